@@ -0,0 +1,100 @@
+#include "utils/enum_set.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <bitset>
+#include <random>
+#include <set>
+#include <vector>
+
+namespace
+{
+	enum class Tech : uint16_t { Count = 256 };
+
+	constexpr size_t cTechsCount = static_cast<size_t>(Tech::Count);
+	constexpr size_t cRequirementsCount = 1024;
+
+	// Tech tree check: is every requirement of an upgrade already researched?
+	struct TechTree
+	{
+		std::vector<std::vector<uint16_t>> requirements;
+		std::vector<uint16_t> researched;
+
+		TechTree()
+		{
+			auto rng = std::mt19937(42);
+			auto tech = std::uniform_int_distribution<uint16_t>(0, cTechsCount - 1);
+			auto count = std::uniform_int_distribution<size_t>(1, 6);
+
+			for (size_t i = 0; i < cRequirementsCount; ++i) {
+				auto &techs = requirements.emplace_back();
+				for (size_t n = count(rng); n > 0; --n) {
+					techs.push_back(tech(rng));
+				}
+			}
+			for (size_t i = 0; i < cTechsCount * 3 / 4; ++i) {
+				researched.push_back(tech(rng));
+			}
+		}
+	};
+
+	template <typename Set, typename InsertFn, typename IsMetFn>
+	void requirementsCheck(benchmark::State &state, InsertFn insert, IsMetFn isMet)
+	{
+		const auto tree = TechTree();
+
+		auto requirements = std::vector<Set>(tree.requirements.size());
+		for (size_t i = 0; i < tree.requirements.size(); ++i) {
+			for (const auto tech : tree.requirements[i]) {
+				insert(requirements[i], tech);
+			}
+		}
+		auto researched = Set{};
+		for (const auto tech : tree.researched) {
+			insert(researched, tech);
+		}
+
+		for (auto _ : state) {
+			size_t available = 0;
+			for (const auto &required : requirements) {
+				available += isMet(required, researched);
+			}
+			benchmark::DoNotOptimize(available);
+		}
+		state.SetItemsProcessed(state.iterations() * requirements.size());
+	}
+
+	void enumSet(benchmark::State &state)
+	{
+		using Techs = enum_set<Tech>;
+		requirementsCheck<Techs>(
+			state,
+			[](Techs &set, uint16_t tech) { set.insert(static_cast<Tech>(tech)); },
+			[](const Techs &required, const Techs &done) { return required.isSubsetOf(done); });
+	}
+
+	void stdBitset(benchmark::State &state)
+	{
+		using Techs = std::bitset<cTechsCount>;
+		requirementsCheck<Techs>(
+			state,
+			[](Techs &set, uint16_t tech) { set.set(tech); },
+			[](const Techs &required, const Techs &done) { return (required & ~done).none(); });
+	}
+
+	void stdSet(benchmark::State &state)
+	{
+		using Techs = std::set<uint16_t>;
+		requirementsCheck<Techs>(
+			state,
+			[](Techs &set, uint16_t tech) { set.insert(tech); },
+			[](const Techs &required, const Techs &done) {
+				return std::includes(done.begin(), done.end(), required.begin(), required.end());
+			});
+	}
+} // namespace
+
+BENCHMARK(enumSet);
+BENCHMARK(stdBitset);
+BENCHMARK(stdSet);
@@ -0,0 +1,73 @@
+#include "scripts/lua/allocators.hpp"
+#include "scripts/lua/runtime.hpp"
+
+#include <benchmark/benchmark.h>
+
+namespace
+{
+	// Unit AI-like churn: short-lived tables, strings and closures that keep the GC busy.
+	const auto gcHeavyChurn = R"(
+		local units = {}
+		for i = 1, 4000 do
+			local unit = { id = i, name = "unit #" .. i, pos = { x = i % 128, y = i % 96 } }
+			unit.distanceTo = function(other)
+				local dx, dy = unit.pos.x - other.pos.x, unit.pos.y - other.pos.y
+				return dx * dx + dy * dy
+			end
+			units[i % 64 + 1] = unit
+		end
+		return #units
+	)";
+
+	void luaGcChurn(benchmark::State &state, lua::memory::Allocator allocator)
+	{
+		LuaRuntime lua(64 * lua::memory::c1MB, allocator);
+		lua.require(sol::lib::base);
+
+		auto chunk = lua.state.load(gcHeavyChurn).get<sol::protected_function>();
+		for (auto _ : state) {
+			auto result = chunk();
+			benchmark::DoNotOptimize(result.valid());
+		}
+		state.counters["used"] = static_cast<double>(lua.getAllocatorState().used);
+	}
+
+	// Between matches: populate a runtime with tens of thousands of objects and reset it.
+	void luaRuntimeReset(benchmark::State &state, lua::memory::Allocator allocator)
+	{
+		LuaRuntime lua(256 * lua::memory::c1MB, allocator);
+
+		for (auto _ : state) {
+			state.PauseTiming();
+			lua.state.script(R"(
+				world = {}
+				for i = 1, 50000 do
+					world[i] = { id = i, tag = "obj" .. i }
+				end
+			)");
+			state.ResumeTiming();
+
+			lua.reset();
+		}
+	}
+} // namespace
+
+BENCHMARK_CAPTURE(luaGcChurn, limitedAlloc, lua::memory::limitedAlloc);
+BENCHMARK_CAPTURE(luaGcChurn, slabAlloc, lua::memory::slabAlloc);
+BENCHMARK_CAPTURE(luaGcChurn, threadCachedAlloc, lua::memory::threadCachedAlloc);
+
+// One runtime per benchmark thread, as on a server running matches on worker threads.
+BENCHMARK_CAPTURE(luaGcChurn, limitedAlloc/parallel, lua::memory::limitedAlloc)
+	->ThreadRange(1, 8)
+	->UseRealTime();
+BENCHMARK_CAPTURE(luaGcChurn, slabAlloc/parallel, lua::memory::slabAlloc)
+	->ThreadRange(1, 8)
+	->UseRealTime();
+BENCHMARK_CAPTURE(luaGcChurn, threadCachedAlloc/parallel, lua::memory::threadCachedAlloc)
+	->ThreadRange(1, 8)
+	->UseRealTime();
+
+BENCHMARK_CAPTURE(luaRuntimeReset, limitedAlloc, lua::memory::limitedAlloc);
+BENCHMARK_CAPTURE(luaRuntimeReset, slabAlloc, lua::memory::slabAlloc);
+BENCHMARK_CAPTURE(luaRuntimeReset, threadCachedAlloc, lua::memory::threadCachedAlloc);
+BENCHMARK_CAPTURE(luaRuntimeReset, arenaAlloc, lua::memory::arenaAlloc);
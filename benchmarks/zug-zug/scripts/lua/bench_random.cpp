@@ -0,0 +1,63 @@
+#include "scripts/lua/runtime.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+namespace
+{
+	// Park-Miller "minimal standard" generator, the kind of PRNG scripts write in pure Lua
+	// when math.random is unavailable.
+	const auto pureLuaDiceRolls = R"(
+		local state = 42
+		local function roll(n)
+			state = (state * 16807) % 2147483647
+			return state % n + 1
+		end
+		local sum = 0
+		for i = 1, 10000 do
+			sum = sum + roll(6)
+		end
+		return sum
+	)";
+
+	const auto nativeDiceRolls = R"(
+		local rng = random.new(42)
+		local sum = 0
+		for i = 1, 10000 do
+			sum = sum + rng:next(6)
+		end
+		return sum
+	)";
+
+	const auto nativeBulkDiceRolls = R"(
+		local rng = random.new(42)
+		local rolls = rng:fill({}, 10000, 6)
+		local sum = 0
+		for i = 1, 10000 do
+			sum = sum + rolls[i]
+		end
+		return sum
+	)";
+
+	void diceRolls(benchmark::State &state, const char *script)
+	{
+		LuaRuntime lua;
+		LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom);
+		(void) sandbox.require(lua::EngineLib::Random);
+
+		// Compiled once, inside the sandbox environment
+		auto rolls = sandbox.run(std::string("return function() ") + script + " end")
+						 .get<sol::protected_function>();
+
+		for (auto _ : state) {
+			auto result = rolls();
+			benchmark::DoNotOptimize(result.valid());
+		}
+		state.SetItemsProcessed(state.iterations() * 10000);
+	}
+} // namespace
+
+BENCHMARK_CAPTURE(diceRolls, pureLua, pureLuaDiceRolls);
+BENCHMARK_CAPTURE(diceRolls, native, nativeDiceRolls);
+BENCHMARK_CAPTURE(diceRolls, nativeBulk, nativeBulkDiceRolls);
@@ -0,0 +1,57 @@
+#include "scripts/lua/runtime.hpp"
+#include "scripts/lua/snapshot.hpp"
+
+#include <benchmark/benchmark.h>
+
+namespace
+{
+	// Game state of the size a match has after a while: units with nested tables and
+	// references between them.
+	const auto world = R"(
+		units = {}
+		for i = 1, 2000 do
+			units[i] = {
+				id = i, hp = 100 - i % 7, owner = i % 4,
+				pos = {x = i * 0.5, y = -i * 0.25},
+				orders = {"move", "attack"},
+			}
+		end
+		for i = 2, 2000 do
+			units[i].target = units[i - 1]
+		end
+	)";
+
+	void snapshotSave(benchmark::State &state)
+	{
+		LuaRuntime lua;
+		LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+		sandbox.run(world);
+
+		auto writer = lua::snapshot::Writer();
+		(void) sandbox.saveSnapshot(writer); // Lets the buffers grow to fit
+
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(sandbox.saveSnapshot(writer));
+		}
+		state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(writer.bytes().size()));
+	}
+
+	void snapshotRestore(benchmark::State &state)
+	{
+		LuaRuntime lua;
+		LuaSandbox source(lua, LuaSandbox::Presets::Minimal);
+		source.run(world);
+
+		auto writer = lua::snapshot::Writer();
+		(void) source.saveSnapshot(writer);
+
+		LuaSandbox target(lua, LuaSandbox::Presets::Minimal);
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(target.restoreSnapshot(writer.bytes()));
+		}
+		state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(writer.bytes().size()));
+	}
+} // namespace
+
+BENCHMARK(snapshotSave);
+BENCHMARK(snapshotRestore);
@@ -0,0 +1,41 @@
+#include "scripts/lua/runtime.hpp"
+
+#include <benchmark/benchmark.h>
+#include <optional>
+
+namespace
+{
+	namespace timeout = lua::timeoutGuard;
+
+	// ~1M VM instructions: FORLOOP + ADD per iteration.
+	const auto tightLoop = R"(
+		local x = 0
+		for i = 1, 500000 do
+			x = x + i
+		end
+		return x
+	)";
+
+	void tightLoopUnderGuard(benchmark::State &state, std::optional<timeout::Mode> mode)
+	{
+		LuaRuntime lua;
+		if (mode) {
+			lua.setTimeoutGuardMode(*mode);
+		}
+		auto chunk = lua.state.load(tightLoop).get<sol::protected_function>();
+
+		for (auto _ : state) {
+			auto guard = mode ? std::optional(lua.makeTimeoutGuardedScope(std::chrono::seconds(10)))
+							  : std::nullopt;
+			auto result = chunk();
+			benchmark::DoNotOptimize(result.valid());
+		}
+		state.counters["Minstructions"] = benchmark::Counter(
+			static_cast<double>(state.iterations()),
+			benchmark::Counter::kIsRate);
+	}
+} // namespace
+
+BENCHMARK_CAPTURE(tightLoopUnderGuard, unguarded, std::nullopt);
+BENCHMARK_CAPTURE(tightLoopUnderGuard, hookMode, timeout::Mode::Hook);
+BENCHMARK_CAPTURE(tightLoopUnderGuard, monitorMode, timeout::Mode::Monitor);
@@ -0,0 +1,28 @@
+if(BUILD_BENCHMARKS)
+    find_package(benchmark CONFIG QUIET)
+    if (NOT benchmark_FOUND)
+        message(STATUS "benchmark not found, fetching with FetchContent...")
+        set(BENCHMARK_ENABLE_TESTING OFF CACHE BOOL "" FORCE)
+        set(BENCHMARK_ENABLE_GTEST_TESTS OFF CACHE BOOL "" FORCE)
+        set(BENCHMARK_ENABLE_INSTALL OFF CACHE BOOL "" FORCE)
+        FetchContent_Declare(
+            benchmark
+            GIT_REPOSITORY https://github.com/google/benchmark.git
+            GIT_TAG        v1.9.4
+        )
+        FetchContent_MakeAvailable(benchmark)
+    endif()
+
+    add_executable(benchmarks
+        benchmarks/zug-zug/scripts/lua/bench_allocators.cpp
+        benchmarks/zug-zug/scripts/lua/bench_random.cpp
+        benchmarks/zug-zug/scripts/lua/bench_snapshot.cpp
+        benchmarks/zug-zug/scripts/lua/bench_timeoutGuard.cpp
+        benchmarks/utils/bench_enum_set.cpp
+    )
+    target_compile_features(benchmarks PRIVATE cxx_std_20)
+    target_link_libraries(benchmarks PRIVATE
+        benchmark::benchmark_main
+        zug-zug::engine
+    )
+endif()
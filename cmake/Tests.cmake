@@ -20,13 +20,33 @@ if(BUILD_TESTING)
 
     add_executable(tests
         tests/main.cpp
+        tests/zug-zug/scripts/lua/test_allocProfiler.cpp
+        tests/zug-zug/scripts/lua/test_chunkCache.cpp
+        tests/zug-zug/scripts/lua/test_fixed.cpp
+        tests/zug-zug/scripts/lua/test_gcPacer.cpp
         tests/zug-zug/scripts/lua/test_limitedAlloc.cpp
+        tests/zug-zug/scripts/lua/test_memoryQuota.cpp
+        tests/zug-zug/scripts/lua/test_precompile.cpp
+        tests/zug-zug/scripts/lua/test_printSink.cpp
+        tests/zug-zug/scripts/lua/test_random.cpp
+        tests/zug-zug/scripts/lua/test_runtimePool.cpp
         tests/zug-zug/scripts/lua/test_sandbox_libs.cpp
+        tests/zug-zug/scripts/lua/test_sandboxPool.cpp
         tests/zug-zug/scripts/lua/test_sandbox_fs.cpp
+        tests/zug-zug/scripts/lua/test_sandboxMemory.cpp
+        tests/zug-zug/scripts/lua/test_scheduler.cpp
+        tests/zug-zug/scripts/lua/test_slabAlloc.cpp
+        tests/zug-zug/scripts/lua/test_snapshot.cpp
+        tests/zug-zug/scripts/lua/test_threadCachedAlloc.cpp
         tests/zug-zug/scripts/lua/test_timeoutGuard.cpp
+        tests/zug-zug/scripts/lua/test_unitColumns.cpp
+        tests/utils/test_enum_map.cpp
+        tests/utils/test_enum_set.cpp
         tests/utils/test_filesystem.cpp
+        tests/utils/test_pack.cpp
     )
     target_compile_features(tests PRIVATE cxx_std_20)
+    target_include_directories(tests PRIVATE tests)
     target_link_libraries(tests PRIVATE
         doctest::doctest
         zug-zug::engine
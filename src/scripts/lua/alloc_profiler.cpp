@@ -0,0 +1,207 @@
+#include "lua/alloc_profiler.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <iterator>
+
+namespace lua::memory
+{
+	namespace
+	{
+		[[nodiscard]]
+		auto metricOf(const AllocSiteStats &stats, AllocProfiler::Metric metric) noexcept
+			-> int64_t
+		{
+			return metric == AllocProfiler::Metric::Live ? stats.liveBytes
+														 : static_cast<int64_t>(stats.totalBytes);
+		}
+
+		void appendFrame(std::string &out, const lua_Debug &ar)
+		{
+			if (std::strcmp(ar.what, "C") == 0) {
+				out += "[C]";
+				if (ar.name != nullptr) {
+					out += ' ';
+					out += ar.name;
+				}
+			} else if (std::strcmp(ar.what, "tail") == 0) {
+				out += "(tail call)";
+			} else {
+				std::format_to(std::back_inserter(out), "{}:{}", ar.short_src, ar.currentline);
+			}
+		}
+	} // namespace
+
+	void AllocProfiler::attach(lua_State *L)
+	{
+		detach();
+		wrapped = lua_getallocf(L, &wrappedData);
+		state = L;
+		lua_setallocf(L, allocate, this);
+	}
+
+	void AllocProfiler::detach() noexcept
+	{
+		if (state == nullptr) {
+			return;
+		}
+		lua_setallocf(state, wrapped, wrappedData);
+		state = nullptr;
+		live.clear(); // The profiler won't see these blocks freed anymore
+	}
+
+	void AllocProfiler::clear()
+	{
+		sites.clear();
+		live.clear();
+		sinceSample = 0;
+		failures = 0;
+	}
+
+	void *AllocProfiler::allocate(void *ud, void *ptr, size_t currSize, size_t newSize) noexcept
+	{
+		auto *profiler = static_cast<AllocProfiler *>(ud);
+		if (profiler->busy) {
+			return profiler->wrapped(profiler->wrappedData, ptr, currSize, newSize);
+		}
+		profiler->busy = true;
+		void *result = profiler->profile(ptr, currSize, newSize);
+		profiler->busy = false;
+		return result;
+	}
+
+	void *AllocProfiler::profile(void *ptr, size_t currSize, size_t newSize) noexcept
+	{
+		if (newSize == 0) {
+			if (ptr != nullptr && !live.empty()) {
+				forget(ptr);
+			}
+			return wrapped(wrappedData, ptr, currSize, newSize);
+		}
+		sinceSample += newSize;
+		const uint64_t samples = sinceSample / interval;
+		sinceSample %= interval;
+
+		// The stack is walked before the wrapped allocator runs: Lua may be growing its
+		// stack or call info array, which stay valid only until the old block is released.
+		Frames frames; // Filled on demand: clearing it for every allocation would cost more
+		if (samples > 0) {
+			captureStack(frames);
+		}
+		void *newPtr = wrapped(wrappedData, ptr, currSize, newSize);
+		if (newPtr == nullptr) {
+			// A failed realloc leaves the old block untouched, so the stack is still readable
+			++failures;
+			if (samples == 0) {
+				captureStack(frames);
+			}
+			try {
+				spdlog::error("Lua allocator: allocation of {} bytes failed at {}",
+							  newSize, foldStack(frames));
+			} catch (...) {
+			}
+			return nullptr;
+		}
+		if (ptr != nullptr && !live.empty()) {
+			forget(ptr); // A resized block is counted anew
+		}
+		if (samples > 0) {
+			record(newPtr, samples * interval, frames);
+		}
+		return newPtr;
+	}
+
+	void AllocProfiler::captureStack(Frames &frames) const noexcept
+	{
+		// Only what can be read without allocating: "S", "l" and "n" just look at the call info.
+		frames.count = 0;
+		while (frames.count < cMaxFrames) {
+			auto &ar = frames.records[static_cast<size_t>(frames.count)];
+			if (lua_getstack(state, frames.count, &ar) == 0) {
+				break;
+			}
+			lua_getinfo(state, "Snl", &ar);
+			++frames.count;
+		}
+	}
+
+	auto AllocProfiler::foldStack(const Frames &frames) -> std::string
+	{
+		if (frames.count == 0) {
+			return "[no Lua code]";
+		}
+		auto stack = std::string{};
+		for (int level = frames.count - 1; level >= 0; --level) {
+			const auto start = stack.size();
+			appendFrame(stack, frames.records[static_cast<size_t>(level)]);
+			// ';' separates frames, so it can't appear inside one (chunk names may have it)
+			std::replace(stack.begin() + static_cast<std::ptrdiff_t>(start), stack.end(), ';', ',');
+			if (level > 0) {
+				stack += ';';
+			}
+		}
+		return stack;
+	}
+
+	void AllocProfiler::record(void *ptr, uint64_t bytes, const Frames &frames) noexcept
+	{
+		try {
+			auto &site = sites[foldStack(frames)];
+			site.samples += 1;
+			site.totalBytes += bytes;
+			site.liveBytes += static_cast<int64_t>(bytes);
+			live.insert_or_assign(ptr, Sample{.site = &site, .bytes = bytes});
+		} catch (...) {
+			// Out of memory outside of Lua: the sample is lost, the allocation is fine
+		}
+	}
+
+	void AllocProfiler::forget(void *ptr) noexcept
+	{
+		const auto it = live.find(ptr);
+		if (it == live.end()) {
+			return;
+		}
+		it->second.site->liveBytes -= static_cast<int64_t>(it->second.bytes);
+		live.erase(it);
+	}
+
+	auto AllocProfiler::hotspots(size_t count, Metric metric) const -> Hotspots
+	{
+		auto bySite = std::unordered_map<std::string_view, AllocSiteStats>{};
+		for (const auto &[stack, stats] : sites) {
+			const auto separator = stack.rfind(';');
+			const auto leaf = separator == std::string::npos
+								? std::string_view(stack)
+								: std::string_view(stack).substr(separator + 1);
+			auto &site = bySite[leaf];
+			site.samples += stats.samples;
+			site.totalBytes += stats.totalBytes;
+			site.liveBytes += stats.liveBytes;
+		}
+		auto result = Hotspots{};
+		result.reserve(bySite.size());
+		for (const auto &[leaf, stats] : bySite) {
+			result.emplace_back(std::string(leaf), stats);
+		}
+		std::ranges::sort(result, [metric](const auto &lhs, const auto &rhs) {
+			return metricOf(lhs.second, metric) > metricOf(rhs.second, metric);
+		});
+		if (result.size() > count) {
+			result.resize(count);
+		}
+		return result;
+	}
+
+	void AllocProfiler::writeFolded(std::ostream &out, Metric metric) const
+	{
+		for (const auto &[stack, stats] : sites) {
+			if (const auto bytes = metricOf(stats, metric); bytes > 0) {
+				out << stack << ' ' << bytes << '\n';
+			}
+		}
+	}
+} // namespace lua::memory
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "lua/sol2.hpp"
+#include "lua/utils.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lua::memory
+{
+	constexpr size_t cDefaultSampleInterval = 64 * 1024;
+
+	struct AllocSiteStats
+	{
+		uint64_t samples{0};
+		uint64_t totalBytes{0}; // Estimated: each sample stands for 'sampleInterval' bytes
+		int64_t liveBytes{0};	// The same estimate, for samples not freed yet
+	};
+
+	// Sampling allocation profiler, layered over the allocator of a Lua state. Every
+	// 'sampleInterval' allocated bytes the Lua call stack is recorded, and the bytes are
+	// attributed to it until the sampled block is freed. An interval of 1 records everything.
+	//
+	// Allocations failing in the wrapped allocator (e.g. when the memory limit is reached)
+	// are logged with the stack that made them, sampled or not.
+	//
+	// The stack is taken from the thread the profiler was attached to: allocations made
+	// inside a coroutine are attributed to the coroutine.resume() call.
+	class AllocProfiler
+	{
+	public:
+		enum class Metric { Total, Live };
+
+		using Stacks = std::unordered_map<std::string, AllocSiteStats>;
+		using Hotspots = std::vector<std::pair<std::string, AllocSiteStats>>;
+
+		static constexpr int cMaxFrames = 32;
+
+		explicit AllocProfiler(size_t sampleInterval = cDefaultSampleInterval)
+			: interval(sampleInterval > 0 ? sampleInterval : 1)
+		{}
+		~AllocProfiler() { detach(); }
+
+		AllocProfiler(const AllocProfiler &) = delete;
+		AllocProfiler &operator=(const AllocProfiler &) = delete;
+		AllocProfiler(AllocProfiler &&) = delete;
+		AllocProfiler &operator=(AllocProfiler &&) = delete;
+
+		// Installs the profiler in front of the current allocator of the state. Blocks
+		// allocated before are handed to that allocator as usual, they just aren't profiled.
+		void attach(lua_State *L);
+		// Puts the wrapped allocator back. Must be done before the state is closed, unless the
+		// profiler outlives it.
+		void detach() noexcept;
+		[[nodiscard]]
+		bool isAttached() const noexcept { return state != nullptr; }
+
+		// Drops the collected data. Live blocks sampled so far are forgotten.
+		void clear();
+
+		[[nodiscard]]
+		size_t sampleInterval() const noexcept { return interval; }
+
+		// Keyed by folded stacks: "source:line" frames from the outermost, joined with ';'
+		[[nodiscard]]
+		auto stacks() const noexcept -> const Stacks & { return sites; }
+
+		// The heaviest call sites (the innermost frames of the stacks), heaviest first.
+		[[nodiscard]]
+		auto hotspots(size_t count, Metric metric = Metric::Total) const -> Hotspots;
+
+		// "frame;frame;frame bytes" lines, as taken by flamegraph.pl and compatible tools.
+		void writeFolded(std::ostream &out, Metric metric = Metric::Total) const;
+
+		[[nodiscard]]
+		uint64_t failedAllocations() const noexcept { return failures; }
+
+	private:
+		struct Sample
+		{
+			AllocSiteStats *site;
+			uint64_t bytes;
+		};
+		struct Frames
+		{
+			std::array<lua_Debug, cMaxFrames> records;
+			int count{0};
+		};
+
+		static void *allocate(void *ud, void *ptr, size_t currSize, size_t newSize) noexcept;
+		void *profile(void *ptr, size_t currSize, size_t newSize) noexcept;
+
+		void captureStack(Frames &frames) const noexcept;
+		[[nodiscard]]
+		static auto foldStack(const Frames &frames) -> std::string;
+
+		void record(void *ptr, uint64_t bytes, const Frames &frames) noexcept;
+		void forget(void *ptr) noexcept;
+
+	private:
+		size_t interval{cDefaultSampleInterval};
+		size_t sinceSample{0}; // Bytes allocated since the last sample
+
+		lua_State *state{nullptr};
+		Allocator wrapped{nullptr};
+		void *wrappedData{nullptr};
+		bool busy{false}; // Reentrancy guard: nothing here may profile itself
+
+		Stacks sites;
+		std::unordered_map<const void *, Sample> live;
+		uint64_t failures{0};
+	};
+} // namespace lua::memory
@@ -0,0 +1,486 @@
+#include "lua/allocators.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <mutex>
+
+namespace lua::memory
+{
+	namespace
+	{
+		struct CachedBlock
+		{
+			CachedBlock *next;
+		};
+
+		// The pool behind all thread caches. Never destroyed: thread caches (and the Lua states
+		// using them) may outlive any static object.
+		class SharedBlockPool
+		{
+		public:
+			[[nodiscard]]
+			static SharedBlockPool &instance()
+			{
+				static auto *pool = new SharedBlockPool();
+				return *pool;
+			}
+
+			// Links up to 'count' blocks of the given size into a list. Returns how many it got.
+			size_t take(size_t blockSize, size_t count, CachedBlock *&list) noexcept
+			{
+				auto lock = std::scoped_lock(mutex);
+				size_t taken = 0;
+				for (; taken < count; ++taken) {
+					auto *block = static_cast<CachedBlock *>(pool.allocate(blockSize));
+					if (block == nullptr) {
+						break;
+					}
+					block->next = list;
+					list = block;
+				}
+				return taken;
+			}
+
+			// Takes back 'count' blocks from the head of the list, or all of it if count is 0.
+			void give(size_t blockSize, size_t count, CachedBlock *&list) noexcept
+			{
+				auto lock = std::scoped_lock(mutex);
+				for (size_t given = 0; list != nullptr && (count == 0 || given < count); ++given) {
+					auto *block = list;
+					list = block->next;
+					pool.deallocate(block, blockSize);
+				}
+			}
+
+		private:
+			std::mutex mutex;
+			SizeClassPool pool{SizeClassPool::Mode::Slab};
+		};
+
+		class ThreadCache
+		{
+		public:
+			static constexpr size_t cClassesCount = SizeClassPool::cClassesCount;
+
+			ThreadCache() = default;
+			~ThreadCache()
+			{
+				flush();
+				destroyed = true;
+			}
+
+			ThreadCache(const ThreadCache &) = delete;
+			ThreadCache &operator=(const ThreadCache &) = delete;
+			ThreadCache(ThreadCache &&) = delete;
+			ThreadCache &operator=(ThreadCache &&) = delete;
+
+			// Null once the cache of the thread is gone, i.e. for frees done by the destructors
+			// of other thread-local objects.
+			[[nodiscard]]
+			static ThreadCache *get() noexcept
+			{
+				thread_local ThreadCache cache;
+				return destroyed ? nullptr : &cache;
+			}
+
+			[[nodiscard]]
+			void *allocate(size_t idx, size_t blockSize) noexcept
+			{
+				auto &list = lists[idx];
+				if (list.head == nullptr) {
+					list.count = SharedBlockPool::instance().take(blockSize, cThreadCacheBatch,
+																  list.head);
+					if (list.count == 0) {
+						return nullptr;
+					}
+				}
+				auto *block = list.head;
+				list.head = block->next;
+				--list.count;
+				return block;
+			}
+
+			void deallocate(void *ptr, size_t idx, size_t blockSize) noexcept
+			{
+				auto &list = lists[idx];
+				auto *block = static_cast<CachedBlock *>(ptr);
+				block->next = list.head;
+				list.head = block;
+				// Keeping a batch after giving one back avoids trading blocks on every other
+				// call when a state allocates and frees around the threshold.
+				if (++list.count >= 2 * cThreadCacheBatch) {
+					SharedBlockPool::instance().give(blockSize, cThreadCacheBatch, list.head);
+					list.count -= cThreadCacheBatch;
+				}
+			}
+
+			void flush() noexcept
+			{
+				for (size_t idx = 0; idx < cClassesCount; ++idx) {
+					if (lists[idx].head != nullptr) {
+						const auto blockSize = (idx + 1) * SizeClassPool::cGranularity;
+						SharedBlockPool::instance().give(blockSize, 0, lists[idx].head);
+						lists[idx].count = 0;
+					}
+				}
+			}
+
+			[[nodiscard]]
+			size_t blocksCount() const noexcept
+			{
+				size_t total = 0;
+				for (const auto &list : lists) {
+					total += list.count;
+				}
+				return total;
+			}
+
+		private:
+			struct FreeList
+			{
+				CachedBlock *head{nullptr};
+				size_t count{0};
+			};
+			std::array<FreeList, cClassesCount> lists{};
+
+			static thread_local bool destroyed;
+		};
+
+		thread_local bool ThreadCache::destroyed = false;
+
+		[[nodiscard]]
+		constexpr size_t cachedClassIndex(size_t size) noexcept
+		{
+			return (size - 1) / SizeClassPool::cGranularity;
+		}
+
+		[[nodiscard]]
+		constexpr size_t cachedClassSize(size_t idx) noexcept
+		{
+			return (idx + 1) * SizeClassPool::cGranularity;
+		}
+
+		[[nodiscard]]
+		void *allocateCached(size_t size) noexcept
+		{
+			if (!SizeClassPool::isSmall(size)) {
+				return std::malloc(size);
+			}
+			const auto idx = cachedClassIndex(size);
+			if (auto *cache = ThreadCache::get()) {
+				return cache->allocate(idx, cachedClassSize(idx));
+			}
+			auto *list = static_cast<CachedBlock *>(nullptr);
+			SharedBlockPool::instance().take(cachedClassSize(idx), 1, list);
+			return list;
+		}
+
+		void deallocateCached(void *ptr, size_t size) noexcept
+		{
+			if (!SizeClassPool::isSmall(size)) {
+				std::free(ptr);
+				return;
+			}
+			const auto idx = cachedClassIndex(size);
+			if (auto *cache = ThreadCache::get()) {
+				cache->deallocate(ptr, idx, cachedClassSize(idx));
+				return;
+			}
+			auto *list = static_cast<CachedBlock *>(ptr);
+			list->next = nullptr;
+			SharedBlockPool::instance().give(cachedClassSize(idx), 1, list);
+		}
+
+		[[nodiscard]]
+		void *reallocateCached(void *ptr, size_t currSize, size_t newSize) noexcept
+		{
+			using Pool = SizeClassPool;
+
+			if (ptr == nullptr) {
+				return allocateCached(newSize);
+			}
+			if (Pool::isSmall(currSize) && Pool::isSmall(newSize)
+				&& cachedClassIndex(currSize) == cachedClassIndex(newSize)) {
+				return ptr;
+			}
+			if (!Pool::isSmall(currSize) && !Pool::isSmall(newSize)) {
+				return std::realloc(ptr, newSize);
+			}
+			void *newPtr = allocateCached(newSize);
+			if (newPtr == nullptr) {
+				return nullptr;
+			}
+			std::memcpy(newPtr, ptr, std::min(currSize, newSize));
+			deallocateCached(ptr, currSize);
+			return newPtr;
+		}
+	} // namespace
+/*-----------------------------------------------------------------------------------------------*/
+	void *SizeClassPool::allocate(size_t size) noexcept
+	{
+		if (!isSmall(size)) {
+			return allocateLarge(size);
+		}
+		const auto idx = classIndex(size);
+		if (auto *block = freeLists[idx]; block != nullptr) {
+			freeLists[idx] = block->next;
+			return block;
+		}
+		return carve(classSize(idx));
+	}
+
+	void SizeClassPool::deallocate(void *ptr, size_t size) noexcept
+	{
+		if (ptr == nullptr || discarding) {
+			return;
+		}
+		if (!isSmall(size)) {
+			deallocateLarge(ptr);
+			return;
+		}
+		const auto idx = classIndex(size);
+		auto *block = static_cast<FreeBlock *>(ptr);
+		block->next = freeLists[idx];
+		freeLists[idx] = block;
+	}
+
+	void *SizeClassPool::reallocate(void *ptr, size_t currSize, size_t newSize) noexcept
+	{
+		if (ptr == nullptr || currSize == 0) {
+			return allocate(newSize);
+		}
+		if (isSmall(currSize) && isSmall(newSize)
+			&& classIndex(currSize) == classIndex(newSize)) {
+			return ptr;
+		}
+		if (!isSmall(currSize) && !isSmall(newSize)) {
+			return reallocateLarge(ptr, newSize);
+		}
+		void *newPtr = allocate(newSize);
+		if (newPtr == nullptr) {
+			return nullptr;
+		}
+		std::memcpy(newPtr, ptr, std::min(currSize, newSize));
+		deallocate(ptr, currSize);
+		return newPtr;
+	}
+
+	void SizeClassPool::release() noexcept
+	{
+		while (largeList != nullptr) {
+			auto *next = largeList->next;
+			std::free(largeList);
+			largeList = next;
+		}
+		while (chunkList != nullptr) {
+			auto *next = chunkList->next;
+			std::free(chunkList);
+			chunkList = next;
+		}
+		freeLists.fill(nullptr);
+		cursor = chunkEnd = nullptr;
+		chunks = 0;
+		discarding = false;
+	}
+
+	void *SizeClassPool::carve(size_t blockSize) noexcept
+	{
+		if (cursor == nullptr || static_cast<size_t>(chunkEnd - cursor) < blockSize) {
+			auto *chunk = static_cast<Chunk *>(std::malloc(cChunkSize));
+			if (chunk == nullptr) {
+				return nullptr;
+			}
+			chunk->next = chunkList;
+			chunkList = chunk;
+			++chunks;
+
+			// The tail of the previous chunk is too short for this class and is left unused.
+			cursor = reinterpret_cast<std::byte *>(chunk) + sizeof(Chunk);
+			chunkEnd = reinterpret_cast<std::byte *>(chunk) + cChunkSize;
+		}
+		void *block = cursor;
+		cursor += blockSize;
+		return block;
+	}
+
+	void *SizeClassPool::allocateLarge(size_t size) noexcept
+	{
+		if (!ownsLargeBlocks()) {
+			return std::malloc(size);
+		}
+		if (size > std::numeric_limits<size_t>::max() - sizeof(LargeBlock)) {
+			return nullptr;
+		}
+		auto *block = static_cast<LargeBlock *>(std::malloc(sizeof(LargeBlock) + size));
+		if (block == nullptr) {
+			return nullptr;
+		}
+		link(block);
+		return block + 1;
+	}
+
+	void SizeClassPool::deallocateLarge(void *ptr) noexcept
+	{
+		if (!ownsLargeBlocks()) {
+			std::free(ptr);
+			return;
+		}
+		auto *block = static_cast<LargeBlock *>(ptr) - 1;
+		unlink(block);
+		std::free(block);
+	}
+
+	void *SizeClassPool::reallocateLarge(void *ptr, size_t newSize) noexcept
+	{
+		if (!ownsLargeBlocks()) {
+			return std::realloc(ptr, newSize);
+		}
+		if (newSize > std::numeric_limits<size_t>::max() - sizeof(LargeBlock)) {
+			return nullptr;
+		}
+		auto *block = static_cast<LargeBlock *>(ptr) - 1;
+		unlink(block);
+		auto *newBlock =
+			static_cast<LargeBlock *>(std::realloc(block, sizeof(LargeBlock) + newSize));
+		if (newBlock == nullptr) {
+			link(block);
+			return nullptr;
+		}
+		link(newBlock);
+		return newBlock + 1;
+	}
+
+	void SizeClassPool::link(LargeBlock *block) noexcept
+	{
+		block->prev = nullptr;
+		block->next = largeList;
+		if (largeList != nullptr) {
+			largeList->prev = block;
+		}
+		largeList = block;
+	}
+
+	void SizeClassPool::unlink(LargeBlock *block) noexcept
+	{
+		if (block->prev != nullptr) {
+			block->prev->next = block->next;
+		} else {
+			largeList = block->next;
+		}
+		if (block->next != nullptr) {
+			block->next->prev = block->prev;
+		}
+	}
+/*-----------------------------------------------------------------------------------------------*/
+	void *slabAlloc(void *ud, void *ptr, size_t currSize, size_t newSize) noexcept
+	{
+		auto *allocState = static_cast<LimitedAllocatorState*>(ud);
+
+		if (allocState == nullptr || allocState->pool == nullptr) {
+			assert((allocState != nullptr && allocState->pool != nullptr)
+				   && "Allocator state with an attached size-class pool must be provided.");
+			return nullptr;
+		}
+		auto &pool = *allocState->pool;
+
+		if (ptr == nullptr) {
+			currSize = 0;
+		}
+		if (newSize == 0) {
+			if (ptr != nullptr) {
+				releaseUsage(*allocState, currSize);
+				pool.deallocate(ptr, currSize);
+			}
+			return nullptr;
+		}
+		const auto newUsed = reserveUsage(*allocState, currSize, newSize);
+		if (!newUsed) {
+			return nullptr;
+		}
+		void *newPtr = pool.reallocate(ptr, currSize, newSize);
+		if (newPtr != nullptr) {
+			allocState->used = *newUsed;
+		}
+		return newPtr;
+	}
+
+	void *arenaAlloc(void *ud, void *ptr, size_t currSize, size_t newSize) noexcept
+	{
+		auto *allocState = static_cast<LimitedAllocatorState*>(ud);
+
+		if (allocState == nullptr || allocState->pool == nullptr
+			|| !allocState->pool->ownsLargeBlocks()) {
+			assert((allocState != nullptr && allocState->pool != nullptr
+					&& allocState->pool->ownsLargeBlocks())
+				   && "Allocator state with an attached region must be provided.");
+			return nullptr;
+		}
+		auto &region = *allocState->pool;
+
+		if (ptr == nullptr) {
+			currSize = 0;
+		}
+		if (newSize == 0) {
+			// While the region is being torn down the usage is rebased by the owner instead.
+			if (ptr != nullptr && !region.discardsFrees()) {
+				releaseUsage(*allocState, currSize);
+				region.deallocate(ptr, currSize);
+			}
+			return nullptr;
+		}
+		const auto newUsed = reserveUsage(*allocState, currSize, newSize);
+		if (!newUsed) {
+			return nullptr;
+		}
+		void *newPtr = region.reallocate(ptr, currSize, newSize);
+		if (newPtr != nullptr) {
+			allocState->used = *newUsed;
+		}
+		return newPtr;
+	}
+
+	void *threadCachedAlloc(void *ud, void *ptr, size_t currSize, size_t newSize) noexcept
+	{
+		auto *allocState = static_cast<LimitedAllocatorState*>(ud);
+
+		if (allocState == nullptr) {
+			assert((allocState != nullptr) && "Pointer to the allocator state must be provided.");
+			return nullptr;
+		}
+		if (ptr == nullptr) {
+			currSize = 0;
+		}
+		if (newSize == 0) {
+			if (ptr != nullptr) {
+				releaseUsage(*allocState, currSize);
+				deallocateCached(ptr, currSize);
+			}
+			return nullptr;
+		}
+		const auto newUsed = reserveUsage(*allocState, currSize, newSize);
+		if (!newUsed) {
+			return nullptr;
+		}
+		void *newPtr = reallocateCached(ptr, currSize, newSize);
+		if (newPtr != nullptr) {
+			allocState->used = *newUsed;
+		}
+		return newPtr;
+	}
+
+	void flushThreadCache() noexcept
+	{
+		if (auto *cache = ThreadCache::get()) {
+			cache->flush();
+		}
+	}
+
+	size_t threadCachedBlocks() noexcept
+	{
+		const auto *cache = ThreadCache::get();
+		return cache != nullptr ? cache->blocksCount() : 0;
+	}
+} // namespace lua::memory
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "lua/utils.hpp"
+
+#include <array>
+#include <cstddef>
+#include <memory>
+
+namespace lua::memory
+{
+	// Size-class pool for small Lua objects (tables, short strings, closures, upvalues).
+	// Blocks up to cMaxBlockSize bytes are carved from cChunkSize chunks and recycled through
+	// per-class free lists; larger blocks go straight to the system allocator.
+	// Lua always passes the real block size on free/realloc, so no per-block header is needed.
+	//
+	// In the Region mode the pool also owns the large blocks (linked through a small header),
+	// so release() drops everything ever allocated from it in O(chunks + large blocks).
+	class SizeClassPool
+	{
+	public:
+		enum class Mode { Slab, Region };
+
+		static constexpr size_t cGranularity = 16;
+		static constexpr size_t cMaxBlockSize = 512;
+		static constexpr size_t cClassesCount = cMaxBlockSize / cGranularity;
+		static constexpr size_t cChunkSize = 64L * 1024;
+
+		explicit SizeClassPool(Mode mode = Mode::Slab) : mode(mode) {}
+		~SizeClassPool() { release(); }
+
+		SizeClassPool(const SizeClassPool &) = delete;
+		SizeClassPool &operator=(const SizeClassPool &) = delete;
+		SizeClassPool(SizeClassPool &&) = delete;
+		SizeClassPool &operator=(SizeClassPool &&) = delete;
+
+		[[nodiscard]]
+		void *allocate(size_t size) noexcept;
+		void deallocate(void *ptr, size_t size) noexcept;
+		[[nodiscard]]
+		void *reallocate(void *ptr, size_t currSize, size_t newSize) noexcept;
+
+		// Returns all chunks to the system. Every small block handed out before becomes invalid,
+		// as well as the large ones in the Region mode.
+		void release() noexcept;
+
+		// Turns deallocate() into a no-op. Used to tear a Lua state down in the Region mode,
+		// where the memory is going to be dropped as a whole by release() anyway.
+		void discardFrees() noexcept { discarding = true; }
+		[[nodiscard]]
+		bool discardsFrees() const noexcept { return discarding; }
+
+		[[nodiscard]]
+		bool ownsLargeBlocks() const noexcept { return mode == Mode::Region; }
+
+		[[nodiscard]]
+		static constexpr bool isSmall(size_t size) noexcept { return size <= cMaxBlockSize; }
+
+		[[nodiscard]]
+		size_t chunksCount() const noexcept { return chunks; }
+		[[nodiscard]]
+		size_t reservedBytes() const noexcept { return chunks * cChunkSize; }
+
+	private:
+		struct FreeBlock
+		{
+			FreeBlock *next;
+		};
+		struct alignas(std::max_align_t) Chunk
+		{
+			Chunk *next;
+		};
+		struct alignas(std::max_align_t) LargeBlock
+		{
+			LargeBlock *prev;
+			LargeBlock *next;
+		};
+
+		[[nodiscard]]
+		static constexpr size_t classIndex(size_t size) noexcept
+		{
+			return (size - 1) / cGranularity;
+		}
+		[[nodiscard]]
+		static constexpr size_t classSize(size_t idx) noexcept { return (idx + 1) * cGranularity; }
+
+		[[nodiscard]]
+		void *carve(size_t blockSize) noexcept;
+
+		[[nodiscard]]
+		void *allocateLarge(size_t size) noexcept;
+		void deallocateLarge(void *ptr) noexcept;
+		[[nodiscard]]
+		void *reallocateLarge(void *ptr, size_t newSize) noexcept;
+
+		void link(LargeBlock *block) noexcept;
+		void unlink(LargeBlock *block) noexcept;
+
+	private:
+		Mode mode{Mode::Slab};
+		bool discarding{false};
+
+		std::array<FreeBlock *, cClassesCount> freeLists{};
+		Chunk *chunkList{nullptr};
+		std::byte *cursor{nullptr};
+		std::byte *chunkEnd{nullptr};
+		size_t chunks{0};
+
+		LargeBlock *largeList{nullptr}; // Region mode only
+	};
+
+	// lua_Alloc backed by the SizeClassPool attached to LimitedAllocatorState::pool.
+	// Accounting is identical to limitedAlloc: 'used' counts requested bytes, not pool overhead.
+	void *slabAlloc(void *ud, void *ptr, size_t currSize, size_t newSize) noexcept;
+
+	// lua_Alloc backed by a Region mode SizeClassPool. Everything a Lua state allocated through it
+	// can be released in one step, which LuaRuntime::reset() relies on to avoid freeing the old
+	// state object by object.
+	void *arenaAlloc(void *ud, void *ptr, size_t currSize, size_t newSize) noexcept;
+
+	// lua_Alloc for states running on worker threads. Small blocks come from a free list per size
+	// class cached by the calling thread, which trades blocks with a process-wide pool
+	// cThreadCacheBatch at a time, so malloc and the pool lock stay off the hot path.
+	// Blocks may be freed by another thread than the one which allocated them (e.g. a runtime
+	// moved to another worker): they just join that thread's cache.
+	// Accounting is identical to limitedAlloc; LimitedAllocatorState::pool isn't used.
+	//
+	// The process-wide pool keeps its chunks until the process ends.
+	void *threadCachedAlloc(void *ud, void *ptr, size_t currSize, size_t newSize) noexcept;
+
+	constexpr size_t cThreadCacheBatch = 32;
+
+	// Returns every block cached by the calling thread to the process-wide pool, e.g. when a
+	// worker goes idle. Done automatically when the thread exits.
+	void flushThreadCache() noexcept;
+	// Blocks cached by the calling thread, all size classes together.
+	[[nodiscard]]
+	size_t threadCachedBlocks() noexcept;
+
+	[[nodiscard]]
+	constexpr bool usesSizeClassPool(Allocator fn) noexcept
+	{
+		return fn == slabAlloc || fn == arenaAlloc;
+	}
+
+	[[nodiscard]]
+	inline auto makePoolFor(Allocator fn) -> std::unique_ptr<SizeClassPool>
+	{
+		if (!usesSizeClassPool(fn)) {
+			return nullptr;
+		}
+		using Mode = SizeClassPool::Mode;
+		return std::make_unique<SizeClassPool>(fn == arenaAlloc ? Mode::Region : Mode::Slab);
+	}
+} // namespace lua::memory
@@ -0,0 +1,95 @@
+#include "lua/chunk_cache.hpp"
+
+#include <spdlog/spdlog.h>
+
+namespace lua
+{
+	namespace
+	{
+		int appendToString(lua_State* /*L*/, const void *data, size_t size, void *ud)
+		{
+			static_cast<std::string *>(ud)->append(static_cast<const char *>(data), size);
+			return 0;
+		}
+	} // namespace
+
+	ChunkCache &ChunkCache::global()
+	{
+		static ChunkCache cache;
+		return cache;
+	}
+
+	auto ChunkCache::find(sol::state_view lua,
+						  const fs::path &file,
+						  const fs_utils::FileStamp &stamp)
+		-> std::optional<sol::protected_function>
+	{
+		const auto key = keyFor(file);
+
+		auto bytecode = std::shared_ptr<const std::string>{};
+		{
+			const auto lock = std::scoped_lock(mutex);
+
+			if (const auto it = entries.find(key); it != entries.end()) {
+				if (it->second.stamp == stamp) {
+					bytecode = it->second.bytecode;
+				} else {
+					entries.erase(it);
+				}
+			}
+		}
+		if (!bytecode) {
+			++misses;
+			return std::nullopt;
+		}
+		// The chunk name is stored in the dump, it's passed only for the error messages.
+		const auto chunkName = "@" + key;
+		if (luaL_loadbuffer(lua, bytecode->data(), bytecode->size(), chunkName.c_str()) != 0) {
+			spdlog::error("Unable to load cached chunk for '{}': {}", key, lua_tostring(lua, -1));
+			lua_pop(lua, 1);
+			++misses;
+			return std::nullopt;
+		}
+		auto chunk = sol::protected_function(lua, -1);
+		lua_pop(lua, 1);
+
+		++hits;
+		return chunk;
+	}
+
+	void ChunkCache::store(const fs::path &file,
+						   const fs_utils::FileStamp &stamp,
+						   const sol::protected_function &chunk)
+	{
+		lua_State *L = chunk.lua_state();
+
+		auto bytecode = std::make_shared<std::string>();
+		chunk.push(L);
+		const int status = lua_dump(L, appendToString, bytecode.get());
+		lua_pop(L, 1);
+
+		if (status != 0) {
+			return;
+		}
+		const auto lock = std::scoped_lock(mutex);
+		entries.insert_or_assign(keyFor(file), Entry{.stamp = stamp, .bytecode = bytecode});
+	}
+
+	void ChunkCache::erase(const fs::path &file)
+	{
+		const auto lock = std::scoped_lock(mutex);
+		entries.erase(keyFor(file));
+	}
+
+	void ChunkCache::clear()
+	{
+		const auto lock = std::scoped_lock(mutex);
+		entries.clear();
+	}
+
+	size_t ChunkCache::size() const
+	{
+		const auto lock = std::scoped_lock(mutex);
+		return entries.size();
+	}
+} // namespace lua
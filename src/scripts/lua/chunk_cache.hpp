@@ -0,0 +1,77 @@
+#pragma once
+
+#include "lua/sol2.hpp"
+
+#include "utils/filesystem.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace lua
+{
+	// In-memory cache of compiled script files, shared between runtimes and threads.
+	// Chunks are kept as lua_dump() output only in memory, so loading precompiled files from disk
+	// is still forbidden. An entry is valid while its file keeps the same modification time and
+	// size; a hit skips reading the file and parsing it. Runtimes get the stamps from their stat
+	// cache (see LuaRuntime::setStatCacheTtl()), so a hit makes no system call either and
+	// a rewritten file is compiled again once its stamp expires or is invalidated.
+	class ChunkCache
+	{
+	public:
+		struct Stats
+		{
+			size_t hits{0};
+			size_t misses{0};
+		};
+
+		static ChunkCache &global();
+
+		ChunkCache() = default;
+		~ChunkCache() = default;
+
+		ChunkCache(const ChunkCache &) = delete;
+		ChunkCache &operator=(const ChunkCache &) = delete;
+		ChunkCache(ChunkCache &&) = delete;
+		ChunkCache &operator=(ChunkCache &&) = delete;
+
+		[[nodiscard]]
+		auto find(sol::state_view lua, const fs::path &file, const fs_utils::FileStamp &stamp)
+			-> std::optional<sol::protected_function>;
+
+		void store(const fs::path &file,
+				   const fs_utils::FileStamp &stamp,
+				   const sol::protected_function &chunk);
+
+		void erase(const fs::path &file);
+		void clear();
+
+		[[nodiscard]]
+		size_t size() const;
+		[[nodiscard]]
+		auto stats() const noexcept -> Stats { return {.hits = hits, .misses = misses}; }
+		void resetStats() noexcept { hits = misses = 0; }
+
+		[[nodiscard]]
+		static auto keyFor(const fs::path &file) -> std::string
+		{
+			return fs_utils::normalize(file).string();
+		}
+
+	private:
+		struct Entry
+		{
+			fs_utils::FileStamp stamp{};
+			std::shared_ptr<const std::string> bytecode{};
+		};
+
+		mutable std::mutex mutex;
+		std::unordered_map<std::string, Entry> entries;
+
+		std::atomic<size_t> hits{0};
+		std::atomic<size_t> misses{0};
+	};
+} // namespace lua
@@ -0,0 +1,15 @@
+#include "lua/engine_libs.hpp"
+#include "lua/fixed.hpp"
+#include "lua/random.hpp"
+
+namespace lua
+{
+	auto makeEngineLib(sol::state_view lua, EngineLib lib) -> sol::table
+	{
+		switch (lib) {
+			case EngineLib::Fixed: return fixed::makeLib(lua);
+			case EngineLib::Random: return random::makeLib(lua);
+			default: return sol::table{};
+		}
+	}
+} // namespace lua
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "lua/sol2.hpp"
+
+#include <string_view>
+
+namespace lua
+{
+	// Native libs of the engine. Sandboxes load them like the standard ones: as read-only
+	// tables shared by every sandbox of a runtime.
+	enum class EngineLib { Fixed, Random, Count };
+
+	[[nodiscard]]
+	constexpr auto engineLibName(EngineLib lib) noexcept -> std::string_view
+	{
+		switch (lib) {
+			case EngineLib::Fixed: return "fixed";
+			case EngineLib::Random: return "random";
+			default: return "";
+		}
+	}
+
+	[[nodiscard]]
+	auto makeEngineLib(sol::state_view lua, EngineLib lib) -> sol::table;
+} // namespace lua
@@ -0,0 +1,129 @@
+#include "lua/fixed.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace lua::fixed
+{
+	namespace
+	{
+		[[nodiscard]]
+		Fixed checkFixed(lua_State *L, int arg)
+		{
+			const lua_Number value = luaL_checknumber(L, arg);
+			luaL_argcheck(L,
+						  std::floor(value) == value && value >= cMin && value <= cMax,
+						  arg,
+						  "fixed-point value expected");
+			return static_cast<Fixed>(value);
+		}
+
+		int push(lua_State *L, Fixed value)
+		{
+			lua_pushnumber(L, static_cast<lua_Number>(value));
+			return 1;
+		}
+
+		// Conversion of a Lua number is exact for integers. Fractions go through a single
+		// IEEE-754 multiplication and a floor, which give the same result everywhere.
+		int from(lua_State *L)
+		{
+			const lua_Number value = luaL_checknumber(L, 1);
+			const lua_Number scaled = std::floor(value * cOne + 0.5);
+			luaL_argcheck(L, scaled >= cMin && scaled <= cMax, 1, "out of fixed-point range");
+			return push(L, static_cast<Fixed>(scaled));
+		}
+
+		int ratio(lua_State *L)
+		{
+			const Fixed num = checkFixed(L, 1);
+			const Fixed den = checkFixed(L, 2);
+			luaL_argcheck(L, den != 0, 2, "division by zero");
+			return push(L, saturate(int64_t{num} * cOne / den));
+		}
+
+		int toNumber(lua_State *L)
+		{
+			lua_pushnumber(L, static_cast<lua_Number>(checkFixed(L, 1)) / cOne);
+			return 1;
+		}
+
+		int floor(lua_State *L)
+		{
+			lua_pushinteger(L, static_cast<lua_Integer>(checkFixed(L, 1) >> cFractionBits));
+			return 1;
+		}
+
+		int ceil(lua_State *L)
+		{
+			const int64_t value = checkFixed(L, 1);
+			lua_pushinteger(L, static_cast<lua_Integer>((value + cOne - 1) >> cFractionBits));
+			return 1;
+		}
+
+		int mul(lua_State *L)
+		{
+			return push(L, fixed::mul(checkFixed(L, 1), checkFixed(L, 2)));
+		}
+
+		int div(lua_State *L)
+		{
+			const Fixed lhs = checkFixed(L, 1);
+			const Fixed rhs = checkFixed(L, 2);
+			luaL_argcheck(L, rhs != 0, 2, "division by zero");
+			return push(L, fixed::div(lhs, rhs));
+		}
+
+		int sqrt(lua_State *L)
+		{
+			return push(L, fixed::sqrt(checkFixed(L, 1)));
+		}
+
+		int sin(lua_State *L)
+		{
+			return push(L, fixed::sin(checkFixed(L, 1)));
+		}
+
+		int cos(lua_State *L)
+		{
+			return push(L, fixed::cos(checkFixed(L, 1)));
+		}
+
+		int abs(lua_State *L)
+		{
+			return push(L, saturate(std::abs(int64_t{checkFixed(L, 1)})));
+		}
+
+		int min(lua_State *L)
+		{
+			return push(L, std::min(checkFixed(L, 1), checkFixed(L, 2)));
+		}
+
+		int max(lua_State *L)
+		{
+			return push(L, std::max(checkFixed(L, 1), checkFixed(L, 2)));
+		}
+	} // namespace
+
+	auto makeLib(sol::state_view lua) -> sol::table
+	{
+		auto lib = lua.create_table();
+		lib["from"] = static_cast<lua_CFunction>(from);
+		lib["ratio"] = static_cast<lua_CFunction>(ratio);
+		lib["toNumber"] = static_cast<lua_CFunction>(toNumber);
+		lib["floor"] = static_cast<lua_CFunction>(floor);
+		lib["ceil"] = static_cast<lua_CFunction>(ceil);
+		lib["mul"] = static_cast<lua_CFunction>(mul);
+		lib["div"] = static_cast<lua_CFunction>(div);
+		lib["sqrt"] = static_cast<lua_CFunction>(sqrt);
+		lib["sin"] = static_cast<lua_CFunction>(sin);
+		lib["cos"] = static_cast<lua_CFunction>(cos);
+		lib["abs"] = static_cast<lua_CFunction>(abs);
+		lib["min"] = static_cast<lua_CFunction>(min);
+		lib["max"] = static_cast<lua_CFunction>(max);
+		lib["one"] = cOne;
+		lib["pi"] = cPi;
+		lib["halfPi"] = cHalfPi;
+		return lib;
+	}
+} // namespace lua::fixed
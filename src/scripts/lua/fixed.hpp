@@ -0,0 +1,161 @@
+#pragma once
+
+#include "lua/sol2.hpp"
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+// Q16.16 fixed-point math with results that are bit-identical on every platform and compiler:
+// only integer arithmetic is used, trigonometry comes from a table computed the same way.
+namespace lua::fixed
+{
+	using Fixed = int32_t; // Raw value: the number multiplied by 2^16
+
+	constexpr int cFractionBits = 16;
+	constexpr Fixed cOne = Fixed{1} << cFractionBits;
+	constexpr Fixed cMax = std::numeric_limits<Fixed>::max();
+	constexpr Fixed cMin = std::numeric_limits<Fixed>::min();
+	constexpr Fixed cPi = 205887;	 // round(pi * 2^16)
+	constexpr Fixed cHalfPi = 102944; // round(pi / 2 * 2^16)
+
+	[[nodiscard]]
+	constexpr Fixed saturate(int64_t value) noexcept
+	{
+		return value > cMax ? cMax : value < cMin ? cMin : static_cast<Fixed>(value);
+	}
+
+	[[nodiscard]]
+	constexpr Fixed fromInt(int64_t value) noexcept
+	{
+		return saturate(value * cOne);
+	}
+
+	// Rounded to the nearest, halves away from zero
+	[[nodiscard]]
+	constexpr Fixed mul(Fixed lhs, Fixed rhs) noexcept
+	{
+		const int64_t product = int64_t{lhs} * rhs;
+		const int64_t half = int64_t{1} << (cFractionBits - 1);
+		return saturate(product >= 0 ? (product + half) >> cFractionBits
+									 : -((-product + half) >> cFractionBits));
+	}
+
+	// Truncated toward zero. The divisor must not be zero.
+	[[nodiscard]]
+	constexpr Fixed div(Fixed lhs, Fixed rhs) noexcept
+	{
+		return saturate((int64_t{lhs} * cOne) / rhs);
+	}
+
+	// Floor of the square root; negative values give zero.
+	[[nodiscard]]
+	constexpr Fixed sqrt(Fixed value) noexcept
+	{
+		if (value <= 0) {
+			return 0;
+		}
+		// sqrt(v * 2^16) * 2^8 == sqrt(v * 2^32): the root of the raw value scaled once more
+		uint64_t rest = uint64_t(value) << cFractionBits;
+		uint64_t root = 0;
+		uint64_t bit = uint64_t{1} << 62;
+		while (bit > rest) {
+			bit >>= 2;
+		}
+		while (bit != 0) {
+			if (rest >= root + bit) {
+				rest -= root + bit;
+				root = (root >> 1) + bit;
+			} else {
+				root >>= 1;
+			}
+			bit >>= 2;
+		}
+		return static_cast<Fixed>(root);
+	}
+
+	namespace detail
+	{
+		constexpr int cSineTableBits = 8; // Entries per quarter wave
+		constexpr int cSineTableSize = 1 << cSineTableBits;
+
+		// sin(pi/2 * i / cSineTableSize) in Q16.16, from a Taylor series evaluated in Q2.30
+		// integers: the table doesn't depend on the floating-point unit of the build machine.
+		consteval auto makeSineTable() -> std::array<Fixed, cSineTableSize + 1>
+		{
+			constexpr int64_t cUnit = int64_t{1} << 30;
+			constexpr int64_t cHalfPiQ30 = 1686629713; // round(pi / 2 * 2^30)
+
+			auto table = std::array<Fixed, cSineTableSize + 1>{};
+			for (int i = 0; i <= cSineTableSize; ++i) {
+				const int64_t x = cHalfPiQ30 * i / cSineTableSize;
+				const int64_t xSq = x * x / cUnit;
+				int64_t term = x;
+				int64_t sum = x;
+				for (int n = 1; n <= 8; ++n) {
+					term = -term * xSq / cUnit / ((2 * n) * (2 * n + 1));
+					sum += term;
+				}
+				table[i] = static_cast<Fixed>((sum + (int64_t{1} << 13)) >> 14);
+			}
+			return table;
+		}
+		constexpr auto cSineTable = makeSineTable();
+
+		constexpr int cPhaseBits = 24;
+		constexpr int cQuarterBits = cPhaseBits - 2;
+
+		// Angle in 2^-24 turns, wrapping around
+		[[nodiscard]]
+		constexpr uint32_t toPhase(Fixed radians) noexcept
+		{
+			constexpr int64_t cTurnsPerRadianQ32 = 683565276; // round(2^32 / (2 * pi))
+			constexpr int cShift = cFractionBits + 32 - cPhaseBits;
+			return static_cast<uint32_t>((int64_t{radians} * cTurnsPerRadianQ32) >> cShift)
+				 & ((1u << cPhaseBits) - 1);
+		}
+
+		[[nodiscard]]
+		constexpr Fixed sineOfPhase(uint32_t phase) noexcept
+		{
+			constexpr int cFracBits = cQuarterBits - cSineTableBits;
+
+			const uint32_t quarter = (phase >> cQuarterBits) & 3;
+			uint32_t offset = phase & ((1u << cQuarterBits) - 1);
+			if (quarter & 1) {
+				offset = (1u << cQuarterBits) - offset; // Falling half of the hump
+			}
+			const uint32_t idx = offset >> cFracBits;
+			const int32_t frac = static_cast<int32_t>(offset & ((1u << cFracBits) - 1));
+
+			Fixed value = cSineTable[idx];
+			if (frac != 0) {
+				value += ((cSineTable[idx + 1] - cSineTable[idx]) * frac) >> cFracBits;
+			}
+			return quarter >= 2 ? -value : value;
+		}
+	} // namespace detail
+
+	[[nodiscard]]
+	constexpr Fixed sin(Fixed radians) noexcept
+	{
+		return detail::sineOfPhase(detail::toPhase(radians));
+	}
+
+	[[nodiscard]]
+	constexpr Fixed cos(Fixed radians) noexcept
+	{
+		return detail::sineOfPhase(detail::toPhase(radians) + (1u << detail::cQuarterBits));
+	}
+
+	// Table of the 'fixed' lib. Fixed-point values are plain Lua numbers holding the raw
+	// value, so +, -, comparisons and multiplying by integers stay exact and cost nothing.
+	// Plain '/' yields non-integral raw values that the lib functions reject: divide with
+	// fixed.div(f, fixed.from(n)), or fixed.ratio(a, b) for integers. The whole lib:
+	//   fixed.from(n), fixed.ratio(a, b), fixed.toNumber(f), fixed.floor(f), fixed.ceil(f)
+	//   fixed.mul(a, b), fixed.div(a, b), fixed.sqrt(f), fixed.sin(f), fixed.cos(f)
+	//   fixed.abs(f), fixed.min(a, b), fixed.max(a, b)
+	//   fixed.one, fixed.pi, fixed.halfPi
+	[[nodiscard]]
+	auto makeLib(sol::state_view lua) -> sol::table;
+} // namespace lua::fixed
@@ -0,0 +1,175 @@
+#include "lua/gc_pacer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace lua::gc
+{
+	namespace
+	{
+		using Clock = time::steady_clock;
+
+		[[nodiscard]]
+		size_t heapSize(lua_State *L) noexcept
+		{
+			return (static_cast<size_t>(lua_gc(L, LUA_GCCOUNT, 0)) << 10)
+				 + static_cast<size_t>(lua_gc(L, LUA_GCCOUNTB, 0));
+		}
+	} // namespace
+/*-----------------------------------------------------------------------------------------------*/
+	void PauseHistogram::add(time::nanoseconds pause) noexcept
+	{
+		++counts[bucketOf(pause)];
+		++total;
+		longest = std::max(longest, pause);
+		spent += pause;
+	}
+
+	auto PauseHistogram::percentile(double fraction) const noexcept -> time::microseconds
+	{
+		if (total == 0) {
+			return time::microseconds{0};
+		}
+		const double clamped = std::clamp(fraction, 0.0, 1.0);
+		const auto wanted = static_cast<uint64_t>(std::ceil(clamped * static_cast<double>(total)));
+		uint64_t seen = 0;
+		for (size_t idx = 0; idx < cBuckets; ++idx) {
+			seen += counts[idx];
+			if (seen >= std::max<uint64_t>(wanted, 1)) {
+				return time::microseconds{uint64_t{1} << idx};
+			}
+		}
+		return time::microseconds{uint64_t{1} << (cBuckets - 1)};
+	}
+/*-----------------------------------------------------------------------------------------------*/
+	void Pacer::enable(lua_State *L) noexcept
+	{
+		enabled = true;
+		automatic = false;
+		lua_gc(L, LUA_GCSTOP, 0);
+	}
+
+	void Pacer::disable(lua_State *L) noexcept
+	{
+		enabled = false;
+		automatic = false;
+		lua_gc(L, LUA_GCRESTART, 0);
+	}
+
+	void Pacer::attach(lua_State *L) noexcept
+	{
+		liveAfterCycle = 0;
+		if (enabled) {
+			enable(L);
+		}
+	}
+
+	bool Pacer::step(lua_State *L, int stepSize) noexcept
+	{
+		const bool cycleEnded = lua_gc(L, LUA_GCSTEP, stepSize) == 1;
+		if (cycleEnded) {
+			noteCycleEnd(L);
+		}
+		if (enabled && !automatic) {
+			lua_gc(L, LUA_GCSTOP, 0);
+		}
+		return cycleEnded;
+	}
+
+	void Pacer::collect(lua_State *L) noexcept
+	{
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		noteCycleEnd(L);
+		if (enabled && !automatic) {
+			lua_gc(L, LUA_GCSTOP, 0);
+		}
+	}
+
+	double Pacer::pressure(lua_State *L,
+						   const memory::LimitedAllocatorState *allocator) const noexcept
+	{
+		if (allocator != nullptr && allocator->isLimitEnabled()) {
+			return static_cast<double>(allocator->used) / static_cast<double>(allocator->limit);
+		}
+		if (liveAfterCycle == 0) {
+			return 0.0;
+		}
+		// The automatic collector starts a cycle once the heap doubles (the default pause)
+		return static_cast<double>(heapSize(L)) / (2.0 * static_cast<double>(liveAfterCycle));
+	}
+
+	auto Pacer::budgetFor(double pressure) const noexcept -> time::nanoseconds
+	{
+		const auto budget = time::duration_cast<time::nanoseconds>(settings.budget);
+		if (pressure <= settings.softPressure || settings.hardPressure <= settings.softPressure) {
+			return budget;
+		}
+		const double excess = std::min(1.0, (pressure - settings.softPressure)
+												/ (settings.hardPressure - settings.softPressure));
+		const double scale = 1.0 + excess * (cMaxBudgetScale - 1);
+		return time::nanoseconds{static_cast<int64_t>(static_cast<double>(budget.count()) * scale)};
+	}
+
+	void Pacer::noteCycleEnd(lua_State *L) noexcept
+	{
+		++stats.cycles;
+		liveAfterCycle = heapSize(L);
+	}
+
+	auto Pacer::idle(lua_State *L, const memory::LimitedAllocatorState *allocator) noexcept
+		-> time::nanoseconds
+	{
+		if (!enabled) {
+			return time::nanoseconds{0};
+		}
+		const auto start = Clock::now();
+		const double current = pressure(L, allocator);
+
+		if (automatic) {
+			if (current >= settings.softPressure) {
+				return time::nanoseconds{0}; // Lua keeps collecting on its own meanwhile
+			}
+			automatic = false;
+		}
+		if (current >= settings.hardPressure) {
+			lua_gc(L, LUA_GCCOLLECT, 0);
+			++stats.fullCollections;
+			noteCycleEnd(L);
+
+			if (pressure(L, allocator) >= settings.hardPressure) {
+				// Mostly live data: without the automatic collection the next tick may well
+				// fail to allocate.
+				automatic = true;
+				++stats.fallbacks;
+				lua_gc(L, LUA_GCRESTART, 0);
+			} else {
+				lua_gc(L, LUA_GCSTOP, 0);
+			}
+			const auto pause = Clock::now() - start;
+			stats.pauses.add(pause);
+			return pause;
+		}
+
+		const auto deadline = start + budgetFor(current);
+		auto now = start;
+		do {
+			const auto stepStart = now;
+			const bool cycleEnded = lua_gc(L, LUA_GCSTEP, settings.stepSize) == 1;
+			now = Clock::now();
+			stats.steps.add(now - stepStart);
+
+			if (cycleEnded) {
+				noteCycleEnd(L);
+				break;
+			}
+		} while (now < deadline);
+
+		// In Lua 5.1 a step re-arms the collection threshold, i.e. turns the automatic
+		// collection back on.
+		lua_gc(L, LUA_GCSTOP, 0);
+
+		const auto pause = now - start;
+		stats.pauses.add(pause);
+		return pause;
+	}
+} // namespace lua::gc
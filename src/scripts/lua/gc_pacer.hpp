@@ -0,0 +1,134 @@
+#pragma once
+
+#include "lua/sol2.hpp"
+#include "lua/utils.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace lua::gc
+{
+	namespace time = std::chrono;
+
+	struct PacerSettings
+	{
+		time::microseconds budget{1'000}; // Collector time per idle() call at low pressure
+		int stepSize{0};				   // In Kb, as for LUA_GCSTEP; 0 is one basic step
+
+		// Memory pressure is 'used / limit' of the limited allocator, or the heap size relative
+		// to twice the heap left by the last cycle when there's no limit.
+		// From 'softPressure' on the budget grows, up to cMaxBudgetScale times at 'hardPressure'.
+		// At 'hardPressure' a full collection is done instead; if that doesn't bring the
+		// pressure down, the automatic collection is turned back on until it drops below
+		// 'softPressure', since Lua 5.1 doesn't collect on a failed allocation.
+		double softPressure{0.6};
+		double hardPressure{0.9};
+	};
+
+	constexpr int cMaxBudgetScale = 4;
+/*-----------------------------------------------------------------------------------------------*/
+	// Bucket i counts pauses of [2^(i-1), 2^i) microseconds, bucket 0 the ones below 1 us.
+	// The last bucket also takes everything longer.
+	class PauseHistogram
+	{
+	public:
+		static constexpr size_t cBuckets = 24;
+
+		void add(time::nanoseconds pause) noexcept;
+		void clear() noexcept { *this = {}; }
+
+		[[nodiscard]]
+		auto buckets() const noexcept -> const std::array<uint64_t, cBuckets> & { return counts; }
+		[[nodiscard]]
+		uint64_t count() const noexcept { return total; }
+		[[nodiscard]]
+		auto max() const noexcept -> time::nanoseconds { return longest; }
+		[[nodiscard]]
+		auto sum() const noexcept -> time::nanoseconds { return spent; }
+
+		// Upper bound of the bucket holding the given fraction (0..1] of the pauses
+		[[nodiscard]]
+		auto percentile(double fraction) const noexcept -> time::microseconds;
+
+		[[nodiscard]]
+		static constexpr size_t bucketOf(time::nanoseconds pause) noexcept
+		{
+			const auto us = time::duration_cast<time::microseconds>(pause).count();
+			size_t idx = 0;
+			for (auto rest = us > 0 ? static_cast<uint64_t>(us) : 0; rest != 0; rest >>= 1) {
+				++idx;
+			}
+			return idx < cBuckets ? idx : cBuckets - 1;
+		}
+
+	private:
+		std::array<uint64_t, cBuckets> counts{};
+		uint64_t total{0};
+		time::nanoseconds longest{0};
+		time::nanoseconds spent{0};
+	};
+
+	struct PacerStats
+	{
+		PauseHistogram pauses;		 // Whole idle() calls that did any work
+		PauseHistogram steps;		 // Single LUA_GCSTEP calls
+		uint64_t cycles{0};			 // Collection cycles finished by the steps
+		uint64_t fullCollections{0}; // Forced by the hard memory pressure
+		uint64_t fallbacks{0};		 // Times the automatic collection had to be turned back on
+	};
+/*-----------------------------------------------------------------------------------------------*/
+	// Takes the incremental collector off the allocation path and runs it in the idle time
+	// after simulation ticks, so its pauses don't land in the middle of one.
+	class Pacer
+	{
+	public:
+		Pacer() = default;
+
+		void configure(const PacerSettings &newSettings) noexcept { settings = newSettings; }
+		[[nodiscard]]
+		auto getSettings() const noexcept -> const PacerSettings & { return settings; }
+
+		// Stops the automatic collection of the state (LUA_GCSTOP).
+		void enable(lua_State *L) noexcept;
+		// Hands the collection back to Lua (LUA_GCRESTART).
+		void disable(lua_State *L) noexcept;
+		[[nodiscard]]
+		bool isEnabled() const noexcept { return enabled; }
+
+		// To be called for a state replacing the previous one.
+		void attach(lua_State *L) noexcept;
+
+		// Runs collector steps until the budget, scaled by the memory pressure, is spent or
+		// a cycle is finished. 'allocator' may be null when the state has no memory limit.
+		// Returns the time spent.
+		auto idle(lua_State *L, const memory::LimitedAllocatorState *allocator) noexcept
+			-> time::nanoseconds;
+
+		// Collections done outside idle(). Both re-arm the collection threshold in Lua 5.1,
+		// so the automatic collection is stopped again afterwards while the pacer is enabled.
+		bool step(lua_State *L, int stepSize) noexcept; // True if a cycle has finished
+		void collect(lua_State *L) noexcept;
+
+		[[nodiscard]]
+		auto getStats() const noexcept -> const PacerStats & { return stats; }
+		void resetStats() noexcept { stats = {}; }
+
+	private:
+		[[nodiscard]]
+		double pressure(lua_State *L,
+						const memory::LimitedAllocatorState *allocator) const noexcept;
+		[[nodiscard]]
+		auto budgetFor(double pressure) const noexcept -> time::nanoseconds;
+
+		void noteCycleEnd(lua_State *L) noexcept;
+
+	private:
+		PacerSettings settings{};
+		PacerStats stats{};
+		bool enabled{false};
+		bool automatic{false}; // The fallback to the automatic collection is active
+		size_t liveAfterCycle{0};
+	};
+} // namespace lua::gc
@@ -0,0 +1,147 @@
+#include "lua/marshal.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <spdlog/spdlog.h>
+
+namespace lua::marshal
+{
+	namespace
+	{
+		auto toPlain(lua_State *L, int index, int depth) -> std::optional<PlainValue>;
+
+		auto tableToPlain(lua_State *L, int index, int depth) -> std::optional<PlainValue>
+		{
+			if (depth >= kMaxDepth) {
+				spdlog::error("Unable to marshal a table: nested deeper than {} levels.", kMaxDepth);
+				return std::nullopt;
+			}
+			if (!lua_checkstack(L, 3)) {
+				return std::nullopt;
+			}
+			auto table = PlainTable{};
+			table.reserve(lua_objlen(L, index));
+
+			lua_pushnil(L);
+			while (lua_next(L, index) != 0) {
+				auto key = toPlain(L, lua_gettop(L) - 1, depth + 1);
+				auto value = key ? toPlain(L, lua_gettop(L), depth + 1) : std::nullopt;
+				if (!value) {
+					lua_pop(L, 2);
+					return std::nullopt;
+				}
+				table.emplace_back(std::move(*key), std::move(*value));
+				lua_pop(L, 1);
+			}
+			return PlainValue{std::move(table)};
+		}
+
+		auto toPlain(lua_State *L, int index, int depth) -> std::optional<PlainValue>
+		{
+			switch (lua_type(L, index)) {
+				case LUA_TNONE:
+				case LUA_TNIL:
+					return PlainValue{};
+				case LUA_TBOOLEAN:
+					return PlainValue{lua_toboolean(L, index) != 0};
+				case LUA_TNUMBER:
+					return PlainValue{lua_tonumber(L, index)};
+				case LUA_TSTRING: {
+					size_t len = 0;
+					const char *str = lua_tolstring(L, index, &len);
+					return PlainValue{std::string(str, len)};
+				}
+				case LUA_TTABLE:
+					// A cycle always ends up deeper than the limit, so it needs no separate check.
+					return tableToPlain(L, index, depth);
+				default:
+					spdlog::error("Unable to marshal a value of type '{}'.",
+								  lua_typename(L, lua_type(L, index)));
+					return std::nullopt;
+			}
+		}
+	} // namespace
+
+	auto PlainValue::find(const PlainValue &key) const -> const PlainValue *
+	{
+		if (!is<PlainTable>()) {
+			return nullptr;
+		}
+		const auto &table = as<PlainTable>();
+		const auto it = std::ranges::find(table, key, &PlainTable::value_type::first);
+		return it != table.end() ? &it->second : nullptr;
+	}
+
+	auto toPlain(lua_State *L, int index) -> std::optional<PlainValue>
+	{
+		if (index < 0 && index > LUA_REGISTRYINDEX) {
+			index = lua_gettop(L) + index + 1;
+		}
+		return toPlain(L, index, 0);
+	}
+
+	void push(lua_State *L, const PlainValue &value)
+	{
+		if (!lua_checkstack(L, 3)) {
+			spdlog::error("Unable to unmarshal a value: not enough stack space.");
+			lua_pushnil(L);
+			return;
+		}
+
+		std::visit([L](const auto &value) {
+			using T = std::decay_t<decltype(value)>;
+
+			if constexpr (std::is_same_v<T, PlainValue::Nil>) {
+				lua_pushnil(L);
+			} else if constexpr (std::is_same_v<T, bool>) {
+				lua_pushboolean(L, value);
+			} else if constexpr (std::is_same_v<T, lua_Number>) {
+				lua_pushnumber(L, value);
+			} else if constexpr (std::is_same_v<T, std::string>) {
+				lua_pushlstring(L, value.data(), value.size());
+			} else {
+				lua_createtable(L, 0, static_cast<int>(value.size()));
+				for (const auto &[key, field] : value) {
+					const auto *number = std::get_if<lua_Number>(&key.value);
+					if (key.isNil() || (number != nullptr && std::isnan(*number))) {
+						continue;
+					}
+					push(L, key);
+					push(L, field);
+					lua_rawset(L, -3);
+				}
+			}
+		}, value.value);
+	}
+
+	namespace
+	{
+		struct SetFieldContext
+		{
+			const sol::table *table;
+			const char *key;
+			const PlainValue *value;
+		};
+
+		int setFieldProtected(lua_State *L)
+		{
+			const auto *ctx = static_cast<const SetFieldContext *>(lua_touserdata(L, 1));
+			ctx->table->push(L);
+			push(L, *ctx->value);
+			lua_setfield(L, -2, ctx->key);
+			return 0;
+		}
+	} // namespace
+
+	bool setField(const sol::table &table, const char *key, const PlainValue &value)
+	{
+		lua_State *L = table.lua_state();
+		auto ctx = SetFieldContext{.table = &table, .key = key, .value = &value};
+		if (lua_cpcall(L, setFieldProtected, &ctx) != 0) {
+			spdlog::error("Unable to unmarshal a value: {}", lua_tostring(L, -1));
+			lua_pop(L, 1);
+			return false;
+		}
+		return true;
+	}
+} // namespace lua::marshal
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "lua/sol2.hpp"
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace lua::marshal
+{
+	struct PlainValue;
+	using PlainTable = std::vector<std::pair<PlainValue, PlainValue>>;
+
+	// Lua value copied out of a state, so it can be passed to another thread or state.
+	// Only nil, booleans, numbers, strings and tables of them are representable.
+	struct PlainValue
+	{
+		using Nil = std::monostate;
+		using Variant = std::variant<Nil, bool, lua_Number, std::string, PlainTable>;
+
+		Variant value{};
+
+		PlainValue() = default;
+		PlainValue(Nil) {}
+		PlainValue(bool value) : value(value) {}
+		PlainValue(lua_Number value) : value(value) {}
+		PlainValue(int value) : value(static_cast<lua_Number>(value)) {}
+		PlainValue(std::string value) : value(std::move(value)) {}
+		PlainValue(const char *value) : value(std::string(value)) {}
+		PlainValue(PlainTable value) : value(std::move(value)) {}
+
+		[[nodiscard]]
+		bool isNil() const noexcept { return std::holds_alternative<Nil>(value); }
+
+		template <typename T>
+		[[nodiscard]]
+		bool is() const noexcept { return std::holds_alternative<T>(value); }
+
+		template <typename T>
+		[[nodiscard]]
+		auto as() const -> const T & { return std::get<T>(value); }
+
+		// Linear lookup: plain tables are meant to be small payloads.
+		[[nodiscard]]
+		auto find(const PlainValue &key) const -> const PlainValue *;
+
+		[[nodiscard]]
+		bool operator==(const PlainValue &) const = default;
+	};
+
+	constexpr int kMaxDepth {32};
+
+	// Copies the value at the given stack index. Functions, userdata, threads, cyclic or
+	// too deeply nested tables aren't representable: nullopt is returned and the reason logged.
+	[[nodiscard]]
+	auto toPlain(lua_State *L, int index) -> std::optional<PlainValue>;
+
+	[[nodiscard]]
+	inline auto toPlain(const sol::object &object) -> std::optional<PlainValue>
+	{
+		lua_State *L = object.lua_state();
+		if (L == nullptr) {
+			return PlainValue{};
+		}
+		object.push(L);
+		auto result = toPlain(L, -1);
+		lua_pop(L, 1);
+		return result;
+	}
+
+	// Raises a Lua error if the state runs out of memory. Keys which Lua tables can't hold
+	// (nil, NaN) are skipped.
+	void push(lua_State *L, const PlainValue &value);
+
+	// Sets table[key] to the value under lua_cpcall: a Lua error raised meanwhile is logged and
+	// reported by returning false instead of unwinding through the caller.
+	[[nodiscard]]
+	bool setField(const sol::table &table, const char *key, const PlainValue &value);
+
+	[[nodiscard]]
+	inline auto fromPlain(sol::state_view lua, const PlainValue &value) -> sol::object
+	{
+		push(lua, value);
+		auto object = sol::object(lua, -1);
+		lua_pop(lua, 1);
+		return object;
+	}
+} // namespace lua::marshal
@@ -0,0 +1,167 @@
+#include "lua/precompile.hpp"
+#include "lua/utils.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+namespace lua
+{
+	namespace
+	{
+		struct ScriptSource
+		{
+			std::string_view text;
+			fs_utils::FileStamp stamp;
+		};
+
+		// Shares the files between the workers through a single counter: scripts differ a lot
+		// in size, so fixed slices would leave some of the workers idle.
+		// ReadFn: (const fs::path &file, std::string &buffer) -> std::optional<ScriptSource>
+		template <typename ReadFn>
+		auto compileAll(ChunkCache &cache,
+						const std::vector<fs::path> &files,
+						size_t workersCount,
+						ReadFn &&readSource) -> PrecompileReport
+		{
+			if (files.empty()) {
+				return {};
+			}
+			if (workersCount == 0) {
+				workersCount = std::max(1u, std::thread::hardware_concurrency());
+			}
+			workersCount = std::min(workersCount, files.size());
+
+			auto reports = std::vector<PrecompileReport>(workersCount);
+			auto next = std::atomic<size_t>{0};
+
+			auto work = [&](PrecompileReport &report) {
+				auto scratch = sol::state{};
+				auto buffer = std::string{};
+
+				auto fail = [&](const fs::path &file, std::string message) {
+					report.errors.push_back({.file = file, .message = std::move(message)});
+				};
+
+				for (size_t i = next++; i < files.size(); i = next++) {
+					const auto &file = files[i];
+
+					const auto source = readSource(file, buffer);
+					if (!source) {
+						fail(file, "Unable to read the script file");
+						continue;
+					}
+					const auto text = skipShebang(source->text);
+					if (isBytecode(text)) {
+						fail(file, "Precompiled Lua bytecode is not allowed");
+						continue;
+					}
+					const auto chunkName = "@" + file.string();
+					if (luaL_loadbuffer(scratch, text.data(), text.size(),
+										chunkName.c_str()) != 0) {
+						fail(file, lua_tostring(scratch, -1));
+						lua_pop(scratch, 1);
+						continue;
+					}
+					const auto chunk = sol::protected_function(scratch, -1);
+					lua_pop(scratch, 1);
+
+					cache.store(file, source->stamp, chunk);
+					++report.compiled;
+				}
+			};
+			{
+				auto workers = std::vector<std::jthread>{};
+				workers.reserve(workersCount - 1);
+				for (size_t i = 1; i < workersCount; ++i) {
+					workers.emplace_back(work, std::ref(reports[i]));
+				}
+				work(reports[0]);
+			}
+			auto result = PrecompileReport{};
+			for (auto &report : reports) {
+				result.compiled += report.compiled;
+				std::ranges::move(report.errors, std::back_inserter(result.errors));
+			}
+			std::ranges::sort(result.errors, {}, &PrecompileError::file);
+			return result;
+		}
+
+		[[nodiscard]]
+		bool isScript(const fs::path &file)
+		{
+			return file.extension() == ".lua";
+		}
+	} // namespace
+
+	auto precompileScripts(ChunkCache &cache, const fs::path &root, size_t workers)
+		-> PrecompileReport
+	{
+		const auto absRoot = fs_utils::normalize(fs::absolute(root));
+
+		auto files = std::vector<fs::path>{};
+		auto ec = std::error_code{};
+		for (auto it = fs::recursive_directory_iterator(absRoot, ec);
+			 !ec && it != fs::recursive_directory_iterator();
+			 it.increment(ec)) {
+			if (it->is_regular_file(ec) && isScript(it->path())) {
+				files.push_back(it->path());
+			}
+		}
+		if (ec) {
+			auto report = PrecompileReport{};
+			report.errors.push_back({.file = absRoot, .message = ec.message()});
+			return report;
+		}
+		return compileAll(cache, files, workers,
+			[](const fs::path &file, std::string &buffer) -> std::optional<ScriptSource> {
+				const auto stamp = fs_utils::FileStamp::of(file);
+				if (!stamp) {
+					return std::nullopt;
+				}
+				auto content = fs_utils::readFile(file, stamp->size);
+				if (!content) {
+					return std::nullopt;
+				}
+				buffer = std::move(*content);
+				return ScriptSource{.text = buffer, .stamp = *stamp};
+			});
+	}
+
+	auto precompileScripts(ChunkCache &cache,
+						   const pack::Archive &archive,
+						   const fs::path &root,
+						   size_t workers) -> PrecompileReport
+	{
+		const auto absRoot = fs_utils::normalize(fs::absolute(root));
+
+		auto files = std::vector<fs::path>{};
+		for (const auto name : archive.names()) {
+			if (const auto file = absRoot / name; isScript(file)) {
+				files.push_back(file);
+			}
+		}
+		return compileAll(cache, files, workers,
+			[&](const fs::path &file, std::string& /*buffer*/) -> std::optional<ScriptSource> {
+				const auto text = archive.findText(file.lexically_relative(absRoot).generic_string());
+				if (!text) {
+					return std::nullopt;
+				}
+				return ScriptSource{.text = *text, .stamp = archive.stamp()};
+			});
+	}
+
+	void logReport(const PrecompileReport &report)
+	{
+		for (const auto &[file, message] : report.errors) {
+			spdlog::error("Unable to compile \"{}\": {}", file.string(), message);
+		}
+		spdlog::info("Scripts precompiled: {}, failed: {}", report.compiled, report.errors.size());
+	}
+} // namespace lua
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "lua/chunk_cache.hpp"
+
+#include "utils/filesystem.hpp"
+#include "utils/pack.hpp"
+
+#include <string>
+#include <vector>
+
+namespace lua
+{
+	struct PrecompileError
+	{
+		fs::path file;
+		std::string message;
+	};
+
+	struct PrecompileReport
+	{
+		size_t compiled{0};
+		std::vector<PrecompileError> errors{}; // Sorted by file
+
+		[[nodiscard]]
+		bool ok() const noexcept { return errors.empty(); }
+	};
+
+	// Compiles every *.lua file under the root into the cache ahead of time, so sandboxes
+	// don't parse them on the first load. Files are spread over the given number of workers
+	// (all hardware threads if zero), each compiling in its own scratch Lua state.
+	// Files that fail to compile are collected in the report and left out of the cache.
+	[[nodiscard]]
+	auto precompileScripts(ChunkCache &cache, const fs::path &root, size_t workers = 0)
+		-> PrecompileReport;
+
+	// The same for the scripts of a pack mounted at the given root (see
+	// LuaSandbox::mountScriptsPack): entries are compiled right from the mapping.
+	[[nodiscard]]
+	auto precompileScripts(ChunkCache &cache,
+						   const pack::Archive &archive,
+						   const fs::path &root,
+						   size_t workers = 0) -> PrecompileReport;
+
+	void logReport(const PrecompileReport &report);
+} // namespace lua
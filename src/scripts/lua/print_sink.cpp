@@ -0,0 +1,146 @@
+#include "lua/print_sink.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+namespace lua::print
+{
+	AsyncSink::AsyncSink(std::ostream &out, size_t capacity /* = cDefaultCapacity */)
+		: out(&out),
+		  slots(std::make_unique<Slot[]>(std::bit_ceil(std::max<size_t>(capacity, 2)))),
+		  mask(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1)
+	{
+		for (size_t i = 0; i <= mask; ++i) {
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		logger = std::jthread([this](std::stop_token stop) { run(stop); });
+	}
+
+	AsyncSink::~AsyncSink()
+	{
+		logger.request_stop();
+		signal.fetch_add(1, std::memory_order_release);
+		signal.notify_one();
+	}
+
+	void AsyncSink::write(std::string_view line) noexcept
+	{
+		auto pos = enqueuePos.load(std::memory_order_relaxed);
+		Slot *slot = nullptr;
+		while (true) {
+			slot = &slots[pos & mask];
+			const auto sequence = slot->sequence.load(std::memory_order_acquire);
+			const auto diff =
+				static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+			if (diff == 0) {
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				droppedLines.fetch_add(1, std::memory_order_relaxed);
+				return;
+			} else {
+				pos = enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		const auto length = std::min(line.size(), cSlotSize);
+		std::memcpy(slot->text.data(), line.data(), length);
+		slot->length = static_cast<uint16_t>(length);
+		slot->sequence.store(pos + 1, std::memory_order_release);
+
+		signal.fetch_add(1, std::memory_order_release);
+		signal.notify_one();
+	}
+
+	void AsyncSink::flush() noexcept
+	{
+		const auto target = enqueuePos.load(std::memory_order_acquire);
+		while (dequeuePos.load(std::memory_order_acquire) < target) {
+			std::this_thread::yield();
+		}
+	}
+
+	void AsyncSink::run(std::stop_token stop)
+	{
+		while (true) {
+			const auto seen = signal.load(std::memory_order_acquire);
+			const bool wrote = drain();
+			if (wrote) {
+				out->flush();
+			}
+			if (stop.stop_requested()) {
+				break;
+			}
+			signal.wait(seen, std::memory_order_acquire);
+		}
+		if (drain()) {
+			out->flush();
+		}
+	}
+
+	bool AsyncSink::drain()
+	{
+		auto pos = dequeuePos.load(std::memory_order_relaxed);
+		bool wrote = false;
+		while (true) {
+			auto &slot = slots[pos & mask];
+			if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+				break;
+			}
+			out->write(slot.text.data(), slot.length).put('\n');
+			slot.sequence.store(pos + mask + 1, std::memory_order_release);
+
+			++pos;
+			dequeuePos.store(pos, std::memory_order_release);
+			wrote = true;
+		}
+		return wrote;
+	}
+/*-----------------------------------------------------------------------------------------------*/
+	void appendValue(std::string &out, lua_State *L, int index)
+	{
+		switch (lua_type(L, index)) {
+			case LUA_TNONE:
+			case LUA_TNIL:
+				out += "nil";
+				return;
+			case LUA_TBOOLEAN:
+				out += lua_toboolean(L, index) != 0 ? "true" : "false";
+				return;
+			case LUA_TNUMBER: {
+				// The same as LUAI_NUMFFORMAT ("%.14g")
+				auto buffer = std::array<char, 32>{};
+				const auto [end, _] = std::to_chars(buffer.data(),
+													buffer.data() + buffer.size(),
+													lua_tonumber(L, index),
+													std::chars_format::general,
+													14);
+				out.append(buffer.data(), end);
+				return;
+			}
+			case LUA_TSTRING: {
+				size_t length = 0;
+				const char *str = lua_tolstring(L, index, &length);
+				out.append(str, length);
+				return;
+			}
+			default:
+				break;
+		}
+		if (luaL_callmeta(L, index, "__tostring")) {
+			if (const char *str = lua_tostring(L, -1); str != nullptr) {
+				out += str;
+			}
+			lua_pop(L, 1);
+			return;
+		}
+		auto buffer = std::array<char, 64>{};
+		const int length = std::snprintf(buffer.data(), buffer.size(), "%s: %p",
+										 lua_typename(L, lua_type(L, index)),
+										 lua_topointer(L, index));
+		out.append(buffer.data(), std::clamp(length, 0, static_cast<int>(buffer.size()) - 1));
+	}
+} // namespace lua::print
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "lua/sol2.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace lua::print
+{
+	// Destination of the lines printed by sandboxed scripts. A line comes without the newline.
+	class Sink
+	{
+	public:
+		virtual ~Sink() = default;
+		virtual void write(std::string_view line) noexcept = 0;
+	};
+
+	// Writes every line to the stream right away, from the calling thread.
+	class StreamSink final : public Sink
+	{
+	public:
+		explicit StreamSink(std::ostream &out) : out(&out) {}
+
+		void write(std::string_view line) noexcept override { *out << line << '\n'; }
+
+	private:
+		std::ostream *out{nullptr};
+	};
+/*-----------------------------------------------------------------------------------------------*/
+	// Hands lines over to a logger thread through a bounded lock-free ring buffer
+	// (multiple producers, single consumer). write() never blocks nor allocates: lines longer
+	// than cSlotSize are truncated and when the buffer is full the line is dropped and counted.
+	class AsyncSink final : public Sink
+	{
+	public:
+		static constexpr size_t cSlotSize = 240;
+		static constexpr size_t cDefaultCapacity = 1024;
+
+		explicit AsyncSink(std::ostream &out, size_t capacity = cDefaultCapacity);
+		~AsyncSink() override; // Writes out everything queued before stopping the logger
+
+		AsyncSink(const AsyncSink &) = delete;
+		AsyncSink &operator=(const AsyncSink &) = delete;
+		AsyncSink(AsyncSink &&) = delete;
+		AsyncSink &operator=(AsyncSink &&) = delete;
+
+		void write(std::string_view line) noexcept override;
+
+		// Blocks until the logger has written every line queued so far.
+		void flush() noexcept;
+
+		[[nodiscard]]
+		size_t capacity() const noexcept { return mask + 1; }
+		[[nodiscard]]
+		size_t dropped() const noexcept { return droppedLines.load(std::memory_order_relaxed); }
+
+	private:
+		struct Slot
+		{
+			std::atomic<size_t> sequence{0};
+			uint16_t length{0};
+			std::array<char, cSlotSize> text{};
+		};
+
+		void run(std::stop_token stop);
+		bool drain();
+
+	private:
+		std::ostream *out{nullptr};
+
+		std::unique_ptr<Slot[]> slots;
+		size_t mask{0};
+
+		alignas(64) std::atomic<size_t> enqueuePos{0};
+		alignas(64) std::atomic<size_t> dequeuePos{0};
+		alignas(64) std::atomic<uint32_t> signal{0}; // Bumped by producers to wake the logger up
+		std::atomic<size_t> droppedLines{0};
+
+		std::jthread logger; // Declared last: stopped before the buffer is destroyed
+	};
+/*-----------------------------------------------------------------------------------------------*/
+	// Zero means unlimited.
+	struct RateLimit
+	{
+		double linesPerSecond{0};
+		double burst{0}; // Lines allowed at once after an idle period, at least 1
+	};
+
+	class TokenBucket
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		TokenBucket() = default;
+		explicit TokenBucket(RateLimit limit) { configure(limit); }
+
+		void configure(RateLimit newLimit) noexcept
+		{
+			limit = newLimit;
+			limit.burst = std::max(limit.burst, 1.0);
+			tokens = limit.burst;
+			refilled = clock::now();
+		}
+
+		[[nodiscard]]
+		bool tryConsume() noexcept
+		{
+			if (limit.linesPerSecond <= 0) {
+				return true;
+			}
+			const auto now = clock::now();
+			const auto elapsed = std::chrono::duration<double>(now - refilled).count();
+			tokens = std::min(limit.burst, tokens + elapsed * limit.linesPerSecond);
+			refilled = now;
+
+			if (tokens < 1) {
+				return false;
+			}
+			tokens -= 1;
+			return true;
+		}
+
+	private:
+		RateLimit limit{};
+		double tokens{0};
+		clock::time_point refilled{};
+	};
+/*-----------------------------------------------------------------------------------------------*/
+	// Appends the value at the given stack index the way Lua's tostring() would, without
+	// calling back into Lua for nil, booleans, numbers and strings.
+	void appendValue(std::string &out, lua_State *L, int index);
+} // namespace lua::print
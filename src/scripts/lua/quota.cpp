@@ -0,0 +1,60 @@
+#include "lua/quota.hpp"
+
+#include <limits>
+
+namespace lua::memory
+{
+	bool Quota::tryAcquireLevel(size_t bytes) noexcept
+	{
+		auto current = usedBytes.load(std::memory_order_relaxed);
+		do {
+			const auto max = limitBytes.load(std::memory_order_relaxed);
+			if (bytes > std::numeric_limits<size_t>::max() - current
+				|| (max > 0 && current + bytes > max)) {
+				return false;
+			}
+		} while (!usedBytes.compare_exchange_weak(current, current + bytes,
+												  std::memory_order_relaxed));
+		return true;
+	}
+
+	auto Quota::tryAcquire(size_t bytes) noexcept -> Quota *
+	{
+		for (auto *level = this; level != nullptr; level = level->parent) {
+			if (!level->tryAcquireLevel(bytes)) {
+				for (auto *taken = this; taken != level; taken = taken->parent) {
+					taken->usedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+				}
+				return level;
+			}
+		}
+		return nullptr;
+	}
+
+	void Quota::forceAcquire(size_t bytes) noexcept
+	{
+		for (auto *level = this; level != nullptr; level = level->parent) {
+			level->usedBytes.fetch_add(bytes, std::memory_order_relaxed);
+		}
+	}
+
+	void Quota::release(size_t bytes) noexcept
+	{
+		for (auto *level = this; level != nullptr; level = level->parent) {
+			level->usedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+		}
+	}
+/*-----------------------------------------------------------------------------------------------*/
+	void setQuota(LimitedAllocatorState &state, Quota *quota) noexcept
+	{
+		if (state.quota != nullptr) {
+			state.quota->release(state.credit);
+		}
+		state.quota = quota;
+		state.credit = 0;
+		if (quota != nullptr) {
+			quota->forceAcquire(state.used);
+			state.credit = state.used;
+		}
+	}
+} // namespace lua::memory
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "lua/utils.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace lua::memory
+{
+	// Granularity of the credit a Lua state takes from its quota. The shared counters are only
+	// touched when a state runs out of credit, or holds more than twice this much unused.
+	constexpr size_t cQuotaChunk = 64L * 1024;
+
+	// Memory budget shared by Lua states which may run on different threads, e.g. all the
+	// runtimes of a match. Quotas form a hierarchy (match -> process): bytes taken from a quota
+	// are taken from all its ancestors as well.
+	//
+	// States don't charge every allocation here: they reserve credit in cQuotaChunk steps (see
+	// reserveUsage()), so the usage of a quota is an upper bound of what its states really use.
+	class Quota
+	{
+	public:
+		// A zero limit means unlimited. The parent must outlive the quota.
+		explicit Quota(std::string_view name, size_t limit = 0, Quota *parent = nullptr)
+			: name(name),
+			  parent(parent),
+			  limitBytes(limit)
+		{}
+
+		Quota(const Quota &) = delete;
+		Quota &operator=(const Quota &) = delete;
+		Quota(Quota &&) = delete;
+		Quota &operator=(Quota &&) = delete;
+
+		// Takes 'bytes' from this quota and all its ancestors, or from none of them.
+		// Returns the level which had no room left, nullptr on success.
+		[[nodiscard]]
+		auto tryAcquire(size_t bytes) noexcept -> Quota *;
+		// Takes 'bytes' regardless of the limits.
+		void forceAcquire(size_t bytes) noexcept;
+		void release(size_t bytes) noexcept;
+
+		[[nodiscard]]
+		auto getName() const noexcept -> const std::string & { return name; }
+		[[nodiscard]]
+		auto getParent() const noexcept -> Quota * { return parent; }
+
+		[[nodiscard]]
+		size_t used() const noexcept { return usedBytes.load(std::memory_order_relaxed); }
+		[[nodiscard]]
+		size_t limit() const noexcept { return limitBytes.load(std::memory_order_relaxed); }
+		// Lowering the limit below the current usage only makes further requests fail.
+		void setLimit(size_t limit) noexcept
+		{
+			limitBytes.store(limit, std::memory_order_relaxed);
+		}
+
+		// Raised on the level which refused an allocation: the states only know that some
+		// quota above them did.
+		[[nodiscard]]
+		bool limitReached() const noexcept { return reached.load(std::memory_order_relaxed); }
+		void reportLimitReached() noexcept { reached.store(true, std::memory_order_relaxed); }
+		void resetErrorFlags() noexcept { reached.store(false, std::memory_order_relaxed); }
+
+	private:
+		[[nodiscard]]
+		bool tryAcquireLevel(size_t bytes) noexcept;
+
+	private:
+		std::string name;
+		Quota *parent{nullptr};
+
+		std::atomic<size_t> usedBytes{0};
+		std::atomic<size_t> limitBytes{0};
+		std::atomic<bool> reached{false};
+	};
+
+	// Moves the state (and the credit it holds) to another quota, nullptr detaching it.
+	// The bytes the state already uses are charged to the new quota even if they don't fit.
+	void setQuota(LimitedAllocatorState &state, Quota *quota) noexcept;
+} // namespace lua::memory
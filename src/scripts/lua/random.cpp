@@ -0,0 +1,281 @@
+#include "lua/random.hpp"
+
+#include <array>
+#include <bit>
+#include <cmath>
+#include <new>
+
+namespace lua::random
+{
+	void Xoshiro256::reseed(uint64_t seed) noexcept
+	{
+		for (auto &word : state) {
+			seed += 0x9e3779b97f4a7c15ULL; // splitmix64
+			uint64_t z = seed;
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			word = z ^ (z >> 31);
+		}
+	}
+
+	uint64_t Xoshiro256::next() noexcept
+	{
+		const uint64_t result = std::rotl(state[1] * 5, 7) * 9;
+		const uint64_t t = state[1] << 17;
+
+		state[2] ^= state[0];
+		state[3] ^= state[1];
+		state[1] ^= state[2];
+		state[0] ^= state[3];
+		state[2] ^= t;
+		state[3] = std::rotl(state[3], 45);
+
+		return result;
+	}
+
+	double Xoshiro256::nextDouble() noexcept
+	{
+		return static_cast<double>(next() >> 11) * 0x1.0p-53;
+	}
+
+	uint64_t Xoshiro256::nextBelow(uint64_t range) noexcept
+	{
+		if (range == 0) {
+			return next();
+		}
+		// Values below the threshold would make the lower results a bit more likely
+		const uint64_t threshold = (0 - range) % range;
+		while (true) {
+			if (const uint64_t value = next(); value >= threshold) {
+				return value % range;
+			}
+		}
+	}
+
+	void Xoshiro256::jump() noexcept
+	{
+		static constexpr auto cJump = State{0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+											0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+		auto jumped = State{};
+		for (const auto word : cJump) {
+			for (int bit = 0; bit < 64; ++bit) {
+				if (word & (uint64_t{1} << bit)) {
+					for (size_t i = 0; i < jumped.size(); ++i) {
+						jumped[i] ^= state[i];
+					}
+				}
+				next();
+			}
+		}
+		state = jumped;
+	}
+
+	auto Xoshiro256::save() const -> std::string
+	{
+		auto saved = std::string(cSavedSize, '\0');
+		size_t pos = 0;
+		for (const auto word : state) {
+			for (int byte = 0; byte < 8; ++byte) {
+				saved[pos++] = static_cast<char>((word >> (byte * 8)) & 0xff);
+			}
+		}
+		return saved;
+	}
+
+	bool Xoshiro256::restore(std::string_view saved) noexcept
+	{
+		if (saved.size() != cSavedSize) {
+			return false;
+		}
+		auto restored = State{};
+		size_t pos = 0;
+		for (auto &word : restored) {
+			for (int byte = 0; byte < 8; ++byte) {
+				word |= uint64_t{static_cast<unsigned char>(saved[pos++])} << (byte * 8);
+			}
+		}
+		if (restored == State{}) { // The all-zero state is a fixed point
+			return false;
+		}
+		state = restored;
+		return true;
+	}
+/*-----------------------------------------------------------------------------------------------*/
+	namespace
+	{
+		constexpr auto cMetatableName = "zug-zug.Random";
+		// Bounds the table a single call may grow, and the time spent in it: the hook of
+		// the timeout guard doesn't run inside C functions.
+		constexpr int64_t cMaxFillCount = int64_t{1} << 20;
+
+		[[nodiscard]]
+		auto checkGenerator(lua_State *L) -> Xoshiro256 &
+		{
+			return *static_cast<Xoshiro256 *>(luaL_checkudata(L, 1, cMetatableName));
+		}
+
+		// Integers are taken as exact doubles, like math.random() does
+		[[nodiscard]]
+		int64_t checkInt(lua_State *L, int arg)
+		{
+			const lua_Number value = luaL_checknumber(L, arg);
+			constexpr auto cLimit = static_cast<lua_Number>(uint64_t{1} << 53);
+			luaL_argcheck(L, std::floor(value) == value && std::abs(value) <= cLimit, arg,
+						  "integer expected");
+			return static_cast<int64_t>(value);
+		}
+
+		struct Range
+		{
+			bool isInteger{false};
+			int64_t low{0};
+			uint64_t size{0}; // Number of values, zero if the range has 2^64 of them
+		};
+
+		// Arguments at [first, first + 1] as in math.random: none, (n) or (m, n)
+		[[nodiscard]]
+		auto checkRange(lua_State *L, int first) -> Range
+		{
+			if (lua_isnoneornil(L, first)) {
+				return {};
+			}
+			int64_t low = 1;
+			int64_t high = checkInt(L, first);
+			if (!lua_isnoneornil(L, first + 1)) {
+				low = high;
+				high = checkInt(L, first + 1);
+			}
+			luaL_argcheck(L, low <= high, first, "interval is empty");
+			return {.isInteger = true,
+					.low = low,
+					.size = static_cast<uint64_t>(high) - static_cast<uint64_t>(low) + 1};
+		}
+
+		[[nodiscard]]
+		lua_Number generate(Xoshiro256 &rng, const Range &range) noexcept
+		{
+			if (!range.isInteger) {
+				return rng.nextDouble();
+			}
+			return static_cast<lua_Number>(range.low + static_cast<int64_t>(rng.nextBelow(range.size)));
+		}
+
+		void pushGenerator(lua_State *L, const Xoshiro256 &rng);
+
+		int newGenerator(lua_State *L)
+		{
+			auto rng = Xoshiro256(static_cast<uint64_t>(checkInt(L, 1)));
+			const int64_t stream = lua_isnoneornil(L, 2) ? 0 : checkInt(L, 2);
+			luaL_argcheck(L, stream >= 0 && stream <= 4096, 2, "stream out of range [0, 4096]");
+			for (int64_t i = 0; i < stream; ++i) {
+				rng.jump();
+			}
+			pushGenerator(L, rng);
+			return 1;
+		}
+
+		int next(lua_State *L)
+		{
+			auto &rng = checkGenerator(L);
+			lua_pushnumber(L, generate(rng, checkRange(L, 2)));
+			return 1;
+		}
+
+		int fill(lua_State *L)
+		{
+			auto &rng = checkGenerator(L);
+			luaL_checktype(L, 2, LUA_TTABLE);
+			const int64_t count = checkInt(L, 3);
+			luaL_argcheck(L, count >= 0 && count <= cMaxFillCount, 3, "count out of range");
+			const auto range = checkRange(L, 4);
+
+			for (int i = 1; i <= static_cast<int>(count); ++i) {
+				lua_pushnumber(L, generate(rng, range));
+				lua_rawseti(L, 2, i);
+			}
+			lua_settop(L, 2);
+			return 1;
+		}
+
+		int save(lua_State *L)
+		{
+			const auto saved = checkGenerator(L).save();
+			lua_pushlstring(L, saved.data(), saved.size());
+			return 1;
+		}
+
+		int restore(lua_State *L)
+		{
+			auto &rng = checkGenerator(L);
+			size_t size = 0;
+			const char *saved = luaL_checklstring(L, 2, &size);
+			lua_pushboolean(L, rng.restore(std::string_view(saved, size)));
+			return 1;
+		}
+
+		int jump(lua_State *L)
+		{
+			checkGenerator(L).jump();
+			return 0;
+		}
+
+		int clone(lua_State *L)
+		{
+			pushGenerator(L, checkGenerator(L));
+			return 1;
+		}
+
+		void pushGenerator(lua_State *L, const Xoshiro256 &rng)
+		{
+			new (lua_newuserdata(L, sizeof(Xoshiro256))) Xoshiro256(rng);
+
+			if (luaL_newmetatable(L, cMetatableName) != 0) {
+				static constexpr auto methods = std::array<luaL_Reg, 6>{{
+					{"next", next},
+					{"fill", fill},
+					{"save", save},
+					{"restore", restore},
+					{"jump", jump},
+					{"clone", clone}
+				}};
+				lua_createtable(L, 0, static_cast<int>(methods.size()));
+				for (const auto &method : methods) {
+					lua_pushcfunction(L, method.func);
+					lua_setfield(L, -2, method.name);
+				}
+				lua_setfield(L, -2, "__index");
+				lua_pushboolean(L, 0);
+				lua_setfield(L, -2, "__metatable");
+			}
+			lua_setmetatable(L, -2);
+		}
+	} // namespace
+
+	auto makeLib(sol::state_view lua) -> sol::table
+	{
+		auto lib = lua.create_table();
+		lib["new"] = static_cast<lua_CFunction>(newGenerator);
+		return lib;
+	}
+
+	auto toGenerator(const sol::object &object) -> Xoshiro256 *
+	{
+		lua_State *L = object.lua_state();
+		if (L == nullptr) {
+			return nullptr;
+		}
+		object.push(L);
+		auto *rng = static_cast<Xoshiro256 *>(lua_touserdata(L, -1));
+		if (rng != nullptr && lua_getmetatable(L, -1) != 0) {
+			luaL_getmetatable(L, cMetatableName);
+			if (!lua_rawequal(L, -1, -2)) {
+				rng = nullptr;
+			}
+			lua_pop(L, 2);
+		} else {
+			rng = nullptr;
+		}
+		lua_pop(L, 1);
+		return rng;
+	}
+} // namespace lua::random
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "lua/sol2.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace lua::random
+{
+	// xoshiro256** by D. Blackman and S. Vigna: fast, 256 bits of state and a jump function
+	// giving 2^128 non-overlapping streams. Results depend only on the seed, never on the
+	// platform, so it's safe for lockstep simulation.
+	class Xoshiro256
+	{
+	public:
+		using State = std::array<uint64_t, 4>;
+		static constexpr size_t cSavedSize = sizeof(State);
+
+		explicit Xoshiro256(uint64_t seed = 0) noexcept { reseed(seed); }
+
+		// State is expanded from the seed with splitmix64, as the authors recommend.
+		void reseed(uint64_t seed) noexcept;
+
+		uint64_t next() noexcept;
+		// Uniform in [0, 1)
+		double nextDouble() noexcept;
+		// Uniform in [0, range), without modulo bias. Zero range means the full 64-bit range.
+		uint64_t nextBelow(uint64_t range) noexcept;
+
+		// Advances the state by 2^64 calls to next(). Used to derive independent streams.
+		void jump() noexcept;
+
+		[[nodiscard]]
+		auto getState() const noexcept -> const State & { return state; }
+		void setState(const State &newState) noexcept { state = newState; }
+
+		// Portable (little-endian) form of the state, for replays and save games.
+		[[nodiscard]]
+		auto save() const -> std::string;
+		bool restore(std::string_view saved) noexcept;
+
+	private:
+		State state{};
+	};
+
+	// Table of the 'random' lib. For Lua:
+	//   local rng = random.new(seed [, stream])   -- stream: e.g. player index, jumps the state
+	//   rng:next()          -- float in [0, 1)
+	//   rng:next(n)         -- integer in [1, n]
+	//   rng:next(m, n)      -- integer in [m, n]
+	//   rng:fill(t, count [, m [, n]])  -- t[1..count] with values as above, returns t;
+	//                                      count is at most 2^20
+	//   rng:save() / rng:restore(saved) -- state as a string
+	//   rng:jump(), rng:clone()
+	[[nodiscard]]
+	auto makeLib(sol::state_view lua) -> sol::table;
+
+	// Generator of an object created by random.new(), or nullptr for any other value.
+	[[nodiscard]]
+	auto toGenerator(const sol::object &object) -> Xoshiro256 *;
+} // namespace lua::random
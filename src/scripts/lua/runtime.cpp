@@ -2,22 +2,30 @@
 
 #include <fmt/core.h>
 #include <spdlog/spdlog.h>
+#include <utility>
 
 // clang-format off
 const LuaSandbox::SandboxPresets
 LuaSandbox::sandboxPresets{
 	{Presets::Core, {}},
 	{Presets::Minimal,
-		{sol::lib::base,
-		 sol::lib::table}},
+		{.libs = {sol::lib::base,
+				  sol::lib::table}}},
 	{Presets::Complete,
-		{sol::lib::base,
-		 sol::lib::coroutine,
-		 sol::lib::math,
-		 sol::lib::os,
-		 sol::lib::string,
-		 sol::lib::table}},
-	{Presets::Custom, {}}
+		{.libs = {sol::lib::base,
+				  sol::lib::coroutine,
+				  sol::lib::math,
+				  sol::lib::os,
+				  sol::lib::string,
+				  sol::lib::table}}},
+	{Presets::Custom, {}},
+	{Presets::Deterministic, // No 'math' and 'os': their results may differ between peers
+		{.libs = {sol::lib::base,
+				  sol::lib::coroutine,
+				  sol::lib::string,
+				  sol::lib::table},
+		 .engineLibs = {lua::EngineLib::Fixed,
+						lua::EngineLib::Random}}}
 };
 
 const LuaSandbox::LibsSandboxingRulesMap
@@ -38,21 +46,78 @@ LuaSandbox::libsSandboxingRules{
 	{sol::lib::table,
 		{.allowedAllExceptRestricted = true}}
 };
+
+const LuaSandbox::EngineLibsSandboxingRulesMap
+LuaSandbox::engineLibsSandboxingRules{
+	{lua::EngineLib::Fixed,
+		{.allowedAllExceptRestricted = true}},
+	{lua::EngineLib::Random,
+		{.allowedAllExceptRestricted = true}}
+};
 // clang-format on
 
 void LuaRuntime::reset()
 {
-	if (usesLimitedAllocator()) {
+	sharedLibs.clear(); // The proxies belong to the state being replaced
+	sharedEngineLibs.clear();
+	if (allocProfiler) {
+		allocProfiler->detach();
+	}
+	// Like the own limit, the quota can't stop the new state from being built. The credit is
+	// settled with what the new state uses afterwards.
+	auto *quota = std::exchange(allocatorState.quota, nullptr);
+	allocatorState.sandbox = nullptr;
+
+	if (usesArena()) {
+		resetArena();
+	} else if (usesLimitedAllocator()) {
 		const auto currentLimit = allocatorState.limit;
 		allocatorState.disableLimit();
 
-		state = sol::state(sol::default_at_panic, allocatorFn, &allocatorState);
+		state = sol::state(sol::default_at_panic, stateAllocator(), &allocatorState);
 
-		allocatorState = {.used = allocatorState.used, .limit = currentLimit};
+		allocatorState.limit = currentLimit;
+		allocatorState.resetErrorFlags();
 	} else {
 		state = sol::state();
 	}
+	if (quota != nullptr) {
+		allocatorState.quota = quota;
+		lua::memory::setQuota(allocatorState, quota);
+	}
+	loadedLibs.clear();
 	timeoutGuard.attach(state, true);
+	gcPacer.attach(state);
+	if (allocProfiler) {
+		allocProfiler->clear();
+		allocProfiler->attach(state);
+	}
+}
+
+void LuaRuntime::resetArena()
+{
+	const auto currentLimit = allocatorState.limit;
+	allocatorState.disableLimit();
+
+	auto retired = std::exchange(allocatorPool, lua::memory::makePoolFor(allocatorFn));
+	allocatorState.pool = allocatorPool.get();
+
+	const auto usedBefore = allocatorState.used;
+	auto fresh = sol::state(sol::default_at_panic, stateAllocator(), &allocatorState);
+	const auto freshUsed = allocatorState.used - usedBefore;
+
+	// The old state is closed inside its own region: finalizers may still allocate there and
+	// every free is a no-op, since the whole region is dropped right after.
+	allocatorState.pool = retired.get();
+	retired->discardFrees();
+	state = std::move(fresh);
+
+	allocatorState.pool = allocatorPool.get();
+	retired.reset();
+
+	allocatorState.used = freshUsed;
+	allocatorState.limit = currentLimit;
+	allocatorState.resetErrorFlags();
 }
 
 bool LuaRuntime::setMemoryLimit(size_t limit)
@@ -63,11 +128,55 @@ bool LuaRuntime::setMemoryLimit(size_t limit)
 	return usesLimitedAllocator();
 }
 
+bool LuaRuntime::setMemoryQuota(lua::memory::Quota *quota)
+{
+	if (usesLimitedAllocator()) {
+		lua::memory::setQuota(allocatorState, quota);
+	}
+	return usesLimitedAllocator();
+}
+
+bool LuaRuntime::enableSandboxMemory()
+{
+	if (!usesLimitedAllocator()) {
+		return false;
+	}
+	if (!usesSandboxMemory()) {
+		allocatorState.base = allocatorFn;
+		reset(); // The blocks of the current state have no owner header
+	}
+	return true;
+}
+
+auto LuaRuntime::acquireSandboxMemory() -> lua::memory::SandboxMemory *
+{
+	for (auto &record : sandboxMemory) {
+		if (record->released && record->used == 0) {
+			*record = lua::memory::SandboxMemory{};
+			return record.get();
+		}
+	}
+	return sandboxMemory.emplace_back(std::make_unique<lua::memory::SandboxMemory>()).get();
+}
+
+void LuaRuntime::releaseSandboxMemory(lua::memory::SandboxMemory *sandbox) noexcept
+{
+	if (allocatorState.sandbox == sandbox) {
+		allocatorState.sandbox = nullptr;
+	}
+	sandbox->released = true;
+	sandbox->limit = 0;
+}
+
 void LuaRuntime::require(sol::lib lib)
 {
 	if (!loadedLibs.contains(lib)) {
 		state.open_libraries(lib);
 		loadedLibs.insert(lib);
+		// Lua 5.1 opens the coroutine lib along with the base one
+		if (lib == sol::lib::base || lib == sol::lib::coroutine) {
+			lua::timeoutGuard::trackCoroutines(state);
+		}
 	}
 }
 
@@ -77,38 +186,144 @@ void LuaSandbox::reset(bool doCollectGrbg /* = false */)
 {
 	sandbox = sol::environment(runtime->state, sol::create);
 	sandbox["_G"] = sandbox;
+	loadedModules.clear();
+	natives = sol::table{};
 
-	if (loadedLibs.empty()) {
-		loadLibs(sandboxPresets.at(preset));
+	if (loadedLibs.empty() && loadedEngineLibs.empty()) {
+		const auto &presetLibs = sandboxPresets.at(preset);
+		loadLibs(presetLibs.libs);
+		loadLibs(presetLibs.engineLibs);
 	} else {
 		loadLibs(loadedLibs);
+		loadLibs(loadedEngineLibs);
 	}
 	loadSafePrint();
 	loadSafeExternalScriptFilesRoutine();
+	takeBaseline();
 
 	if (doCollectGrbg) {
-		runtime->state.collect_garbage();
+		runtime->collectGarbage();
+	}
+}
+
+void LuaSandbox::MemoryReleaser::operator()(lua::memory::SandboxMemory *memory) const
+{
+	runtime->releaseSandboxMemory(memory);
+}
+
+bool LuaSandbox::setMemoryLimit(size_t limit)
+{
+	if (!runtime->usesSandboxMemory()) {
+		spdlog::error("Unable to limit the sandbox memory: "
+					  "sandbox memory accounting isn't enabled on the runtime");
+		return false;
+	}
+	if (memory == nullptr) {
+		memory = decltype(memory)(runtime->acquireSandboxMemory(), MemoryReleaser{runtime});
+	}
+	memory->limit = limit;
+	return true;
+}
+
+void LuaSandbox::recycle()
+{
+	auto toRestore = std::vector<sol::object>{};
+	for (const auto &[key, value] : sandbox) {
+		const sol::object original = baseline.raw_get<sol::object>(key);
+		if (original != value) {
+			toRestore.push_back(key);
+		}
+	}
+	for (const auto &key : toRestore) {
+		sandbox.raw_set(key, baseline.raw_get<sol::object>(key));
+	}
+	// Baseline globals the scripts have removed
+	for (const auto &[key, value] : baseline) {
+		if (sandbox.raw_get<sol::object>(key) == sol::nil) {
+			sandbox.raw_set(key, value);
+		}
+	}
+	loadedLibs = baselineLibs;
+	loadedEngineLibs = baselineEngineLibs;
+	loadedModules.clear();
+	natives = sol::table{};
+}
+
+void LuaSandbox::takeBaseline()
+{
+	baseline = sol::table(runtime->state, sol::create);
+	for (const auto &[key, value] : sandbox) {
+		baseline.raw_set(key, value);
+	}
+	baselineLibs = loadedLibs;
+	baselineEngineLibs = loadedEngineLibs;
+}
+
+auto LuaSandbox::nativesIndex() -> const sol::table &
+{
+	if (!natives.valid()) {
+		natives = sol::table(runtime->state, sol::create);
+		lua::snapshot::addNatives(natives, baseline);
+
+		// Libs required after reset(). The environment can't be indexed as a whole here,
+		// since by now scripts may have put their own tables there.
+		for (const auto lib : loadedLibs - baselineLibs) {
+			if (lib == sol::lib::base) { // Its functions are copied right into the environment
+				for (const auto &[key, value] : runtime->state.globals()) {
+					if (key.get_type() == sol::type::string
+						&& sandbox.raw_get<sol::object>(key) == value) {
+						lua::snapshot::addNative(natives, key.as<std::string>(), value);
+					}
+				}
+			} else if (const auto name = lua::libLookupName(lib); !name.empty()) {
+				lua::snapshot::addNative(natives, std::string(name),
+										 sandbox.raw_get<sol::object>(name));
+			}
+		}
+		for (const auto lib : loadedEngineLibs - baselineEngineLibs) {
+			const auto name = std::string(lua::engineLibName(lib));
+			lua::snapshot::addNative(natives, name, sandbox.raw_get<sol::object>(name));
+		}
+		for (const auto &[name, native] : hostNatives) {
+			lua::snapshot::addNative(natives, name, native);
+		}
 	}
+	return natives;
+}
+
+void LuaSandbox::addSnapshotNative(const std::string &name, const sol::object &native)
+{
+	hostNatives.emplace_back(name, native);
+	natives = sol::table{};
+}
+
+bool LuaSandbox::saveSnapshot(lua::snapshot::Writer &writer)
+{
+	return lua::snapshot::save(writer, sandbox, baseline, nativesIndex());
+}
+
+bool LuaSandbox::restoreSnapshot(std::span<const std::byte> snapshot)
+{
+	return lua::snapshot::restore(snapshot, sandbox, nativesIndex());
 }
 
 auto LuaSandbox::run(std::string_view script)
 	-> sol::protected_function_result
 {
+	const auto memoryScope = makeMemoryScope();
 	return runtime->state.safe_script(script, sandbox);
 }
 
-auto LuaSandbox::checkIfAllowedToLoad(const fs::path &scriptFile) const
+auto LuaSandbox::checkIfAllowedToLoad(const fs::path &scriptFile,
+									  const std::optional<fs_utils::FileStamp> &stamp) const
 	-> std::tuple<bool, std::string_view>
 {
-	if (!fs::exists(scriptFile)) {
+	if (!stamp) {
 		return {false, "Attempting to run a non-existent script"};
 	}
 	if (!isPathAllowed(scriptFile)) {
 		return {false, "Attempting to run a script outside the allowed path"};
 	}
-	if (lua::isBytecode(scriptFile)) {
-		return {false, "Attempting to run precompiled Lua bytecode"};
-	}
 	return {true, {}};
 }
 
@@ -121,10 +336,12 @@ auto LuaSandbox::runFile(const fs::path &scriptFile)
 		return lua::makeFnCallResult(runtime->state, errMsg, sol::call_status::file);
 	};
 
-	if (const auto [isFileOk, errMsg] = checkIfAllowedToLoad(scriptFile); !isFileOk) {
-		return error(errMsg);
+	const auto memoryScope = makeMemoryScope();
+	auto [chunk, errMsg] = loadChunk(scriptFile);
+	if (!chunk.valid()) {
+		return error(errMsg.as<std::string>());
 	}
-	return runtime->state.safe_script_file(scriptFile.string(), sandbox);
+	return chunk.as<sol::protected_function>()();
 }
 
 bool LuaSandbox::require(sol::lib lib)
@@ -135,7 +352,42 @@ bool LuaSandbox::require(sol::lib lib)
 	return false;
 }
 
-auto LuaSandbox::loadfileReplace(sol::stack_object fileName)
+bool LuaSandbox::require(lua::EngineLib lib)
+{
+	if (preset == Presets::Custom) {
+		return loadLib(lib);
+	}
+	return false;
+}
+
+auto LuaSandbox::packEntryName(const fs::path &scriptFile) const
+	-> std::optional<std::string>
+{
+	if (scriptsRoot.empty()) {
+		return std::nullopt;
+	}
+	const auto relative = scriptFile.lexically_relative(scriptsRoot);
+	if (relative.empty() || *relative.begin() == "..") {
+		return std::nullopt;
+	}
+	return pack::entryName(relative);
+}
+
+auto LuaSandbox::scriptStamp(const fs::path &scriptFile) const
+	-> std::optional<fs_utils::FileStamp>
+{
+	if (scriptsPack == nullptr) {
+		return runtime->fileStamp(scriptFile);
+	}
+	// Entries change only along with the whole pack
+	const auto entry = packEntryName(scriptFile);
+	if (!entry || !scriptsPack->contains(*entry)) {
+		return std::nullopt;
+	}
+	return scriptsPack->stamp();
+}
+
+auto LuaSandbox::loadChunk(const fs::path &scriptFile)
 	-> ResultOrErrorMsg
 {
 	auto lua = sol::state_view(runtime->state.lua_state());
@@ -143,26 +395,62 @@ auto LuaSandbox::loadfileReplace(sol::stack_object fileName)
 	auto makeError = [&](std::string_view errMsg) -> ResultOrErrorMsg {
 		return {sol::nil, sol::make_object(lua, errMsg)};
 	};
+	auto makeChunk = [&](sol::protected_function chunk) -> ResultOrErrorMsg {
+		sandbox.set_on(chunk);
+		return {sol::make_object(lua, chunk), sol::nil};
+	};
 
-	if (!fileName.is<std::string>()) {
-		return makeError("Bad argument #1 to 'loadfile' (string expected)");
+	auto *cache = runtime->getChunkCache();
+	const auto stamp = scriptStamp(scriptFile);
 
+	// Only text scripts are ever cached, so a hit needs no existence or bytecode checks.
+	if (cache != nullptr && stamp && isPathAllowed(scriptFile)) {
+		if (auto chunk = cache->find(lua, scriptFile, *stamp)) {
+			return makeChunk(std::move(*chunk));
+		}
 	}
-	const auto filePath = toScriptPath(fileName.as<std::string>());
-	const auto &[isFileOk, fileErrMsg] = checkIfAllowedToLoad(filePath);
-
-	if (!isFileOk) {
-		return makeError(fileErrMsg);
+	if (const auto [isFileOk, errMsg] = checkIfAllowedToLoad(scriptFile, stamp); !isFileOk) {
+		return makeError(errMsg);
 	}
-	auto loadResult = lua.load_file(filePath.string(), sol::load_mode::text);
+	// The file is opened once: its contents are checked for the bytecode signature and
+	// parsed from the same buffer. Pack entries are parsed right from the mapping.
+	auto fileContent = std::optional<std::string>{};
+	auto source = std::optional<std::string_view>{};
+	if (scriptsPack != nullptr) {
+		source = scriptsPack->findText(*packEntryName(scriptFile));
+	} else if (fileContent = fs_utils::readFile(scriptFile, stamp->size); fileContent) {
+		source = *fileContent;
+	}
+	if (!source) {
+		return makeError("Unable to read the script file");
+	}
+	source = lua::skipShebang(*source);
+	if (lua::isBytecode(*source)) {
+		return makeError("Attempting to run precompiled Lua bytecode");
+	}
+	const auto chunkName = "@" + scriptFile.string();
+	auto loadResult = lua.load_buffer(source->data(), source->size(), chunkName,
+									  sol::load_mode::text);
 	if (!loadResult.valid()) {
 		sol::error err = loadResult;
 		return makeError(err.what());
 	}
 	auto chunk = sol::protected_function(loadResult);
-	sandbox.set_on(chunk);
+	if (cache != nullptr) {
+		cache->store(scriptFile, *stamp, chunk);
+	}
+	return makeChunk(std::move(chunk));
+}
 
-	return { sol::make_object(lua, chunk), sol::nil };
+auto LuaSandbox::loadfileReplace(sol::stack_object fileName)
+	-> ResultOrErrorMsg
+{
+	if (!fileName.is<std::string>()) {
+		return {sol::nil,
+				sol::make_object(runtime->state,
+								 "Bad argument #1 to 'loadfile' (string expected)")};
+	}
+	return loadChunk(toScriptPath(fileName.as<std::string>()));
 }
 
 auto LuaSandbox::dofileReplace(sol::stack_object fileName)
@@ -224,20 +512,47 @@ auto LuaSandbox::dofileSafe(sol::stack_object fileName)
 auto LuaSandbox::requireFile(sol::stack_object fileName)
 	-> ResultOrErrorMsg
 {
-	auto [chunk, errMsg] = loadfileReplace(fileName);
+	auto makeError = [&](std::string_view errMsg) -> ResultOrErrorMsg {
+		return {sol::nil, sol::make_object(runtime->state, errMsg)};
+	};
+
+	if (!fileName.is<std::string>()) {
+		return makeError("Bad argument #1 to 'require_file' (string expected)");
+	}
+	const auto filePath = toScriptPath(fileName.as<std::string>());
+	const auto moduleKey = fs_utils::normalize(filePath).string();
+	const auto stamp = scriptStamp(filePath);
+
+	if (const auto it = loadedModules.find(moduleKey); it != loadedModules.end()) {
+		if (it->second.loading) {
+			return makeError(std::format(R"(Loop while loading module "{}")",
+										 fileName.as<std::string>()));
+		}
+		if (stamp && it->second.stamp == *stamp) {
+			return {it->second.result, sol::nil};
+		}
+		loadedModules.erase(it);
+	}
+
+	auto [chunk, errMsg] = loadChunk(filePath);
 	if (!chunk.valid()) {
 		return { sol::nil, errMsg };
 	}
+	loadedModules[moduleKey].loading = true;
+
 	auto function = chunk.as<sol::protected_function>();
 	auto result = function();
 	if (!result.valid()) {
+		loadedModules.erase(moduleKey);
 		sol::error err = result;
-		return { sol::nil, sol::make_object(runtime->state, err.what()) };
-	}
-	if (result.return_count() == 0) {
-		return {};
+		return makeError(err.what());
 	}
-	return { result[0], sol::nil };
+	auto &module = loadedModules[moduleKey];
+	module.loading = false;
+	module.stamp = stamp.value_or(fs_utils::FileStamp{});
+	module.result = result.return_count() > 0 ? sol::object(result[0]) : sol::object(sol::nil);
+
+	return { module.result, sol::nil };
 }
 
 auto LuaSandbox::requireReplace(sol::stack_object target)
@@ -279,8 +594,8 @@ void LuaSandbox::loadSafePrint()
 
 auto LuaSandbox::checkRulesFor(sol::lib lib) noexcept -> opt_cref<LibSymbolsRules>
 {
-	if (const auto it = libsSandboxingRules.find(lib); it != libsSandboxingRules.end()) {
-		return it->second;
+	if (const auto *rules = libsSandboxingRules.find(lib)) {
+		return *rules;
 	}
 	return std::nullopt;
 }
@@ -295,6 +610,30 @@ bool LuaSandbox::loadLib(sol::lib lib)
 
 	copyLibFromState(lib, *rules);
 	loadedLibs.insert(lib);
+	natives = sol::table{};
+	return true;
+}
+
+bool LuaSandbox::loadLib(lua::EngineLib lib)
+{
+	const auto *rules = engineLibsSandboxingRules.find(lib);
+	if (rules == nullptr) {
+		return false;
+	}
+	auto proxy = sol::table{};
+	if (const auto shared = runtime->findSharedLib(lib)) {
+		proxy = *shared;
+	} else {
+		const auto src = lua::makeEngineLib(runtime->state, lib);
+		auto allowed = sol::table(runtime->state, sol::create);
+		copyLibSymbols(src, allowed, *rules);
+
+		proxy = lua::makeReadOnlyProxy(runtime->state, allowed);
+		runtime->shareLib(lib, proxy);
+	}
+	sandbox[lua::engineLibName(lib)] = proxy;
+	loadedEngineLibs.insert(lib);
+	natives = sol::table{};
 	return true;
 }
 
@@ -304,15 +643,34 @@ void LuaSandbox::copyLibFromState(sol::lib lib, const LibSymbolsRules &rules)
 	if (libLookupName.empty()) {
 		return;
 	}
+	if (lib != sol::lib::base) {
+		// Other libs are shared between sandboxes as read-only proxies, built once per runtime.
+		if (const auto shared = runtime->findSharedLib(lib)) {
+			sandbox[libLookupName] = *shared;
+			return;
+		}
+	}
 	const sol::table src = runtime->state[libLookupName];
 	if (!src.valid()) {
 		return;
 	}
-	if (lib != sol::lib::base) { // The 'base' is loaded directly into '_G', which already exists
-		sandbox[libLookupName] = sol::table(runtime->state, sol::create);
+	if (lib == sol::lib::base) { // The 'base' is loaded directly into '_G', which already exists
+		sol::table dst = sandbox;
+		copyLibSymbols(src, dst, rules);
+		return;
 	}
-	sol::table dst = sandbox[libLookupName];
+	auto allowed = sol::table(runtime->state, sol::create);
+	copyLibSymbols(src, allowed, rules);
 
+	const auto proxy = lua::makeReadOnlyProxy(runtime->state, allowed);
+	runtime->shareLib(lib, proxy);
+	sandbox[libLookupName] = proxy;
+}
+
+void LuaSandbox::copyLibSymbols(const sol::table &src,
+								sol::table &dst,
+								const LibSymbolsRules &rules)
+{
 	if (rules.allowedAllExceptRestricted) {
 		for (const auto &[name, object] : src) {
 			dst[name] = object;
@@ -337,8 +695,7 @@ bool LuaSandbox::allowScriptPath(const fs::path &path)
 		return false;
 	}
 	const auto allow = path.is_relative() ? scriptsRoot / path : path;
-	allowedScriptPaths.push_back(fs_utils::normalize(allow));
-	return true;
+	return allowedScriptPaths.insert(allow);
 }
 
 void LuaSandbox::setPathsForScripts(const fs::path &root, const Paths &allowed)
@@ -372,20 +729,25 @@ bool LuaSandbox::isPathAllowed(const fs::path &scriptFile) const
 		if (scriptsRoot.empty()) {
 			return false;
 		}
-		return fs_utils::startsWith(scriptsRoot / scriptFile, allowedScriptPaths);
+		return allowedScriptPaths.contains(scriptsRoot / scriptFile);
 	}
-	return fs_utils::startsWith(scriptFile, allowedScriptPaths);
+	return allowedScriptPaths.contains(scriptFile);
 }
 
 void LuaSandbox::printReplace(sol::variadic_args args)
 {
-	std::string result;
-	for (auto &&arg : args) {
-		result += lua::toString(arg);
-		result += " ";
+	if (!printLimiter.tryConsume()) {
+		++printsOverLimit;
+		return;
 	}
-	if (!result.empty()) {
-		result.pop_back(); // remove last space separator
+	lua_State *L = args.lua_state();
+
+	printBuffer.assign("[lua sandbox]:> ");
+	for (int i = 0; i < static_cast<int>(args.size()); ++i) {
+		if (i > 0) {
+			printBuffer += ' ';
+		}
+		lua::print::appendValue(printBuffer, L, args.stack_index() + i);
 	}
-	*printOutStrm << "[lua sandbox]:> " << result << "\n";
+	printSink->write(printBuffer);
 }
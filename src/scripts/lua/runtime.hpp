@@ -1,26 +1,46 @@
 #pragma once
 
+#include "lua/alloc_profiler.hpp"
+#include "lua/allocators.hpp"
+#include "lua/chunk_cache.hpp"
+#include "lua/engine_libs.hpp"
+#include "lua/gc_pacer.hpp"
+#include "lua/print_sink.hpp"
+#include "lua/quota.hpp"
+#include "lua/snapshot.hpp"
 #include "lua/sol2.hpp"
 #include "lua/utils.hpp"
 
+#include "utils/enum_map.hpp"
 #include "utils/enum_set.hpp"
 #include "utils/filesystem.hpp"
 #include "utils/optional_ref.hpp"
+#include "utils/pack.hpp"
 
-#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 template <typename T>
-concept SolLibContainer =
+concept LibContainer =
 	std::ranges::range<T>
-	&& std::same_as<std::ranges::range_value_t<T>, sol::lib>;
+	&& (std::same_as<std::ranges::range_value_t<T>, sol::lib>
+		|| std::same_as<std::ranges::range_value_t<T>, lua::EngineLib>);
 /*-----------------------------------------------------------------------------------------------*/
 class LuaRuntime
 {
 private:
+	std::unique_ptr<lua::memory::SizeClassPool> allocatorPool{};
 	lua::memory::LimitedAllocatorState allocatorState{};
 	lua::memory::Allocator allocatorFn{nullptr};
+	std::unique_ptr<lua::memory::AllocProfiler> allocProfiler{};
+	// Records of the sandboxes accounted, kept here since blocks refer to them (see
+	// lua::memory::sandboxAlloc()) until they're freed, possibly after the sandbox is gone
+	std::vector<std::unique_ptr<lua::memory::SandboxMemory>> sandboxMemory{};
 
 public:
 	sol::state state;
@@ -28,6 +48,11 @@ public:
 private:
 	enum_set<sol::lib> loadedLibs;
 	lua::timeoutGuard::Watchdog timeoutGuard;
+	lua::gc::Pacer gcPacer;
+	lua::ChunkCache *chunkCache{&lua::ChunkCache::global()};
+	enum_map<sol::lib, sol::table> sharedLibs; // Read-only lib proxies, reused by every sandbox
+	enum_map<lua::EngineLib, sol::table> sharedEngineLibs;
+	fs_utils::StatCache statCache;
 
 public:
 	LuaRuntime()
@@ -35,10 +60,11 @@ public:
 		  timeoutGuard(state)
 	{}
 
-	~LuaRuntime() = default;
+	~LuaRuntime() { disableAllocProfiler(); } // Detached while the state is still open
 
 	LuaRuntime(size_t memoryLimit, lua::memory::Allocator fn = lua::memory::limitedAlloc)
-		: allocatorState({.limit = memoryLimit}),
+		: allocatorPool(lua::memory::makePoolFor(fn)),
+		  allocatorState({.limit = memoryLimit, .pool = allocatorPool.get()}),
 		  allocatorFn(fn),
 		  state(sol::default_at_panic, fn, &allocatorState),
 		  timeoutGuard(state)
@@ -51,15 +77,21 @@ public:
 
 	void reset();
 	bool setMemoryLimit(size_t limit);
+	// Charges the memory of the state to a quota shared with other runtimes as well, on top of
+	// the own limit. Requires the limited allocator; the quota must outlive the runtime.
+	bool setMemoryQuota(lua::memory::Quota *quota);
 	void require(sol::lib lib);
 
 	[[nodiscard]]
 	bool usesLimitedAllocator() { return allocatorFn != nullptr; }
+	[[nodiscard]]
+	bool usesArena() const noexcept { return allocatorFn == lua::memory::arenaAlloc; }
 
 	[[nodiscard]]
 	bool hasAllocError() const noexcept
 	{
-		return allocatorState.limitReached || allocatorState.overflow;
+		return allocatorState.limitReached || allocatorState.overflow
+			|| allocatorState.quotaReached;
 	}
 	void resetAllocErrors() noexcept { allocatorState.resetErrorFlags(); }
 
@@ -75,12 +107,136 @@ public:
 	{
 		return lua::timeoutGuard::GuardedScope{timeoutGuard, limit};
 	}
+	bool setTimeoutGuardMode(lua::timeoutGuard::Mode mode) noexcept
+	{
+		return timeoutGuard.setMode(mode);
+	}
+
+	// Stops the automatic garbage collection: the collector then runs in collectIdle(),
+	// which the host calls in the idle time after each tick. Survives reset().
+	void enableGcPacer(const lua::gc::PacerSettings &settings = {})
+	{
+		gcPacer.configure(settings);
+		gcPacer.enable(state);
+	}
+	void disableGcPacer() { gcPacer.disable(state); }
+
+	// Returns the time spent collecting; nothing is done if the pacer is disabled.
+	auto collectIdle() -> std::chrono::nanoseconds
+	{
+		return gcPacer.idle(state, usesLimitedAllocator() ? &allocatorState : nullptr);
+	}
+	// Incremental step and full collection which leave the pacer in charge
+	bool stepGc(int stepSize = 0) { return gcPacer.step(state, stepSize); }
+	void collectGarbage() { gcPacer.collect(state); }
+
+	[[nodiscard]]
+	auto getGcStats() const noexcept -> const lua::gc::PacerStats & { return gcPacer.getStats(); }
+	void resetGcStats() noexcept { gcPacer.resetStats(); }
+
+	// Samples the allocations of the state by Lua call stack. Survives reset(), which clears
+	// the collected data.
+	void enableAllocProfiler(size_t sampleInterval = lua::memory::cDefaultSampleInterval)
+	{
+		disableAllocProfiler(); // A new profiler would wrap the previous one
+		allocProfiler = std::make_unique<lua::memory::AllocProfiler>(sampleInterval);
+		allocProfiler->attach(state);
+	}
+	void disableAllocProfiler() { allocProfiler.reset(); }
+
+	[[nodiscard]]
+	auto getAllocProfiler() const noexcept -> const lua::memory::AllocProfiler *
+	{
+		return allocProfiler.get();
+	}
+
+	// Per sandbox memory accounting, see LuaSandbox::setMemoryLimit(). Requires the limited
+	// allocator. Every block then carries the sandbox it's charged to, so the state is rebuilt
+	// as by reset() the first time: to be called before creating the sandboxes.
+	bool enableSandboxMemory();
+	[[nodiscard]]
+	bool usesSandboxMemory() const noexcept { return allocatorState.base != nullptr; }
+
+	// The record is reused once the sandbox is released and no block is charged to it anymore.
+	[[nodiscard]]
+	auto acquireSandboxMemory() -> lua::memory::SandboxMemory *;
+	void releaseSandboxMemory(lua::memory::SandboxMemory *sandbox) noexcept;
+
+	[[nodiscard]]
+	auto makeSandboxMemoryScope(lua::memory::SandboxMemory *sandbox)
+		-> lua::memory::SandboxMemoryScope
+	{
+		return {usesLimitedAllocator() ? &allocatorState : nullptr, sandbox};
+	}
+
+	[[nodiscard]]
+	auto findSharedLib(sol::lib lib) const -> opt_cref<sol::table>
+	{
+		if (const auto *proxy = sharedLibs.find(lib)) {
+			return *proxy;
+		}
+		return std::nullopt;
+	}
+	void shareLib(sol::lib lib, const sol::table &proxy) { sharedLibs.insert_or_assign(lib, proxy); }
+
+	[[nodiscard]]
+	auto findSharedLib(lua::EngineLib lib) const -> opt_cref<sol::table>
+	{
+		if (const auto *proxy = sharedEngineLibs.find(lib)) {
+			return *proxy;
+		}
+		return std::nullopt;
+	}
+	void shareLib(lua::EngineLib lib, const sol::table &proxy)
+	{
+		sharedEngineLibs.insert_or_assign(lib, proxy);
+	}
+
+	// Stamp (or nullopt if the file is missing) seen by the script loaders of this runtime.
+	// Reused until the stat cache TTL runs out, so a chunk cache hit makes no system call.
+	[[nodiscard]]
+	auto fileStamp(const fs::path &file) -> std::optional<fs_utils::FileStamp>
+	{
+		return statCache.stamp(file);
+	}
+	// How long the loaders reuse a file stamp instead of checking the file again, by default
+	// fs_utils::StatCache::cDefaultTtl: a script changed on disk is seen once its stamp
+	// expires, or right away after invalidateFileStamps(). Zero checks the file on each load.
+	void setStatCacheTtl(std::chrono::milliseconds ttl)
+	{
+		statCache.setTtl(ttl);
+		statCache.clear();
+	}
+	// Makes the loaders check the file again on its next load, every file if none is given.
+	// The path is matched as the loaders see it, i.e. after toScriptPath().
+	void invalidateFileStamps(const fs::path &file = {})
+	{
+		if (file.empty()) {
+			statCache.clear();
+		} else {
+			statCache.invalidate(file);
+		}
+	}
+
+	// Compiled script files are taken from this cache. Pass nullptr to always load from disk.
+	void setChunkCache(lua::ChunkCache *cache) noexcept { chunkCache = cache; }
+	[[nodiscard]]
+	auto getChunkCache() const noexcept -> lua::ChunkCache * { return chunkCache; }
+
+private:
+	void resetArena();
+
+	[[nodiscard]]
+	auto stateAllocator() const noexcept -> lua::memory::Allocator
+	{
+		return usesSandboxMemory() ? lua::memory::sandboxAlloc : allocatorFn;
+	}
 };
 /*-----------------------------------------------------------------------------------------------*/
 class LuaSandbox
 {
 public:
-	enum class Presets { Core, Minimal, Complete, Custom };
+	enum class Presets { Core, Minimal, Complete, Custom, Deterministic, Count };
 	using Paths = std::vector<fs::path>;
 	using ResultOrErrorMsg = std::tuple<sol::object, sol::object>;
 
@@ -91,7 +247,21 @@ public:
 						std::ostream &printOutStrm = std::cout)
 		: runtime(&runtime),
 		  preset(preset),
-		  printOutStrm(&printOutStrm)
+		  ownedPrintSink(std::make_unique<lua::print::StreamSink>(printOutStrm)),
+		  printSink(ownedPrintSink.get())
+	{
+		setPathsForScripts(root, allowedPaths);
+		reset();
+	}
+
+	explicit LuaSandbox(LuaRuntime &runtime,
+						Presets preset,
+						const fs::path &root,
+						const Paths &allowedPaths,
+						lua::print::Sink &printSink)
+		: runtime(&runtime),
+		  preset(preset),
+		  printSink(&printSink)
 	{
 		setPathsForScripts(root, allowedPaths);
 		reset();
@@ -105,15 +275,45 @@ public:
 	LuaSandbox &operator=(LuaSandbox &&) = default;
 
 	auto operator[](auto &&key) noexcept { return sandbox[std::forward<decltype(key)>(key)]; }
+	[[nodiscard]]
+	auto getEnvironment() const noexcept -> const sol::environment & { return sandbox; }
 	void reset(bool doCollectGrbg = false);
 
+	// Brings the environment back to the state it had right after reset(): globals created by
+	// scripts are removed and overwritten ones are restored. Much cheaper than reset(), which
+	// rebuilds the environment and reinstalls every binding.
+	void recycle();
+
 	auto run(std::string_view script) -> sol::protected_function_result;
 	auto runFile(const fs::path &scriptFile) -> sol::protected_function_result;
 
 	[[nodiscard]]
 	bool require(sol::lib lib);
+	[[nodiscard]]
+	bool require(lua::EngineLib lib);
 	bool allowScriptPath(const fs::path &path);
 
+	// Saves the data reachable from the environment: globals changed since reset() and
+	// everything they refer to. Functions and tables of the loaded libs are saved by name,
+	// so the sandbox restoring it needs the same libs.
+	[[nodiscard]]
+	bool saveSnapshot(lua::snapshot::Writer &writer);
+
+	// Applies a snapshot on top of the environment, normally one just reset() with the
+	// scripts that define the global functions already run.
+	[[nodiscard]]
+	bool restoreSnapshot(std::span<const std::byte> snapshot);
+
+	// Lets snapshots refer to a function, userdata or lib proxy bound by the host after reset()
+	// (e.g. sandbox["units"] = columns.object()) by the given name. The sandbox restoring them
+	// must have its own object registered under the same name. Kept by reset() and recycle().
+	void addSnapshotNative(const std::string &name, const sol::object &native);
+
+	// Script files are then read from the pack instead of the disk, by their path relative to
+	// the scripts root. Allowed paths still apply. The pack must outlive the sandbox,
+	// nullptr switches back to loose files.
+	void mountScriptsPack(const pack::Archive *archive) noexcept { scriptsPack = archive; }
+
 	[[nodiscard]]
 	auto makeTimeoutGuardedScope(std::chrono::milliseconds limit)
 		-> lua::timeoutGuard::GuardedScope
@@ -121,10 +321,54 @@ public:
 		return runtime->makeTimeoutGuardedScope(limit);
 	}
 
+	// The sink must outlive the sandbox.
+	void setPrintSink(lua::print::Sink &sink) noexcept
+	{
+		ownedPrintSink.reset();
+		printSink = &sink;
+	}
+	void setPrintRateLimit(lua::print::RateLimit limit) noexcept { printLimiter.configure(limit); }
+
+	[[nodiscard]]
+	size_t suppressedPrints() const noexcept { return printsOverLimit; }
+
+	// Limits the memory allocated while this sandbox runs, within the limit of the runtime.
+	// Zero only counts it. Requires LuaRuntime::enableSandboxMemory().
+	bool setMemoryLimit(size_t limit);
+	[[nodiscard]]
+	auto getMemoryUsage() const noexcept -> opt_cref<lua::memory::SandboxMemory>
+	{
+		if (memory == nullptr) {
+			return std::nullopt;
+		}
+		return *memory;
+	}
+	void resetMemoryErrors() noexcept
+	{
+		if (memory != nullptr) {
+			memory->limitReached = false;
+		}
+	}
+
+	// run() and runFile() are charged already; this is for calling functions of the sandbox
+	// from the host.
+	[[nodiscard]]
+	auto makeMemoryScope() -> lua::memory::SandboxMemoryScope
+	{
+		return runtime->makeSandboxMemoryScope(memory.get());
+	}
+
 private:
 	using LibNames = std::vector<std::string_view>;
 	using Libs = std::vector<sol::lib>;
-	using SandboxPresets = std::map<Presets, Libs>;
+	using EngineLibs = std::vector<lua::EngineLib>;
+
+	struct PresetLibs
+	{
+		Libs libs {};
+		EngineLibs engineLibs {};
+	};
+	using SandboxPresets = enum_map<Presets, PresetLibs>;
 
 	struct LibSymbolsRules
 	{
@@ -133,20 +377,33 @@ private:
 		LibNames restricted {};
 	};
 
-	using LibsSandboxingRulesMap = std::map<sol::lib, LibSymbolsRules>;
+	using LibsSandboxingRulesMap = enum_map<sol::lib, LibSymbolsRules>;
+	using EngineLibsSandboxingRulesMap = enum_map<lua::EngineLib, LibSymbolsRules>;
+
+	struct LoadedModule
+	{
+		fs_utils::FileStamp stamp{};
+		sol::object result{};
+		bool loading{false}; // Set while the module chunk runs, to catch require_file loops
+	};
+	using LoadedModules = std::unordered_map<std::string, LoadedModule>;
 
 	[[nodiscard]]
 	static auto checkRulesFor(sol::lib lib) noexcept -> opt_cref<LibSymbolsRules>;
 
 	bool loadLib(sol::lib lib);
+	bool loadLib(lua::EngineLib lib);
 
-	void loadLibs(const SolLibContainer auto &libs)
+	void loadLibs(const LibContainer auto &libs)
 	{
 		for (const auto lib : libs) {
 			loadLib(lib);
 		}
 	}
 	void copyLibFromState(sol::lib lib, const LibSymbolsRules &rules);
+	static void copyLibSymbols(const sol::table &src,
+							   sol::table &dst,
+							   const LibSymbolsRules &rules);
 
 	void setPathsForScripts(const fs::path &root, const Paths &allowed);
 
@@ -157,9 +414,17 @@ private:
 	bool isPathAllowed(const fs::path &scriptFile) const;
 
 	[[nodiscard]]
-	auto checkIfAllowedToLoad(const fs::path &scriptFile) const
+	auto checkIfAllowedToLoad(const fs::path &scriptFile,
+							  const std::optional<fs_utils::FileStamp> &stamp) const
 		-> std::tuple<bool, std::string_view>;
 
+	[[nodiscard]]
+	auto packEntryName(const fs::path &scriptFile) const -> std::optional<std::string>;
+	[[nodiscard]]
+	auto scriptStamp(const fs::path &scriptFile) const -> std::optional<fs_utils::FileStamp>;
+
+	auto loadChunk(const fs::path &scriptFile) -> ResultOrErrorMsg;
+
 	auto loadfileReplace(sol::stack_object fileName) -> ResultOrErrorMsg;
 	auto dofileReplace(sol::stack_object fileName) -> sol::protected_function_result;
 	auto dofileSafe(sol::stack_object fileName) -> sol::variadic_results;
@@ -171,6 +436,11 @@ private:
 	void loadSafeExternalScriptFilesRoutine();
 	void loadSafePrint();
 
+	void takeBaseline();
+
+	[[nodiscard]]
+	auto nativesIndex() -> const sol::table &;
+
 private:
 	LuaRuntime *runtime = {nullptr};
 	sol::environment sandbox;
@@ -179,12 +449,33 @@ private:
 	fs::path scriptsRoot;	// Absolute, lexically normalized path.
 							// Relative paths to script files are resolved from this location.
 							// If empty, loading external scripts is prohibited.
-	Paths allowedScriptPaths;
+	fs_utils::PathIndex allowedScriptPaths;
+	const pack::Archive *scriptsPack{nullptr};
+
+	std::unique_ptr<lua::print::Sink> ownedPrintSink; // Set when constructed with a stream
+	lua::print::Sink *printSink{nullptr};
+	lua::print::TokenBucket printLimiter;
+	size_t printsOverLimit{0};
+	std::string printBuffer;
 
-	std::ostream *printOutStrm;
+	struct MemoryReleaser // The record is given back to the runtime along with the sandbox
+	{
+		LuaRuntime *runtime; // No initializer, so unique_ptr<> sees it default constructible
+		void operator()(lua::memory::SandboxMemory *memory) const;
+	};
+	std::unique_ptr<lua::memory::SandboxMemory, MemoryReleaser> memory; // By setMemoryLimit()
 
 	enum_set<sol::lib> loadedLibs;
+	enum_set<lua::EngineLib> loadedEngineLibs;
+	LoadedModules loadedModules; // Results of require_file, keyed by normalized script path
+
+	sol::table baseline;	// Shadow copy of the environment taken by reset(), used by recycle()
+	enum_set<sol::lib> baselineLibs;
+	enum_set<lua::EngineLib> baselineEngineLibs;
+	sol::table natives;		// Index of lib functions and tables for snapshots, built on demand
+	std::vector<std::pair<std::string, sol::object>> hostNatives; // See addSnapshotNative()
 
 	static const SandboxPresets sandboxPresets;
 	static const LibsSandboxingRulesMap libsSandboxingRules;
+	static const EngineLibsSandboxingRulesMap engineLibsSandboxingRules;
 };
@@ -0,0 +1,151 @@
+#include "lua/runtime_pool.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+struct LuaRuntimePool::Worker
+{
+	LuaRuntime runtime;
+	LuaSandboxPool sandboxes;
+
+	std::mutex mutex;
+	std::deque<Task> queue; // The owner takes from the back, thieves from the front
+
+	std::jthread thread;
+
+	explicit Worker(const Config &config)
+		: runtime(config.memoryLimit, config.allocator),
+		  sandboxes(runtime, config.scriptsRoot, config.allowedScriptPaths)
+	{
+		runtime.setTimeoutGuardMode(lua::timeoutGuard::Mode::Monitor);
+	}
+};
+/*-----------------------------------------------------------------------------------------------*/
+LuaRuntimePool::LuaRuntimePool()
+	: LuaRuntimePool(Config{})
+{}
+
+LuaRuntimePool::LuaRuntimePool(Config config)
+	: config(std::move(config))
+{
+	auto count = this->config.workers;
+	if (count == 0) {
+		count = std::max(1u, std::thread::hardware_concurrency());
+	}
+	workers.reserve(count);
+	for (size_t i = 0; i < count; ++i) {
+		workers.push_back(std::make_unique<Worker>(this->config));
+	}
+	// Started only once every worker exists, since any of them can be stolen from.
+	for (size_t i = 0; i < count; ++i) {
+		workers[i]->thread = std::jthread([this, i](std::stop_token stop) { run(stop, i); });
+	}
+}
+
+LuaRuntimePool::~LuaRuntimePool()
+{
+	for (auto &worker : workers) {
+		worker->thread.request_stop();
+	}
+	for (auto &worker : workers) {
+		worker->thread.join();
+	}
+}
+
+auto LuaRuntimePool::submit(Job job) -> std::future<JobResult>
+{
+	auto task = Task{.job = std::move(job), .promise = {}};
+	auto future = task.promise.get_future();
+
+	auto &worker = *workers[nextWorker++ % workers.size()];
+	// Counted before it's published: a worker may take the task (and decrease the counter)
+	// as soon as it's in the queue.
+	{
+		const auto lock = std::scoped_lock(idleMutex);
+		++pending;
+	}
+	{
+		const auto lock = std::scoped_lock(worker.mutex);
+		worker.queue.push_back(std::move(task));
+	}
+	wakeUp.notify_one();
+	return future;
+}
+
+void LuaRuntimePool::run(std::stop_token stop, size_t index)
+{
+	auto &worker = *workers[index];
+
+	while (!stop.stop_requested()) {
+		if (auto task = takeTask(index)) {
+			execute(worker, *task);
+			continue;
+		}
+		worker.sandboxes.collectIdle();
+
+		auto lock = std::unique_lock(idleMutex);
+		wakeUp.wait(lock, stop, [this] { return pending > 0; });
+	}
+}
+
+auto LuaRuntimePool::takeTask(size_t index) -> std::optional<Task>
+{
+	auto takeFrom = [this](Worker &worker, bool own) -> std::optional<Task> {
+		const auto lock = std::scoped_lock(worker.mutex);
+		if (worker.queue.empty()) {
+			return std::nullopt;
+		}
+		auto task = std::optional<Task>{};
+		if (own) {
+			task.emplace(std::move(worker.queue.back()));
+			worker.queue.pop_back();
+		} else {
+			task.emplace(std::move(worker.queue.front()));
+			worker.queue.pop_front();
+		}
+		--pending;
+		return task;
+	};
+
+	if (auto task = takeFrom(*workers[index], true)) {
+		return task;
+	}
+	for (size_t offset = 1; offset < workers.size(); ++offset) {
+		if (auto task = takeFrom(*workers[(index + offset) % workers.size()], false)) {
+			return task;
+		}
+	}
+	return std::nullopt;
+}
+
+void LuaRuntimePool::execute(Worker &worker, Task &task)
+{
+	auto result = JobResult{};
+	// The job fails rather than the worker thread, whose exceptions would end the process
+	try {
+		auto sandbox = worker.sandboxes.acquire(task.job.preset);
+		if (!lua::marshal::setField(sandbox->getEnvironment(), "input", task.job.input)) {
+			result.error = "Unable to unmarshal the job input";
+		} else {
+			auto scriptResult = [&] {
+				auto guard = worker.runtime.makeTimeoutGuardedScope(config.timeout);
+				return sandbox->run(task.job.script);
+			}();
+
+			if (!scriptResult.valid()) {
+				sol::error err = scriptResult;
+				result.error = err.what();
+			} else if (auto value = lua::marshal::toPlain(scriptResult.get<sol::object>())) {
+				result.ok = true;
+				result.value = std::move(*value);
+			} else {
+				result.error = "Unable to marshal the script result";
+			}
+		}
+	} catch (const std::exception &err) {
+		result = JobResult{.error = err.what()};
+	}
+	worker.runtime.resetAllocErrors();
+	task.promise.set_value(std::move(result));
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "lua/marshal.hpp"
+#include "lua/sandbox_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs scripts on a set of worker threads, each owning its own LuaRuntime and sandbox pool.
+// Jobs are spread over per-worker queues; an idle worker steals the oldest job of a busy one.
+// Inputs and results cross threads only as plain data (see lua::marshal).
+class LuaRuntimePool
+{
+public:
+	using Presets = LuaSandbox::Presets;
+	using PlainValue = lua::marshal::PlainValue;
+
+	struct Config
+	{
+		size_t workers{0}; // 0 - one per hardware thread
+		size_t memoryLimit{lua::memory::cDefaultMemLimit}; // Per worker runtime, 0 - unlimited
+		lua::memory::Allocator allocator{lua::memory::limitedAlloc};
+		std::chrono::milliseconds timeout{lua::timeoutGuard::kDefaultLimit}; // Per job
+		fs::path scriptsRoot{};
+		LuaSandbox::Paths allowedScriptPaths{};
+	};
+
+	// The script runs in a recycled sandbox of the given preset, where the input is available
+	// as the 'input' global. Its first return value becomes the job result.
+	struct Job
+	{
+		Presets preset{Presets::Core};
+		std::string script{};
+		PlainValue input{};
+	};
+
+	struct JobResult
+	{
+		bool ok{false};
+		PlainValue value{};
+		std::string error{};
+	};
+
+	LuaRuntimePool();
+	explicit LuaRuntimePool(Config config);
+	// Jobs still queued are dropped: their futures report std::future_errc::broken_promise.
+	~LuaRuntimePool();
+
+	LuaRuntimePool(const LuaRuntimePool &) = delete;
+	LuaRuntimePool &operator=(const LuaRuntimePool &) = delete;
+	LuaRuntimePool(LuaRuntimePool &&) = delete;
+	LuaRuntimePool &operator=(LuaRuntimePool &&) = delete;
+
+	[[nodiscard]]
+	auto submit(Job job) -> std::future<JobResult>;
+
+	[[nodiscard]]
+	size_t workersCount() const noexcept { return workers.size(); }
+
+private:
+	struct Task
+	{
+		Job job;
+		std::promise<JobResult> promise;
+	};
+	struct Worker;
+
+	void run(std::stop_token stop, size_t index);
+	[[nodiscard]]
+	auto takeTask(size_t index) -> std::optional<Task>;
+	void execute(Worker &worker, Task &task);
+
+private:
+	Config config;
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<size_t> nextWorker{0};
+
+	std::mutex idleMutex;
+	std::condition_variable_any wakeUp;
+	// Tasks queued or about to be. Increased under idleMutex before the task is pushed, so no
+	// wake-up is lost and taking the task never drives it below zero.
+	std::atomic<size_t> pending{0};
+};
@@ -0,0 +1,50 @@
+#include "lua/sandbox_pool.hpp"
+
+void LuaSandboxPool::Handle::release()
+{
+	if (pool != nullptr && sandbox != nullptr) {
+		pool->giveBack(preset, std::move(sandbox));
+	}
+	pool = nullptr;
+	sandbox.reset();
+}
+
+auto LuaSandboxPool::acquire(Presets preset) -> Handle
+{
+	auto &ready = idle[preset];
+	if (ready.empty()) {
+		return Handle(this, preset, makeSandbox(preset));
+	}
+	auto sandbox = std::move(ready.back());
+	ready.pop_back();
+
+	return Handle(this, preset, std::move(sandbox));
+}
+
+void LuaSandboxPool::reserve(Presets preset, size_t count)
+{
+	auto &ready = idle[preset];
+	ready.reserve(count);
+	while (ready.size() < count) {
+		ready.push_back(makeSandbox(preset));
+	}
+}
+
+bool LuaSandboxPool::collectIdle(int stepSize /* = 0 */)
+{
+	return runtime->stepGc(stepSize);
+}
+
+size_t LuaSandboxPool::idleCount(Presets preset) const
+{
+	if (const auto *ready = idle.find(preset)) {
+		return ready->size();
+	}
+	return 0;
+}
+
+void LuaSandboxPool::giveBack(Presets preset, std::unique_ptr<LuaSandbox> sandbox)
+{
+	sandbox->recycle();
+	idle[preset].push_back(std::move(sandbox));
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "lua/runtime.hpp"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Keeps ready-made sandboxes of a runtime for every preset. A released sandbox is recycled
+// (only the globals created by scripts are wiped) and handed out again by the next acquire().
+//
+// Sandboxes hold references into the runtime state: the pool and every handle it gave out
+// must be gone (or clear() called) before LuaRuntime::reset() or the runtime destruction.
+class LuaSandboxPool
+{
+public:
+	using Presets = LuaSandbox::Presets;
+
+	class Handle
+	{
+	public:
+		Handle() = default;
+		~Handle() { release(); }
+
+		Handle(const Handle &) = delete;
+		Handle &operator=(const Handle &) = delete;
+
+		Handle(Handle &&other) noexcept
+			: pool(std::exchange(other.pool, nullptr)),
+			  preset(other.preset),
+			  sandbox(std::move(other.sandbox))
+		{}
+		Handle &operator=(Handle &&other) noexcept
+		{
+			if (this != &other) {
+				release();
+				pool = std::exchange(other.pool, nullptr);
+				preset = other.preset;
+				sandbox = std::move(other.sandbox);
+			}
+			return *this;
+		}
+
+		LuaSandbox *operator->() noexcept { return sandbox.get(); }
+		LuaSandbox &operator*() noexcept { return *sandbox; }
+
+		explicit operator bool() const noexcept { return sandbox != nullptr; }
+
+		// Returns the sandbox to the pool before the handle goes out of scope.
+		void release();
+
+	private:
+		friend class LuaSandboxPool;
+
+		Handle(LuaSandboxPool *pool, Presets preset, std::unique_ptr<LuaSandbox> sandbox)
+			: pool(pool),
+			  preset(preset),
+			  sandbox(std::move(sandbox))
+		{}
+
+		LuaSandboxPool *pool{nullptr};
+		Presets preset{Presets::Core};
+		std::unique_ptr<LuaSandbox> sandbox;
+	};
+
+	explicit LuaSandboxPool(LuaRuntime &runtime,
+							const fs::path &root = {},
+							const LuaSandbox::Paths &allowedPaths = {},
+							std::ostream &printOutStrm = std::cout)
+		: runtime(&runtime),
+		  root(root),
+		  allowedPaths(allowedPaths),
+		  printOutStrm(&printOutStrm)
+	{}
+	~LuaSandboxPool() = default;
+
+	LuaSandboxPool(const LuaSandboxPool &) = delete;
+	LuaSandboxPool &operator=(const LuaSandboxPool &) = delete;
+	LuaSandboxPool(LuaSandboxPool &&) = delete;
+	LuaSandboxPool &operator=(LuaSandboxPool &&) = delete;
+
+	[[nodiscard]]
+	auto acquire(Presets preset) -> Handle;
+
+	// Builds sandboxes ahead of time, so the following acquire() calls don't create any.
+	void reserve(Presets preset, size_t count);
+
+	// Performs one incremental GC step of 'stepSize' (in Kb, as for LUA_GCSTEP).
+	// Meant to be called in idle time, instead of a full collection per sandbox reset.
+	// Returns true if the step has finished a collection cycle.
+	bool collectIdle(int stepSize = 0);
+
+	[[nodiscard]]
+	size_t idleCount(Presets preset) const;
+	void clear() { idle.clear(); }
+
+private:
+	void giveBack(Presets preset, std::unique_ptr<LuaSandbox> sandbox);
+
+	[[nodiscard]]
+	auto makeSandbox(Presets preset) const -> std::unique_ptr<LuaSandbox>
+	{
+		return std::make_unique<LuaSandbox>(*runtime, preset, root, allowedPaths, *printOutStrm);
+	}
+
+private:
+	LuaRuntime *runtime{nullptr};
+
+	fs::path root;
+	LuaSandbox::Paths allowedPaths;
+	std::ostream *printOutStrm;
+
+	enum_map<Presets, std::vector<std::unique_ptr<LuaSandbox>>> idle;
+};
@@ -0,0 +1,273 @@
+#include "lua/scheduler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <string_view>
+#include <utility>
+
+namespace lua::scheduling
+{
+	struct Scheduler::Task
+	{
+		lua_State *thread{nullptr};
+		int threadRef{LUA_NOREF};
+
+		Budget budget{};
+		CpuStats stats{};
+		TaskStatus status{TaskStatus::Ready};
+		sol::object result{};
+		std::string error{};
+
+		bool preempted{false};
+		bool preemptPending{false}; // The budget ran out where the task couldn't yield
+		InstructionsCount hookPeriod{0};
+		InstructionsCount sliceInstructions{0};
+
+		const timeoutGuard::HookContext *guard{nullptr}; // Of the watchdog armed on the state
+	};
+/*-----------------------------------------------------------------------------------------------*/
+	// Set for the duration of lua_resume(). Hooks run on the thread that resumed the task,
+	// including the one installed by the Monitor, so no registry lookup is needed.
+	thread_local Scheduler::Task *Scheduler::runningTask = nullptr;
+
+	namespace
+	{
+		// Lua 5.1 can only yield when nothing but Lua calls made by Lua code sit between the
+		// running function and the resume. A C function (pcall, a callback) or a Lua function
+		// called by the VM itself (metamethod, 'for' iterator) leaves no call name behind.
+		// Frames lost to tail calls can't be told apart, so they count as boundaries too.
+		[[nodiscard]]
+		bool canYield(lua_State *L)
+		{
+			lua_Debug ar{};
+			for (int level = 0; lua_getstack(L, level, &ar) != 0; ++level) {
+				lua_getinfo(L, "Sn", &ar);
+				if (std::string_view(ar.what) != "Lua" && std::string_view(ar.what) != "main") {
+					return false;
+				}
+				lua_Debug caller{};
+				if (lua_getstack(L, level + 1, &caller) == 0) {
+					return true; // The task function, called by lua_resume()
+				}
+				const auto namewhat = std::string_view(ar.namewhat);
+				if (namewhat.empty() || namewhat == "for iterator") {
+					return false;
+				}
+			}
+			return true;
+		}
+	} // namespace
+
+	void Scheduler::checkGuard(lua_State *L, const Task &task)
+	{
+		if (task.guard != nullptr && task.guard->isTimedOut()) {
+			luaL_error(L, "Timeout guard: Script timed out.");
+		}
+	}
+
+	void Scheduler::preempt(lua_State *L, Task &task)
+	{
+		if (!canYield(L)) {
+			// Retried by the budget hook until the task is back in plain Lua code
+			task.preemptPending = true;
+			lua_sethook(L, budgetHook, LUA_MASKCOUNT, task.hookPeriod);
+			return;
+		}
+		task.preemptPending = false;
+		task.preempted = true;
+		lua_yield(L, 0);
+	}
+
+	void Scheduler::budgetHook(lua_State *L, lua_Debug* /*ar*/)
+	{
+		auto *task = runningTask;
+		if (task == nullptr) {
+			return;
+		}
+		task->stats.instructions += task->hookPeriod;
+		checkGuard(L, *task);
+
+		// Coroutines created by the task inherit its hook, but yielding them would only
+		// return control to the task itself.
+		if (L != task->thread) {
+			return;
+		}
+		if (task->preemptPending) {
+			preempt(L, *task);
+			return;
+		}
+		if (task->budget.instructions <= 0) {
+			return;
+		}
+		task->sliceInstructions += task->hookPeriod;
+		if (task->sliceInstructions >= task->budget.instructions) {
+			preempt(L, *task);
+		}
+	}
+
+	void Scheduler::sliceExpiredHook(lua_State *L, lua_Debug* /*ar*/)
+	{
+		auto *task = runningTask;
+		if (task == nullptr) {
+			return;
+		}
+		checkGuard(L, *task);
+		if (L == task->thread) {
+			preempt(L, *task);
+		}
+	}
+/*-----------------------------------------------------------------------------------------------*/
+	Scheduler::Scheduler(sol::state_view lua, InstructionsCount checkPeriod)
+		: lua(lua.lua_state()),
+		  checkPeriod(checkPeriod > 0 ? checkPeriod : kDefaultCheckPeriod)
+	{}
+
+	Scheduler::~Scheduler()
+	{
+		for (auto &task : tasks) {
+			if (task) {
+				luaL_unref(lua, LUA_REGISTRYINDEX, task->threadRef);
+			}
+		}
+	}
+
+	auto Scheduler::spawn(const sol::protected_function &fn, Budget budget) -> TaskId
+	{
+		auto task = std::make_unique<Task>();
+
+		task->thread = lua_newthread(lua);
+		task->threadRef = luaL_ref(lua, LUA_REGISTRYINDEX);
+		task->budget = budget;
+
+		fn.push(lua);
+		lua_xmove(lua, task->thread, 1);
+
+		tasks.push_back(std::move(task));
+		return tasks.size() - 1;
+	}
+
+	void Scheduler::remove(TaskId id)
+	{
+		assert(id < tasks.size() && tasks[id] && "Unknown task id.");
+		assert(runningTask != tasks[id].get() && "A running task can't be removed.");
+
+		luaL_unref(lua, LUA_REGISTRYINDEX, tasks[id]->threadRef);
+		tasks[id].reset();
+	}
+
+	size_t Scheduler::tick()
+	{
+		// Indices are used on purpose: a task may spawn new ones while it's being resumed.
+		for (size_t id = 0; id < tasks.size(); ++id) {
+			if (tasks[id] && tasks[id]->status == TaskStatus::Ready) {
+				resume(*tasks[id]);
+			}
+		}
+		return readyCount();
+	}
+
+	void Scheduler::resume(Task &task)
+	{
+		lua_State *thread = task.thread;
+		auto &monitor = timeoutGuard::Monitor::instance();
+
+		task.hookPeriod = task.budget.instructions > 0
+						? std::min(checkPeriod, task.budget.instructions)
+						: checkPeriod;
+		task.sliceInstructions = 0;
+		task.preempted = false;
+		task.preemptPending = false;
+		task.guard = timeoutGuard::Watchdog::CtxRegistry::get(lua);
+
+		// The deadline of an armed watchdog is checked by the budget hook, which replaces its
+		// hook on the thread for the slice
+		const auto ownHook = timeoutGuard::HookTrigger{.hook = lua_gethook(thread),
+													   .mask = lua_gethookmask(thread),
+													   .count = lua_gethookcount(thread)};
+		lua_sethook(thread, budgetHook, LUA_MASKCOUNT, task.hookPeriod);
+
+		const auto start = timeoutGuard::Monitor::clock::now();
+		if (task.budget.time.count() > 0) {
+			monitor.schedule(&task, thread, start + task.budget.time, {.hook = sliceExpiredHook});
+		}
+		auto *prevTask = std::exchange(runningTask, &task);
+		const int status = lua_resume(thread, 0);
+		runningTask = prevTask;
+
+		task.stats.time += timeoutGuard::Monitor::clock::now() - start;
+		if (task.budget.time.count() > 0) {
+			monitor.cancel(&task);
+		}
+		lua_sethook(thread, ownHook.hook, ownHook.mask, ownHook.count);
+		task.guard = nullptr;
+		++task.stats.slices;
+
+		switch (status) {
+			case LUA_YIELD:
+				if (task.preempted) {
+					++task.stats.preemptions;
+				}
+				lua_settop(thread, 0); // Values passed to coroutine.yield() are dropped
+				break;
+			case 0:
+				task.status = TaskStatus::Finished;
+				if (lua_gettop(thread) > 0) {
+					lua_pushvalue(thread, 1);
+					lua_xmove(thread, lua, 1);
+					task.result = sol::object(lua, -1);
+					lua_pop(lua, 1);
+				}
+				lua_settop(thread, 0);
+				break;
+			default:
+				task.status = TaskStatus::Failed;
+				if (const char *msg = lua_tostring(thread, -1); msg != nullptr) {
+					task.error = msg;
+				}
+				lua_settop(thread, 0);
+				break;
+		}
+	}
+
+	auto Scheduler::taskAt(TaskId id) const -> Task &
+	{
+		assert(id < tasks.size() && tasks[id] && "Unknown task id.");
+		return *tasks[id];
+	}
+
+	auto Scheduler::status(TaskId id) const -> TaskStatus
+	{
+		return taskAt(id).status;
+	}
+
+	auto Scheduler::stats(TaskId id) const -> const CpuStats &
+	{
+		return taskAt(id).stats;
+	}
+
+	auto Scheduler::result(TaskId id) const -> sol::object
+	{
+		return taskAt(id).result;
+	}
+
+	auto Scheduler::error(TaskId id) const -> const std::string &
+	{
+		return taskAt(id).error;
+	}
+
+	bool Scheduler::setBudget(TaskId id, Budget budget)
+	{
+		if (id >= tasks.size() || !tasks[id]) {
+			return false;
+		}
+		tasks[id]->budget = budget;
+		return true;
+	}
+
+	size_t Scheduler::readyCount() const noexcept
+	{
+		return std::ranges::count_if(tasks, [](const auto &task) {
+			return task && task->status == TaskStatus::Ready;
+		});
+	}
+} // namespace lua::scheduling
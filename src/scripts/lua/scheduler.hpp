@@ -0,0 +1,100 @@
+#pragma once
+
+#include "lua/sol2.hpp"
+#include "lua/utils.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lua::scheduling
+{
+	namespace time = std::chrono;
+	using InstructionsCount = timeoutGuard::InstructionsCount;
+
+	constexpr InstructionsCount kDefaultCheckPeriod {1'000};
+
+	// Per-tick budget of a task. Zero means unlimited.
+	struct Budget
+	{
+		InstructionsCount instructions{0};
+		time::microseconds time{0};
+	};
+
+	struct CpuStats
+	{
+		uint64_t instructions{0}; // Counted with the check period granularity
+		time::nanoseconds time{0};
+		size_t slices{0};
+		size_t preemptions{0}; // Slices that ended because the budget ran out
+	};
+
+	enum class TaskStatus { Ready, Finished, Failed };
+/*-----------------------------------------------------------------------------------------------*/
+	// Cooperative scheduler running Lua functions as coroutines across several simulation ticks.
+	// Every tick each ready task is resumed for one slice. When the slice budget runs out the
+	// task is yielded from a count hook (instructions) or from a hook installed by the shared
+	// timeout Monitor (time), and it's resumed on the next tick.
+	//
+	// Lua 5.1 can only yield from Lua code: a task exhausting its budget inside pcall,
+	// a metamethod or a C function is preempted once it's back in plain Lua code.
+	//
+	// The deadline of a Watchdog (or GuardedScope) armed on the state around tick() is checked
+	// by the scheduler hooks, in either mode: a task running past it fails as timed out.
+	class Scheduler
+	{
+	public:
+		using TaskId = size_t;
+
+		explicit Scheduler(sol::state_view lua, InstructionsCount checkPeriod = kDefaultCheckPeriod);
+		~Scheduler();
+
+		Scheduler(const Scheduler &) = delete;
+		Scheduler &operator=(const Scheduler &) = delete;
+		Scheduler(Scheduler &&) = delete;
+		Scheduler &operator=(Scheduler &&) = delete;
+
+		[[nodiscard]]
+		TaskId spawn(const sol::protected_function &fn, Budget budget = {});
+		void remove(TaskId id);
+
+		// Resumes every ready task for one slice. Returns the number of tasks still ready.
+		size_t tick();
+
+		[[nodiscard]]
+		auto status(TaskId id) const -> TaskStatus;
+		[[nodiscard]]
+		auto stats(TaskId id) const -> const CpuStats &;
+		[[nodiscard]]
+		auto result(TaskId id) const -> sol::object; // First value returned by a finished task
+		[[nodiscard]]
+		auto error(TaskId id) const -> const std::string &;
+
+		bool setBudget(TaskId id, Budget budget);
+
+		[[nodiscard]]
+		size_t readyCount() const noexcept;
+
+	private:
+		struct Task;
+
+		static void checkGuard(lua_State *L, const Task &task);
+		static void preempt(lua_State *L, Task &task);
+		static void budgetHook(lua_State *L, lua_Debug* /*ar*/);
+		static void sliceExpiredHook(lua_State *L, lua_Debug* /*ar*/);
+
+		void resume(Task &task);
+		[[nodiscard]]
+		auto taskAt(TaskId id) const -> Task &;
+
+	private:
+		lua_State *lua{nullptr};
+		InstructionsCount checkPeriod{kDefaultCheckPeriod};
+
+		std::vector<std::unique_ptr<Task>> tasks;
+
+		static thread_local Task *runningTask;
+	};
+} // namespace lua::scheduling
@@ -0,0 +1,664 @@
+#include "lua/snapshot.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <optional>
+#include <string>
+
+namespace lua::snapshot
+{
+	namespace
+	{
+		constexpr double cMaxExactInteger = 9007199254740992.0; // 2^53
+
+		[[nodiscard]]
+		constexpr uint64_t zigzag(int64_t value) noexcept
+		{
+			return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+		}
+
+		[[nodiscard]]
+		constexpr int64_t unzigzag(uint64_t value) noexcept
+		{
+			return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+		}
+
+		[[nodiscard]]
+		size_t hashPointer(const void *ptr) noexcept
+		{
+			auto x = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr));
+			x ^= x >> 33;
+			x *= 0xff51afd7ed558ccdULL;
+			x ^= x >> 33;
+			return static_cast<size_t>(x);
+		}
+
+		[[nodiscard]]
+		bool isNativeType(sol::type type) noexcept
+		{
+			return type == sol::type::function
+				|| type == sol::type::userdata
+				|| type == sol::type::lightuserdata;
+		}
+
+		// The table a read-only proxy forwards to, see makeReadOnlyProxy(). The metatable is
+		// read raw, as the proxies hide it from getmetatable().
+		[[nodiscard]]
+		auto proxiedTable(const sol::table &proxy) -> std::optional<sol::table>
+		{
+			lua_State *L = proxy.lua_state();
+			proxy.push(L);
+			if (!lua_getmetatable(L, -1)) {
+				lua_pop(L, 1);
+				return std::nullopt;
+			}
+			lua_pushliteral(L, "__index");
+			lua_rawget(L, -2);
+			auto index = std::optional<sol::table>{};
+			if (lua_istable(L, -1)) {
+				index = sol::table(L, -1);
+			}
+			lua_pop(L, 3);
+			return index;
+		}
+
+		void addIndexEntry(sol::table &index, const sol::object &native, std::string_view name)
+		{
+			if (index.raw_get<sol::object>(native) != sol::nil
+				|| index.raw_get<sol::object>(name) != sol::nil) {
+				return;
+			}
+			index.raw_set(native, name);
+			index.raw_set(name, native);
+		}
+/*-----------------------------------------------------------------------------------------------*/
+		// Saving and restoring run under lua_cpcall, so a Lua error (out of memory, or one
+		// raised by them on bad data) unwinds back to the caller. Lua is built as C and
+		// unwinds with longjmp: nothing with a destructor may live on these frames.
+		struct SaveContext
+		{
+			Writer *writer;
+			const sol::table *env;
+			const sol::table *baseline;
+			const sol::table *natives;
+		};
+
+		struct Saver
+		{
+			lua_State *L;
+			Writer *writer;
+			int natives; // Stack index of the natives index
+
+			[[nodiscard]]
+			bool isCode(int index);
+
+			void saveValue(int index, int depth);
+			void saveTable(int index, int depth);
+			bool saveNative(int index);
+			void saveNumber(lua_Number value);
+			void saveString(int index);
+		};
+
+		// Lua functions the host didn't bind as natives
+		bool Saver::isCode(int index)
+		{
+			if (!lua_isfunction(L, index) || lua_iscfunction(L, index)) {
+				return false;
+			}
+			lua_pushvalue(L, index);
+			lua_rawget(L, natives);
+			const bool native = !lua_isnil(L, -1);
+			lua_pop(L, 1);
+			return !native;
+		}
+
+		void Saver::saveValue(int index, int depth)
+		{
+			if (writer->failed()) {
+				luaL_error(L, "not enough memory");
+			}
+			switch (lua_type(L, index)) {
+				case LUA_TNIL:
+					writer->write(Tag::Nil);
+					break;
+				case LUA_TBOOLEAN:
+					writer->write(lua_toboolean(L, index) ? Tag::True : Tag::False);
+					break;
+				case LUA_TNUMBER:
+					saveNumber(lua_tonumber(L, index));
+					break;
+				case LUA_TSTRING:
+					saveString(index);
+					break;
+				case LUA_TTABLE:
+					saveTable(index, depth);
+					break;
+				default:
+					if (!saveNative(index)) {
+						luaL_error(L, "a %s which isn't a native of the sandbox",
+								   luaL_typename(L, index));
+					}
+					break;
+			}
+		}
+
+		void Saver::saveNumber(lua_Number value)
+		{
+			if (std::trunc(value) == value && std::abs(value) <= cMaxExactInteger
+				&& !(value == 0 && std::signbit(value))) {
+				writer->write(Tag::Integer);
+				writer->writeVarint(zigzag(static_cast<int64_t>(value)));
+				return;
+			}
+			static_assert(sizeof(lua_Number) == 8);
+			writer->write(Tag::Number);
+			writer->writeBytes(&value, sizeof(value));
+		}
+
+		void Saver::saveString(int index)
+		{
+			size_t len = 0;
+			const char *str = lua_tolstring(L, index, &len);
+			writer->write(Tag::String);
+			writer->writeVarint(len);
+			writer->writeBytes(str, len);
+		}
+
+		bool Saver::saveNative(int index)
+		{
+			lua_pushvalue(L, index);
+			lua_rawget(L, natives);
+			if (lua_type(L, -1) != LUA_TSTRING) {
+				lua_pop(L, 1);
+				return false;
+			}
+			size_t len = 0;
+			const char *name = lua_tolstring(L, -1, &len);
+			writer->write(Tag::Native);
+			writer->writeVarint(len);
+			writer->writeBytes(name, len);
+			lua_pop(L, 1);
+			return true;
+		}
+
+		void Saver::saveTable(int index, int depth)
+		{
+			if (saveNative(index)) {
+				return;
+			}
+			if (const auto id = writer->findOrAddTable(lua_topointer(L, index)); id >= 0) {
+				writer->write(Tag::Ref);
+				writer->writeVarint(static_cast<uint64_t>(id));
+				return;
+			}
+			if (writer->failed()) {
+				luaL_error(L, "not enough memory");
+			}
+			if (depth >= cMaxDepth) {
+				luaL_error(L, "tables nested deeper than %d levels", cMaxDepth);
+			}
+			if (!lua_checkstack(L, 4)) {
+				luaL_error(L, "not enough stack space");
+			}
+			writer->write(Tag::Table);
+			lua_pushnil(L);
+			while (lua_next(L, index) != 0) {
+				const int top = lua_gettop(L);
+				if (!isCode(top - 1) && !isCode(top)) {
+					saveValue(top - 1, depth + 1);
+					saveValue(top, depth + 1);
+				}
+				lua_pop(L, 1);
+			}
+			writer->write(Tag::End);
+
+			if (lua_getmetatable(L, index)) {
+				saveValue(lua_gettop(L), depth + 1);
+				lua_pop(L, 1);
+			} else {
+				writer->write(Tag::Nil);
+			}
+		}
+
+		int saveProtected(lua_State *L)
+		{
+			const auto *ctx = static_cast<const SaveContext *>(lua_touserdata(L, 1));
+			ctx->env->push(L);
+			const int env = lua_gettop(L);
+			ctx->baseline->push(L);
+			const int baseline = lua_gettop(L);
+			ctx->natives->push(L);
+
+			auto saver = Saver{.L = L, .writer = ctx->writer, .natives = lua_gettop(L)};
+			(void) ctx->writer->findOrAddTable(lua_topointer(L, env)); // Table #0
+
+			// Globals changed since the baseline. Global Lua functions are code rather than
+			// data: the scripts define them again before a snapshot is restored.
+			lua_pushnil(L);
+			while (lua_next(L, env) != 0) {
+				const int top = lua_gettop(L);
+				lua_pushvalue(L, top - 1);
+				lua_rawget(L, baseline);
+				const bool unchanged = lua_rawequal(L, -1, top) != 0
+									|| (lua_isfunction(L, top) && !lua_iscfunction(L, top));
+				lua_pop(L, 1);
+				if (!unchanged) {
+					saver.saveValue(top - 1, 0);
+					saver.saveValue(top, 0);
+				}
+				lua_pop(L, 1);
+			}
+			// Removed ones
+			lua_pushnil(L);
+			while (lua_next(L, baseline) != 0) {
+				lua_pushvalue(L, -2);
+				lua_rawget(L, env);
+				if (lua_isnil(L, -1)) {
+					saver.saveValue(lua_gettop(L) - 2, 0);
+					ctx->writer->write(Tag::Nil);
+				}
+				lua_pop(L, 2);
+			}
+			ctx->writer->write(Tag::End);
+			if (ctx->writer->failed()) {
+				luaL_error(L, "not enough memory");
+			}
+			return 0;
+		}
+/*-----------------------------------------------------------------------------------------------*/
+		struct RestoreContext
+		{
+			std::span<const std::byte> blob;
+			sol::table *env;
+			const sol::table *natives;
+		};
+
+		struct Loader
+		{
+			lua_State *L;
+			std::span<const std::byte> blob;
+			size_t pos;
+			int natives;	 // Stack indices of the natives index
+			int tables;		 // and of the restored tables, by their number + 1
+			uint32_t tablesCount;
+			uint32_t nextTable;
+
+			[[nodiscard]]
+			auto readBytes(size_t size) -> const std::byte *;
+			[[nodiscard]]
+			Tag readTag();
+			[[nodiscard]]
+			uint64_t readVarint();
+
+			void loadValue(Tag tag, int depth);
+			void loadTable(int depth);
+			void loadKey(Tag tag, int depth);
+		};
+
+		auto Loader::readBytes(size_t size) -> const std::byte *
+		{
+			if (size > blob.size() - pos) {
+				luaL_error(L, "unexpected end of data");
+			}
+			const auto *bytes = blob.data() + pos;
+			pos += size;
+			return bytes;
+		}
+
+		Tag Loader::readTag()
+		{
+			const auto tag = static_cast<uint8_t>(*readBytes(1));
+			if (tag > static_cast<uint8_t>(Tag::Native)) {
+				luaL_error(L, "unknown tag %d", static_cast<int>(tag));
+			}
+			return static_cast<Tag>(tag);
+		}
+
+		uint64_t Loader::readVarint()
+		{
+			uint64_t value = 0;
+			for (int shift = 0; shift < 64; shift += 7) {
+				const auto byte = static_cast<uint8_t>(*readBytes(1));
+				value |= uint64_t{byte & 0x7fu} << shift;
+				if ((byte & 0x80u) == 0) {
+					return value;
+				}
+			}
+			luaL_error(L, "malformed varint");
+			return 0;
+		}
+
+		void Loader::loadValue(Tag tag, int depth)
+		{
+			switch (tag) {
+				case Tag::Nil:
+					lua_pushnil(L);
+					break;
+				case Tag::False:
+				case Tag::True:
+					lua_pushboolean(L, tag == Tag::True);
+					break;
+				case Tag::Integer:
+					lua_pushnumber(L, static_cast<lua_Number>(unzigzag(readVarint())));
+					break;
+				case Tag::Number: {
+					lua_Number value = 0;
+					std::memcpy(&value, readBytes(sizeof(value)), sizeof(value));
+					lua_pushnumber(L, value);
+					break;
+				}
+				case Tag::String: {
+					const auto len = readVarint();
+					lua_pushlstring(L, reinterpret_cast<const char *>(readBytes(len)), len);
+					break;
+				}
+				case Tag::Table:
+					loadTable(depth);
+					break;
+				case Tag::Ref: {
+					const auto id = readVarint();
+					if (id >= nextTable) {
+						luaL_error(L, "reference to an unknown table");
+					}
+					lua_rawgeti(L, tables, static_cast<int>(id) + 1);
+					break;
+				}
+				case Tag::Native: {
+					const auto len = readVarint();
+					lua_pushlstring(L, reinterpret_cast<const char *>(readBytes(len)), len);
+					lua_pushvalue(L, -1);
+					lua_rawget(L, natives);
+					if (lua_isnil(L, -1)) {
+						luaL_error(L, "unknown native '%s'", lua_tostring(L, -2));
+					}
+					lua_remove(L, -2);
+					break;
+				}
+				case Tag::End:
+					luaL_error(L, "unexpected end of table");
+					break;
+			}
+		}
+
+		// Like loadValue(), but rejects what can't be a table key
+		void Loader::loadKey(Tag tag, int depth)
+		{
+			loadValue(tag, depth);
+			if (lua_isnil(L, -1)
+				|| (lua_type(L, -1) == LUA_TNUMBER && std::isnan(lua_tonumber(L, -1)))) {
+				luaL_error(L, "invalid table key");
+			}
+		}
+
+		void Loader::loadTable(int depth)
+		{
+			if (depth >= cMaxDepth) {
+				luaL_error(L, "tables nested deeper than %d levels", cMaxDepth);
+			}
+			if (nextTable >= tablesCount) {
+				luaL_error(L, "more tables than declared");
+			}
+			if (!lua_checkstack(L, 4)) {
+				luaL_error(L, "not enough stack space");
+			}
+			lua_newtable(L);
+			const int table = lua_gettop(L);
+			lua_pushvalue(L, table);
+			lua_rawseti(L, tables, static_cast<int>(nextTable++) + 1);
+
+			for (auto tag = readTag(); tag != Tag::End; tag = readTag()) {
+				loadKey(tag, depth + 1);
+				loadValue(readTag(), depth + 1);
+				lua_rawset(L, table);
+			}
+			loadValue(readTag(), depth + 1);
+			if (lua_istable(L, -1)) {
+				lua_setmetatable(L, table);
+			} else if (lua_isnil(L, -1)) {
+				lua_pop(L, 1);
+			} else {
+				luaL_error(L, "invalid metatable");
+			}
+		}
+
+		int restoreProtected(lua_State *L)
+		{
+			const auto *ctx = static_cast<const RestoreContext *>(lua_touserdata(L, 1));
+
+			auto header = Header{};
+			if (ctx->blob.size() < sizeof(Header)) {
+				luaL_error(L, "too short");
+			}
+			std::memcpy(&header, ctx->blob.data(), sizeof(Header));
+			if (header.magic != cMagic) {
+				luaL_error(L, "bad signature");
+			}
+			if (header.version != cVersion) {
+				luaL_error(L, "unsupported version %d", static_cast<int>(header.version));
+			}
+			// Each table takes at least two bytes, which bounds the preallocation below
+			if (header.tablesCount == 0 || header.tablesCount > ctx->blob.size() / 2 + 1) {
+				luaL_error(L, "bad tables count");
+			}
+			ctx->env->push(L);
+			const int env = lua_gettop(L);
+			ctx->natives->push(L);
+			const int natives = lua_gettop(L);
+			lua_createtable(L, static_cast<int>(header.tablesCount), 0);
+			const int tables = lua_gettop(L);
+			lua_pushvalue(L, env);
+			lua_rawseti(L, tables, 1);
+
+			auto loader = Loader{.L = L,
+								 .blob = ctx->blob,
+								 .pos = sizeof(Header),
+								 .natives = natives,
+								 .tables = tables,
+								 .tablesCount = header.tablesCount,
+								 .nextTable = 1};
+
+			// Changes are staged and applied once everything is read, so bad data leaves
+			// the environment as it was.
+			lua_newtable(L);
+			const int changed = lua_gettop(L);
+			lua_newtable(L);
+			const int removed = lua_gettop(L);
+
+			for (auto tag = loader.readTag(); tag != Tag::End; tag = loader.readTag()) {
+				loader.loadKey(tag, 0);
+				loader.loadValue(loader.readTag(), 0);
+				if (lua_isnil(L, -1)) {
+					lua_pop(L, 1);
+					lua_pushboolean(L, 1);
+					lua_rawset(L, removed);
+				} else {
+					lua_rawset(L, changed);
+				}
+			}
+			if (loader.pos != ctx->blob.size()) {
+				luaL_error(L, "trailing data");
+			}
+			lua_pushnil(L);
+			while (lua_next(L, changed) != 0) {
+				lua_pushvalue(L, -2);
+				lua_insert(L, -2);
+				lua_rawset(L, env);
+			}
+			lua_pushnil(L);
+			while (lua_next(L, removed) != 0) {
+				lua_pop(L, 1);
+				lua_pushvalue(L, -1);
+				lua_pushnil(L);
+				lua_rawset(L, env);
+			}
+			return 0;
+		}
+	} // namespace
+/*-----------------------------------------------------------------------------------------------*/
+	void Writer::clear() noexcept
+	{
+		buffer.clear();
+		std::ranges::fill(tableIds, std::pair<const void *, uint32_t>{nullptr, 0});
+		tablesCount = 0;
+		outOfMemory = false;
+	}
+
+	void Writer::write(Tag tag) noexcept
+	{
+		const auto byte = static_cast<std::byte>(tag);
+		writeBytes(&byte, 1);
+	}
+
+	void Writer::writeVarint(uint64_t value) noexcept
+	{
+		auto bytes = std::array<std::byte, 10>{};
+		size_t size = 0;
+		while (value >= 0x80) {
+			bytes[size++] = static_cast<std::byte>((value & 0x7f) | 0x80);
+			value >>= 7;
+		}
+		bytes[size++] = static_cast<std::byte>(value);
+		writeBytes(bytes.data(), size);
+	}
+
+	void Writer::writeBytes(const void *data, size_t size) noexcept
+	{
+		if (outOfMemory || size == 0) {
+			return;
+		}
+		const auto at = buffer.size();
+		try {
+			buffer.resize(at + size);
+		} catch (const std::exception &) { // bad_alloc or length_error
+			outOfMemory = true;
+			return;
+		}
+		std::memcpy(buffer.data() + at, data, size);
+	}
+
+	int64_t Writer::findOrAddTable(const void *table) noexcept
+	{
+		// Kept at most half full
+		if ((tablesCount + 1) * 2 > tableIds.size()) {
+			try {
+				growTables();
+			} catch (const std::exception &) {
+				outOfMemory = true;
+				return -1;
+			}
+		}
+		const size_t mask = tableIds.size() - 1;
+		for (size_t slot = hashPointer(table) & mask;; slot = (slot + 1) & mask) {
+			auto &[key, id] = tableIds[slot];
+			if (key == table) {
+				return id;
+			}
+			if (key == nullptr) {
+				key = table;
+				id = tablesCount++;
+				return -1;
+			}
+		}
+	}
+
+	void Writer::growTables()
+	{
+		// Left as it was if the allocation throws
+		auto grown = std::vector<std::pair<const void *, uint32_t>>(
+			std::max<size_t>(64, tableIds.size() * 2), {nullptr, 0});
+
+		const size_t mask = grown.size() - 1;
+		for (const auto &[key, id] : tableIds) {
+			if (key == nullptr) {
+				continue;
+			}
+			size_t slot = hashPointer(key) & mask;
+			while (grown[slot].first != nullptr) {
+				slot = (slot + 1) & mask;
+			}
+			grown[slot] = {key, id};
+		}
+		tableIds = std::move(grown);
+	}
+
+	void Writer::finish()
+	{
+		auto header = Header{};
+		header.tablesCount = tablesCount;
+		std::memcpy(buffer.data(), &header, sizeof(Header));
+	}
+/*-----------------------------------------------------------------------------------------------*/
+	void addNative(sol::table &index, const std::string &name, const sol::object &native)
+	{
+		if (isNativeType(native.get_type())) {
+			addIndexEntry(index, native, name);
+			return;
+		}
+		if (native.get_type() != sol::type::table) {
+			return;
+		}
+		// Plain tables are data, only lib proxies are natives
+		const auto lib = proxiedTable(native.as<sol::table>());
+		if (!lib) {
+			return;
+		}
+		addIndexEntry(index, native, name);
+		for (const auto &[key, member] : *lib) {
+			if (key.get_type() == sol::type::string && isNativeType(member.get_type())) {
+				addIndexEntry(index, member, name + "." + key.as<std::string>());
+			}
+		}
+	}
+
+	void addNatives(sol::table &index, const sol::table &globals)
+	{
+		for (const auto &[key, value] : globals) {
+			if (key.get_type() == sol::type::string) {
+				addNative(index, key.as<std::string>(), value);
+			}
+		}
+	}
+
+	bool save(Writer &writer,
+			  const sol::table &env,
+			  const sol::table &baseline,
+			  const sol::table &natives)
+	{
+		writer.clear();
+		const auto header = Header{};
+		writer.writeBytes(&header, sizeof(Header));
+		if (writer.failed()) {
+			spdlog::error("Unable to save a snapshot: not enough memory");
+			writer.clear();
+			return false;
+		}
+
+		lua_State *L = env.lua_state();
+		auto ctx = SaveContext{.writer = &writer, .env = &env, .baseline = &baseline,
+							   .natives = &natives};
+		if (lua_cpcall(L, saveProtected, &ctx) != 0) {
+			spdlog::error("Unable to save a snapshot: {}", lua_tostring(L, -1));
+			lua_pop(L, 1);
+			writer.clear();
+			return false;
+		}
+		writer.finish();
+		return true;
+	}
+
+	bool restore(std::span<const std::byte> blob, sol::table &env, const sol::table &natives)
+	{
+		lua_State *L = env.lua_state();
+		auto ctx = RestoreContext{.blob = blob, .env = &env, .natives = &natives};
+		if (lua_cpcall(L, restoreProtected, &ctx) != 0) {
+			spdlog::error("Unable to restore a snapshot: {}", lua_tostring(L, -1));
+			lua_pop(L, 1);
+			return false;
+		}
+		return true;
+	}
+} // namespace lua::snapshot
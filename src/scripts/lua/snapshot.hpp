@@ -0,0 +1,121 @@
+#pragma once
+
+#include "lua/sol2.hpp"
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*----------------------------------------------------------------------------
+--  Binary snapshot of the data reachable from a sandbox environment
+--
+--  Layout (little-endian):
+--    Header
+--    Root: (key, value) pairs of the environment globals changed since its baseline,
+--          a removed global is saved with a Nil value; terminated by End
+--
+--  Values start with a Tag:
+--    Nil, False, True
+--    Integer  zigzag varint, for integral numbers within +-2^53
+--    Number   8 bytes of the IEEE-754 double
+--    String   varint length, bytes
+--    Table    (key, value) pairs terminated by End, then the metatable value (Nil if none).
+--             Tables are numbered in the order they are written, the environment being #0.
+--    Ref      varint number of a table written earlier: shared tables and cycles
+--    Native   varint length, name: functions and lib tables of the sandbox, which aren't
+--             saved but looked up by name on restore ("print", "string.format")
+--
+--  Lua functions are code rather than data and aren't saved: table fields holding one
+--  (as key or value) are left out, as are the global ones.
+----------------------------------------------------------------------------*/
+namespace lua::snapshot
+{
+	static_assert(std::endian::native == std::endian::little,
+				  "Numbers are saved in their in-memory form, which needs a little-endian host.");
+
+	constexpr auto cMagic = std::array<char, 4>{'Z', 'Z', 'S', 'N'};
+	constexpr uint16_t cVersion = 1;
+	constexpr int cMaxDepth = 128;
+
+	enum class Tag : uint8_t { End, Nil, False, True, Integer, Number, String, Table, Ref, Native };
+
+	struct Header
+	{
+		std::array<char, 4> magic{cMagic};
+		uint16_t version{cVersion};
+		uint16_t flags{0};
+		uint32_t tablesCount{0}; // Including the environment
+	};
+	static_assert(sizeof(Header) == 12);
+
+	// Output buffer together with the scratch space of saving. Meant to be kept and reused:
+	// once both have grown to fit the data, saving allocates nothing.
+	//
+	// Writing doesn't throw, as it happens under lua_cpcall: once growing the buffer fails,
+	// the writer ignores further data and failed() tells until it's cleared.
+	class Writer
+	{
+	public:
+		Writer() = default;
+		explicit Writer(size_t reserveBytes) { buffer.reserve(reserveBytes); }
+
+		[[nodiscard]]
+		auto bytes() const noexcept -> std::span<const std::byte> { return buffer; }
+
+		[[nodiscard]]
+		bool failed() const noexcept { return outOfMemory; }
+
+		// Leaves the capacity as is
+		void clear() noexcept;
+
+		void write(Tag tag) noexcept;
+		void writeVarint(uint64_t value) noexcept;
+		void writeBytes(const void *data, size_t size) noexcept;
+
+		// Number of the table if it was written already, otherwise numbers it and returns -1.
+		int64_t findOrAddTable(const void *table) noexcept;
+
+		// Fills in the header once the data is written
+		void finish();
+
+	private:
+		void growTables();
+
+	private:
+		std::vector<std::byte> buffer;
+
+		// Open addressing with linear probing, keyed by lua_topointer() of tables
+		std::vector<std::pair<const void *, uint32_t>> tableIds;
+		uint32_t tablesCount{0};
+		bool outOfMemory{false};
+	};
+
+	// Index of the sandbox natives: maps each of them to its name and each name back,
+	// both kept in the same table since natives are never strings. Functions, userdata and
+	// read-only lib proxies are indexed by their global name, members of the lib proxies
+	// as "lib.member". The first object to take a name keeps it.
+	void addNative(sol::table &index, const std::string &name, const sol::object &native);
+
+	// Adds every global: meant for environments holding nothing but what the host put there.
+	void addNatives(sol::table &index, const sol::table &globals);
+
+	// Saves the globals of 'env' that differ from 'baseline' and everything they refer to.
+	// Lua functions are skipped, as the scripts recreate them. Returns false (the reason is
+	// logged) if some value can't be saved: coroutines and userdata that aren't natives,
+	// tables nested deeper than cMaxDepth, or data the writer has no memory left for.
+	[[nodiscard]]
+	bool save(Writer &writer,
+			  const sol::table &env,
+			  const sol::table &baseline,
+			  const sol::table &natives);
+
+	// Applies the snapshot to the environment; it is left untouched if the snapshot can't
+	// be restored (the reason is logged).
+	[[nodiscard]]
+	bool restore(std::span<const std::byte> blob, sol::table &env, const sol::table &natives);
+} // namespace lua::snapshot
@@ -0,0 +1,275 @@
+#include "lua/unit_columns.hpp"
+
+#include <algorithm>
+#include <array>
+#include <new>
+#include <optional>
+#include <utility>
+
+namespace lua::units
+{
+	void UnitsSnapshot::reserve(size_t count)
+	{
+		id.reserve(count);
+		x.reserve(count);
+		y.reserve(count);
+		hp.reserve(count);
+		owner.reserve(count);
+		type.reserve(count);
+	}
+
+	void UnitsSnapshot::clear() noexcept
+	{
+		id.clear();
+		x.clear();
+		y.clear();
+		hp.clear();
+		owner.clear();
+		type.clear();
+	}
+
+	void UnitsSnapshot::add(const UnitRecord &unit)
+	{
+		id.push_back(unit.id);
+		x.push_back(unit.x);
+		y.push_back(unit.y);
+		hp.push_back(unit.hp);
+		owner.push_back(unit.owner);
+		type.push_back(unit.type);
+	}
+/*-----------------------------------------------------------------------------------------------*/
+	namespace
+	{
+		constexpr size_t cBlockSize = 256;
+
+		// Matches(row) -> bool, evaluated for every row of a block before any of them is stored.
+		template <typename Matches>
+		void select(size_t count, std::vector<uint32_t> &rows, Matches &&matches)
+		{
+			rows.resize(count);
+
+			auto hits = std::array<uint8_t, cBlockSize>{};
+			size_t found = 0;
+			for (size_t first = 0; first < count; first += cBlockSize) {
+				const size_t blockSize = std::min(cBlockSize, count - first);
+				for (size_t i = 0; i < blockSize; ++i) {
+					hits[i] = matches(first + i);
+				}
+				for (size_t i = 0; i < blockSize; ++i) {
+					rows[found] = static_cast<uint32_t>(first + i);
+					found += hits[i];
+				}
+			}
+			rows.resize(found);
+		}
+	} // namespace
+
+	void selectInRadius(const UnitsSnapshot &units,
+						float x,
+						float y,
+						float radius,
+						std::vector<uint32_t> &rows)
+	{
+		const float *xs = units.x.data();
+		const float *ys = units.y.data();
+		const float radiusSq = radius * radius;
+
+		select(units.size(), rows, [=](size_t row) -> uint8_t {
+			const float dx = xs[row] - x;
+			const float dy = ys[row] - y;
+			return dx * dx + dy * dy <= radiusSq;
+		});
+	}
+
+	void selectByOwner(const UnitsSnapshot &units, int32_t owner, std::vector<uint32_t> &rows)
+	{
+		const int32_t *owners = units.owner.data();
+
+		select(units.size(), rows, [=](size_t row) -> uint8_t {
+			return owners[row] == owner;
+		});
+	}
+/*-----------------------------------------------------------------------------------------------*/
+	// Payload of the userdata. Lua owns it and destroys it in __gc.
+	struct ColumnsBlock
+	{
+		std::shared_ptr<const UnitsSnapshot> snapshot{};
+		std::vector<uint32_t> rows{}; // Scratch buffer of the filters
+	};
+
+	namespace
+	{
+		constexpr auto cMetatableName = "zug-zug.UnitColumns";
+
+		using Block = ColumnsBlock;
+
+		[[nodiscard]]
+		auto checkBlock(lua_State *L) -> Block &
+		{
+			return *static_cast<Block *>(luaL_checkudata(L, 1, cMetatableName));
+		}
+
+		[[nodiscard]]
+		size_t countOf(const Block &block) noexcept
+		{
+			return block.snapshot ? block.snapshot->size() : 0;
+		}
+
+		// 1-based row argument, or nullopt (and nil is pushed) if there's no such unit.
+		[[nodiscard]]
+		auto checkRow(lua_State *L, const Block &block, int arg) -> std::optional<size_t>
+		{
+			const auto row = static_cast<lua_Integer>(luaL_checkinteger(L, arg));
+			if (row < 1 || static_cast<size_t>(row) > countOf(block)) {
+				lua_pushnil(L);
+				return std::nullopt;
+			}
+			return static_cast<size_t>(row - 1);
+		}
+
+		int count(lua_State *L)
+		{
+			lua_pushinteger(L, static_cast<lua_Integer>(countOf(checkBlock(L))));
+			return 1;
+		}
+
+		template <auto Column>
+		int column(lua_State *L)
+		{
+			const auto &block = checkBlock(L);
+			if (const auto row = checkRow(L, block, 2)) {
+				lua_pushnumber(L, static_cast<lua_Number>(((*block.snapshot).*Column)[*row]));
+			}
+			return 1;
+		}
+
+		int unit(lua_State *L)
+		{
+			const auto &block = checkBlock(L);
+			const auto row = checkRow(L, block, 2);
+			if (!row) {
+				return 1;
+			}
+			const auto &units = *block.snapshot;
+			lua_pushnumber(L, static_cast<lua_Number>(units.id[*row]));
+			lua_pushnumber(L, static_cast<lua_Number>(units.x[*row]));
+			lua_pushnumber(L, static_cast<lua_Number>(units.y[*row]));
+			lua_pushnumber(L, static_cast<lua_Number>(units.hp[*row]));
+			lua_pushnumber(L, static_cast<lua_Number>(units.owner[*row]));
+			lua_pushnumber(L, static_cast<lua_Number>(units.type[*row]));
+			return 6;
+		}
+
+		// Pushes the rows as a 1-based array: into the table at 'outArg' if there is one,
+		// clearing its leftovers from a longer previous result.
+		int pushRows(lua_State *L, const std::vector<uint32_t> &rows, int outArg)
+		{
+			const auto count = static_cast<int>(rows.size());
+			int previous = 0;
+			if (lua_istable(L, outArg)) {
+				previous = static_cast<int>(lua_objlen(L, outArg));
+				lua_pushvalue(L, outArg);
+			} else {
+				lua_createtable(L, count, 0);
+			}
+			for (int i = 0; i < count; ++i) {
+				lua_pushinteger(L, static_cast<lua_Integer>(rows[i]) + 1);
+				lua_rawseti(L, -2, i + 1);
+			}
+			for (int i = previous; i > count; --i) {
+				lua_pushnil(L);
+				lua_rawseti(L, -2, i);
+			}
+			return 1;
+		}
+
+		int inRadius(lua_State *L)
+		{
+			auto &block = checkBlock(L);
+			const auto x = static_cast<float>(luaL_checknumber(L, 2));
+			const auto y = static_cast<float>(luaL_checknumber(L, 3));
+			const auto radius = static_cast<float>(luaL_checknumber(L, 4));
+
+			block.rows.clear();
+			if (block.snapshot) {
+				selectInRadius(*block.snapshot, x, y, radius, block.rows);
+			}
+			return pushRows(L, block.rows, 5);
+		}
+
+		int ofOwner(lua_State *L)
+		{
+			auto &block = checkBlock(L);
+			const auto owner = static_cast<int32_t>(luaL_checkinteger(L, 2));
+
+			block.rows.clear();
+			if (block.snapshot) {
+				selectByOwner(*block.snapshot, owner, block.rows);
+			}
+			return pushRows(L, block.rows, 3);
+		}
+
+		int collect(lua_State *L)
+		{
+			static_cast<Block *>(lua_touserdata(L, 1))->~Block();
+			return 0;
+		}
+
+		void pushMetatable(lua_State *L)
+		{
+			if (luaL_newmetatable(L, cMetatableName) == 0) {
+				return; // Already registered in this state
+			}
+			static constexpr auto methods = std::array<luaL_Reg, 11>{{
+				{"count", count},
+				{"id", column<&UnitsSnapshot::id>},
+				{"x", column<&UnitsSnapshot::x>},
+				{"y", column<&UnitsSnapshot::y>},
+				{"hp", column<&UnitsSnapshot::hp>},
+				{"owner", column<&UnitsSnapshot::owner>},
+				{"type", column<&UnitsSnapshot::type>},
+				{"unit", unit},
+				{"inRadius", inRadius},
+				{"ofOwner", ofOwner},
+				{nullptr, nullptr}
+			}};
+			lua_createtable(L, 0, static_cast<int>(methods.size()));
+			for (const auto &method : methods) {
+				if (method.name != nullptr) {
+					lua_pushcfunction(L, method.func);
+					lua_setfield(L, -2, method.name);
+				}
+			}
+			lua_setfield(L, -2, "__index");
+
+			lua_pushcfunction(L, count);
+			lua_setfield(L, -2, "__len");
+			lua_pushcfunction(L, collect);
+			lua_setfield(L, -2, "__gc");
+			lua_pushboolean(L, 0);
+			lua_setfield(L, -2, "__metatable");
+		}
+	} // namespace
+
+	UnitColumns::UnitColumns(sol::state_view lua)
+	{
+		lua_State *L = lua.lua_state();
+
+		block = new (lua_newuserdata(L, sizeof(ColumnsBlock))) ColumnsBlock{};
+		pushMetatable(L);
+		lua_setmetatable(L, -2);
+
+		handle = sol::userdata(L, -1);
+		lua_pop(L, 1);
+	}
+
+	void UnitColumns::publish(std::shared_ptr<const UnitsSnapshot> snapshot) noexcept
+	{
+		block->snapshot = std::move(snapshot);
+	}
+
+	auto UnitColumns::snapshot() const noexcept -> const std::shared_ptr<const UnitsSnapshot> &
+	{
+		return block->snapshot;
+	}
+} // namespace lua::units
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "lua/sol2.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace lua::units
+{
+	struct UnitRecord
+	{
+		uint32_t id{0};
+		float x{0.f};
+		float y{0.f};
+		int32_t hp{0};
+		int32_t owner{0};
+		int32_t type{0};
+	};
+
+	// State of all units for one tick, stored column by column (struct of arrays), so a query
+	// touches only the columns it needs. Row 'i' of every column belongs to the same unit.
+	struct UnitsSnapshot
+	{
+		std::vector<uint32_t> id;
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<int32_t> hp;
+		std::vector<int32_t> owner;
+		std::vector<int32_t> type;
+
+		[[nodiscard]]
+		size_t size() const noexcept { return id.size(); }
+
+		void reserve(size_t count);
+		void clear() noexcept;
+		void add(const UnitRecord &unit);
+	};
+
+	// Query helpers: fill 'rows' with the 0-based rows of matching units, in row order.
+	// The predicate is evaluated over fixed-size blocks without branches, so the compiler
+	// can vectorize it, and the matching rows are compacted afterwards.
+	void selectInRadius(const UnitsSnapshot &units,
+						float x,
+						float y,
+						float radius,
+						std::vector<uint32_t> &rows);
+	void selectByOwner(const UnitsSnapshot &units, int32_t owner, std::vector<uint32_t> &rows);
+
+	struct ColumnsBlock;
+
+	// Read-only view of the published snapshot for Lua, e.g.
+	//   sandbox["units"] = columns.object()
+	// then in a script (rows are 1-based):
+	//   for _, i in ipairs(units:inRadius(x, y, 12)) do
+	//       if units:owner(i) ~= me then attack(units:id(i)) end
+	//   end
+	// Available: #units, units:count(), units:id(i), units:x(i), units:y(i), units:hp(i),
+	// units:owner(i), units:type(i), units:unit(i) -> id, x, y, hp, owner, type,
+	// units:inRadius(x, y, radius [, out]) and units:ofOwner(owner [, out]). Filters return
+	// tables of rows; passing the previous result as 'out' reuses it instead of allocating.
+	class UnitColumns
+	{
+	public:
+		explicit UnitColumns(sol::state_view lua);
+		~UnitColumns() = default;
+
+		UnitColumns(const UnitColumns &) = delete;
+		UnitColumns &operator=(const UnitColumns &) = delete;
+		UnitColumns(UnitColumns &&) = default;
+		UnitColumns &operator=(UnitColumns &&) = default;
+
+		// O(1): scripts see the new snapshot on their next access, nothing is copied.
+		// Must not be called while a script of the same Lua state is running.
+		void publish(std::shared_ptr<const UnitsSnapshot> snapshot) noexcept;
+
+		[[nodiscard]]
+		auto snapshot() const noexcept -> const std::shared_ptr<const UnitsSnapshot> &;
+
+		// Userdata to bind into sandboxes; it keeps the last snapshot alive on its own.
+		[[nodiscard]]
+		auto object() const noexcept -> const sol::userdata & { return handle; }
+
+	private:
+		ColumnsBlock *block{nullptr};
+		sol::userdata handle;
+	};
+} // namespace lua::units
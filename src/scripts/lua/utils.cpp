@@ -1,9 +1,13 @@
 #include "lua/utils.hpp"
 
-#include <array>
-#include <fstream>
+#include "lua/quota.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
 #include <ranges>
 #include <spdlog/spdlog.h>
+#include <utility>
 
 namespace lua
 {
@@ -16,25 +20,105 @@ namespace lua
 		return lua["tostring"](obj).get<std::string>();
 	}
 
-	bool isBytecode(const fs::path &file)
+	auto makeReadOnlyProxy(sol::state_view lua, const sol::table &src) -> sol::table
 	{
-		constexpr auto signature = std::string_view(LUA_SIGNATURE);
+		constexpr auto newIndex = [](lua_State *L) -> int {
+			return luaL_error(L, "Attempt to modify a read-only table.");
+		};
+		auto metatable = lua.create_table();
+		metatable[sol::meta_function::index] = src;
+		metatable[sol::meta_function::new_index] = static_cast<lua_CFunction>(newIndex);
+		metatable["__metatable"] = false;
 
-		auto ifs = std::ifstream(file, std::ios::binary);
-		if (!ifs) {
-			return false;
-		}
-		auto header = std::array<char, signature.size()>{};
-		ifs.read(header.data(), header.size());
-		if (ifs.gcount() < static_cast<std::streamsize>(header.size())) {
-			return false;
-		}
-		return ranges::equal(header, signature);
+		auto proxy = lua.create_table();
+		proxy[sol::metatable_key] = metatable;
+		return proxy;
 	}
 } // namespace lua
 /*-----------------------------------------------------------------------------------------------*/
 namespace lua::memory
 {
+	namespace
+	{
+		// Takes the credit the state needs to reach 'newUsed' bytes from its quota.
+		[[nodiscard]]
+		bool reserveCredit(LimitedAllocatorState &state, size_t newUsed) noexcept
+		{
+			const size_t needed = newUsed - state.credit;
+			const size_t rounded = needed <= std::numeric_limits<size_t>::max() - cQuotaChunk
+									 ? (needed + cQuotaChunk - 1) / cQuotaChunk * cQuotaChunk
+									 : needed;
+			size_t taken = rounded;
+			auto *tripped = state.quota->tryAcquire(rounded);
+			if (tripped != nullptr && rounded != needed) {
+				// Close to the limit: a whole chunk may not fit where the request does
+				taken = needed;
+				tripped = state.quota->tryAcquire(needed);
+			}
+			if (tripped != nullptr) {
+				spdlog::error("Lua allocator: memory quota \"{}\" reached "
+							  "[limit: {}, used: {}, requested: {}]",
+							  tripped->getName(),
+							  tripped->limit(),
+							  tripped->used(),
+							  needed);
+				tripped->reportLimitReached();
+				state.quotaReached = true;
+				return false;
+			}
+			state.credit += taken;
+			return true;
+		}
+
+		void trimCredit(LimitedAllocatorState &state) noexcept
+		{
+			// Everything goes back once the state has freed all its memory (i.e. it's closed)
+			const size_t kept = state.used > 0 ? state.used + cQuotaChunk : 0;
+			if (state.credit > kept + (state.used > 0 ? cQuotaChunk : 0)) {
+				state.quota->release(state.credit - kept);
+				state.credit = kept;
+			}
+		}
+	} // namespace
+
+	auto reserveUsage(LimitedAllocatorState &state, size_t currSize, size_t newSize) noexcept
+		-> std::optional<size_t>
+	{
+		const size_t usedBase = (state.used >= currSize) ? state.used - currSize : 0;
+
+		if (newSize > (std::numeric_limits<size_t>::max() - usedBase)) {
+			spdlog::error("Lua allocator: arithmetic overflow while computing memory usage "
+						  "[used: {}, requested more for: {}, size_t max: {}]",
+						  usedBase,
+						  newSize,
+						  std::numeric_limits<size_t>::max());
+			state.overflow = true;
+			return std::nullopt;
+		}
+		const size_t newUsed = usedBase + newSize;
+		if (state.isLimitEnabled() && newUsed > state.limit) {
+			spdlog::error("Lua allocator: memory limit reached "
+						  "[limit: {}, used: {}, requested total: {}]",
+						  state.limit,
+						  state.used,
+						  newUsed);
+			state.limitReached = true;
+			return std::nullopt;
+		}
+		if (state.quota != nullptr && newUsed > state.credit && !reserveCredit(state, newUsed)) {
+			return std::nullopt;
+		}
+		return newUsed;
+	}
+
+	void releaseUsage(LimitedAllocatorState &state, size_t size) noexcept
+	{
+		state.used -= (state.used >= size) ? size : state.used;
+		if (state.quota != nullptr) {
+			trimCredit(state);
+		}
+	}
+
 	void *limitedAlloc(void *ud, void *ptr, size_t currSize, size_t newSize) noexcept
 	{
 		auto *allocState = static_cast<LimitedAllocatorState*>(ud);
@@ -49,39 +133,87 @@ namespace lua::memory
 		}
 		if (newSize == 0) {
 			if (ptr != nullptr) {
-				allocState->used -= (allocState->used >= currSize) ? currSize
-																   : allocState->used;
+				releaseUsage(*allocState, currSize);
 			}
 			std::free(ptr);
 			return nullptr;
 		}
-		const size_t usedBase = (allocState->used >= currSize) ? allocState->used - currSize
-															   : 0;
+		const auto newUsed = reserveUsage(*allocState, currSize, newSize);
+		if (!newUsed) {
+			return nullptr;
+		}
+		void *newPtr = std::realloc(ptr, newSize);
+		if (newPtr != nullptr) {
+			allocState->used = *newUsed;
+		}
+		return newPtr;
+	}
 
-		if (newSize > (std::numeric_limits<size_t>::max() - usedBase)) {
-			spdlog::error("Lua allocator: arithmetic overflow while computing memory usage "
-						  "[used: {}, requested more for: {}, size_t max: {}]",
-						  usedBase,
-						  newSize,
-						  std::numeric_limits<size_t>::max());
+	namespace
+	{
+		auto ownerOf(void *block) noexcept -> SandboxMemory *&
+		{
+			return *static_cast<SandboxMemory **>(block);
+		}
+
+		void credit(SandboxMemory *sandbox, size_t size) noexcept
+		{
+			if (sandbox != nullptr) {
+				sandbox->used -= std::min(sandbox->used, size);
+			}
+		}
+	} // namespace
+
+	void *sandboxAlloc(void *ud, void *ptr, size_t currSize, size_t newSize) noexcept
+	{
+		auto *allocState = static_cast<LimitedAllocatorState*>(ud);
+
+		if (allocState == nullptr || allocState->base == nullptr) {
+			assert(allocState != nullptr && allocState->base != nullptr
+				   && "The allocator state with a base allocator must be provided.");
+			return nullptr;
+		}
+		auto *block = ptr != nullptr ? static_cast<std::byte *>(ptr) - cOwnerHeaderSize : nullptr;
+		auto *const previousOwner = block != nullptr ? ownerOf(block) : nullptr;
+		const size_t blockSize = block != nullptr ? currSize + cOwnerHeaderSize : 0;
+
+		if (newSize == 0) {
+			if (block != nullptr) {
+				credit(previousOwner, currSize);
+				allocState->base(ud, block, blockSize, 0);
+			}
+			return nullptr;
+		}
+		if (block == nullptr) {
+			currSize = 0;
+		}
+		// Resized outside of sandboxes, the block stays with its owner
+		auto *owner = allocState->sandbox != nullptr ? allocState->sandbox : previousOwner;
+		if (auto *sandbox = allocState->sandbox; sandbox != nullptr && sandbox->isLimitEnabled()
+			&& newSize > currSize && sandbox->used + (newSize - currSize) > sandbox->limit) {
+			spdlog::error("Lua allocator: sandbox memory limit reached "
+						  "[limit: {}, used: {}, requested more: {}]",
+						  sandbox->limit,
+						  sandbox->used,
+						  newSize - currSize);
+			sandbox->limitReached = true;
+			return nullptr;
+		}
+		if (newSize > std::numeric_limits<size_t>::max() - cOwnerHeaderSize) {
 			allocState->overflow = true;
 			return nullptr;
 		}
-		const size_t newUsed = usedBase + newSize;
-		if (allocState->isLimitEnabled() && newUsed > allocState->limit) {
-			spdlog::error("Lua allocator: memory limit reached "
-						  "[limit: {}, used: {}, requested total: {}]",
-						  allocState->limit,
-						  allocState->used,
-						  newUsed);
-			allocState->limitReached = true;
+		void *newBlock = allocState->base(ud, block, blockSize, newSize + cOwnerHeaderSize);
+		if (newBlock == nullptr) {
 			return nullptr;
 		}
-		void *newPtr = std::realloc(ptr, newSize);
-		if (newPtr != nullptr) {
-			allocState->used = newUsed;
+		credit(previousOwner, currSize);
+		ownerOf(newBlock) = owner;
+		if (owner != nullptr) {
+			owner->used += newSize;
+			owner->peak = std::max(owner->peak, owner->used);
 		}
-		return newPtr;
+		return static_cast<std::byte *>(newBlock) + cOwnerHeaderSize;
 	}
 } // namespace lua::memory
 /*-----------------------------------------------------------------------------------------------*/
@@ -99,6 +231,11 @@ namespace lua::timeoutGuard
 		}
 	}
 
+	void expiredHook(lua_State *L, lua_Debug* /*ar*/)
+	{
+		luaL_error(L, "Timeout guard: Script timed out.");
+	}
+
 	void setHook(sol::state_view lua,
 				 InstructionsCount checkPeriod,
 				 lua_Hook func /* = lua::timeoutGuard::defaultHook */) noexcept
@@ -111,6 +248,158 @@ namespace lua::timeoutGuard
 	{
 		lua_sethook(lua.lua_state(), nullptr, 0, 0);
 	}
+
+	namespace
+	{
+		void trackThread(lua_State *L, int index)
+		{
+			if (lua_type(L, index) != LUA_TTHREAD) {
+				return;
+			}
+			if (auto *watchdog = Watchdog::SelfRegistry::get(L)) {
+				watchdog->track(L, index);
+			}
+		}
+
+		// Upvalue 1: the original function
+		void callOriginal(lua_State *L)
+		{
+			lua_pushvalue(L, lua_upvalueindex(1));
+			lua_insert(L, 1);
+			lua_call(L, lua_gettop(L) - 1, 1);
+		}
+
+		int trackedCreate(lua_State *L)
+		{
+			callOriginal(L);
+			trackThread(L, -1);
+			return 1;
+		}
+
+		int trackedWrap(lua_State *L)
+		{
+			callOriginal(L);
+			// The wrapper made by coroutine.wrap keeps its thread as the first upvalue
+			if (lua_iscfunction(L, -1) && lua_getupvalue(L, -1, 1) != nullptr) {
+				trackThread(L, -1);
+				lua_pop(L, 1);
+			}
+			return 1;
+		}
+
+		void replaceWithTracked(lua_State *L, int lib, const char *name, lua_CFunction tracked)
+		{
+			lua_getfield(L, lib, name);
+			if (!lua_isfunction(L, -1) || lua_tocfunction(L, -1) == tracked) {
+				lua_pop(L, 1);
+				return;
+			}
+			lua_pushcclosure(L, tracked, 1);
+			lua_setfield(L, lib, name);
+		}
+	} // namespace
+
+	void trackCoroutines(sol::state_view lua)
+	{
+		auto *L = lua.lua_state();
+		lua_getglobal(L, "coroutine");
+		if (lua_istable(L, -1)) {
+			const auto lib = lua_gettop(L);
+			replaceWithTracked(L, lib, "create", trackedCreate);
+			replaceWithTracked(L, lib, "wrap", trackedWrap);
+		}
+		lua_pop(L, 1);
+	}
+/*-----------------------------------------------------------------------------------------------*/
+	Monitor &Monitor::instance()
+	{
+		static Monitor monitor;
+		return monitor;
+	}
+
+	void Monitor::schedule(Key key, lua_State *lua, clock::time_point deadline, Trigger trigger)
+	{
+		auto lock = std::scoped_lock(mutex);
+
+		auto sameKey = [key](const Entry &entry) { return entry.key == key; };
+		if (auto it = ranges::find_if(entries, sameKey); it != entries.end()) {
+			*it = Entry{key, lua, deadline, trigger};
+		} else {
+			entries.push_back(Entry{key, lua, deadline, trigger});
+		}
+		changed = true;
+
+		if (!thread.joinable()) {
+			thread = std::jthread([this](std::stop_token stop) { run(stop); });
+		}
+		wakeUp.notify_one();
+	}
+
+	void Monitor::addThread(Key key, lua_State *lua)
+	{
+		auto lock = std::scoped_lock(mutex);
+
+		auto sameKey = [key](const Entry &entry) { return entry.key == key; };
+		const auto it = ranges::find_if(entries, sameKey);
+		if (it == entries.end()) {
+			return;
+		}
+		if (it->fired) {
+			const auto &[hook, mask, count] = it->trigger;
+			lua_sethook(lua, hook, mask, count);
+		} else {
+			it->threads.push_back(lua);
+		}
+	}
+
+	bool Monitor::cancel(Key key)
+	{
+		auto lock = std::scoped_lock(mutex);
+
+		auto sameKey = [key](const Entry &entry) { return entry.key == key; };
+		const auto it = ranges::find_if(entries, sameKey);
+		if (it == entries.end()) {
+			return false;
+		}
+		const bool fired = it->fired;
+		*it = std::move(entries.back());
+		entries.pop_back();
+		changed = true;
+
+		return fired;
+	}
+
+	void Monitor::run(std::stop_token stop)
+	{
+		auto lock = std::unique_lock(mutex);
+
+		auto isChanged = [this] { return std::exchange(changed, false); };
+
+		while (!stop.stop_requested()) {
+			auto nextDeadline = clock::time_point::max();
+			for (const auto &entry : entries) {
+				if (!entry.fired) {
+					nextDeadline = std::min(nextDeadline, entry.deadline);
+				}
+			}
+			if (nextDeadline == clock::time_point::max()) {
+				wakeUp.wait(lock, stop, isChanged);
+			} else {
+				wakeUp.wait_until(lock, stop, nextDeadline, isChanged);
+			}
+			const auto now = clock::now();
+			for (auto &entry : entries) {
+				if (!entry.fired && entry.deadline <= now) {
+					const auto &[hook, mask, count] = entry.trigger;
+					lua_sethook(entry.lua, hook, mask, count);
+					for (auto *thread : entry.threads) {
+						lua_sethook(thread, hook, mask, count);
+					}
+					entry.fired = true;
+				}
+			}
+		}
+	}
 /*-----------------------------------------------------------------------------------------------*/
 	bool Watchdog::attach(sol::state_view newLua, bool force /* = false */) noexcept
 	{
@@ -151,6 +440,16 @@ namespace lua::timeoutGuard
 		return true;
 	}
 
+	bool Watchdog::setMode(Mode newMode) noexcept
+	{
+		if (armed()) {
+			spdlog::error("Cannot change timeout watchdog mode while it's armed");
+			return false;
+		}
+		mode = newMode;
+		return true;
+	}
+
 	bool Watchdog::arm(time::milliseconds limit) noexcept
 	{
 		if (armed()) {
@@ -173,8 +472,20 @@ namespace lua::timeoutGuard
 		}
 		running = true;
 		CtxRegistry::set(lua, &context);
-		setHook(lua, checkPeriod, hook);
 		context.start(limit);
+
+		if (mode == Mode::Monitor) {
+			SelfRegistry::set(lua, this);
+			try {
+				Monitor::instance().schedule(this, lua, context.deadline);
+			} catch (const std::exception &err) {
+				spdlog::error("Unable to arm timeout watchdog: {}", err.what());
+				disarm();
+				return false;
+			}
+		} else {
+			setHook(lua, checkPeriod, hook);
+		}
 		return true;
 	}
 
@@ -185,6 +496,27 @@ namespace lua::timeoutGuard
 			return false;
 		}
 		context.start(limit);
+
+		if (mode == Mode::Monitor) {
+			try {
+				auto &monitor = Monitor::instance();
+				if (monitor.cancel(this)) {
+					removeHook(lua);
+					for (auto *thread : coroutines) {
+						lua_sethook(thread, nullptr, 0, 0);
+					}
+				}
+				monitor.schedule(this, lua, context.deadline);
+				for (auto *thread : coroutines) {
+					monitor.addThread(this, thread);
+				}
+			} catch (const std::exception &err) {
+				// Without a deadline on the monitor the script could run forever
+				spdlog::error("Unable to rearm timeout watchdog: {}", err.what());
+				disarm();
+				return false;
+			}
+		}
 		return true;
 	}
 
@@ -197,7 +529,62 @@ namespace lua::timeoutGuard
 		if (!attached() || !wasArmed) {
 			return;
 		}
+		if (mode == Mode::Monitor) {
+			Monitor::instance().cancel(this);
+			untrackCoroutines();
+			SelfRegistry::remove(lua);
+		}
 		removeHook(lua);
 		CtxRegistry::remove(lua);
 	}
+
+	void Watchdog::track(lua_State *L, int index)
+	{
+		index = index < 0 ? lua_gettop(L) + index + 1 : index;
+
+		// Anchored in the registry, so the monitor never touches a collected thread
+		auto *const anchorsKey = static_cast<void *>(&coroutines);
+		lua_pushlightuserdata(L, anchorsKey);
+		lua_rawget(L, LUA_REGISTRYINDEX);
+		if (!lua_istable(L, -1)) {
+			lua_pop(L, 1);
+			lua_newtable(L);
+			lua_pushlightuserdata(L, anchorsKey);
+			lua_pushvalue(L, -2);
+			lua_rawset(L, LUA_REGISTRYINDEX);
+			coroutinesAnchored = true;
+		}
+		lua_pushvalue(L, index);
+		lua_pushboolean(L, 1);
+		lua_rawset(L, -3);
+		lua_pop(L, 1);
+
+		auto *thread = lua_tothread(L, index);
+		bool tracked = true;
+		try {
+			coroutines.push_back(thread);
+			Monitor::instance().addThread(this, thread);
+		} catch (...) {
+			tracked = false;
+		}
+		if (!tracked) {
+			luaL_error(L, "Timeout guard: Unable to track the coroutine.");
+		}
+	}
+
+	void Watchdog::untrackCoroutines() noexcept
+	{
+		for (auto *thread : coroutines) {
+			lua_sethook(thread, nullptr, 0, 0);
+		}
+		coroutines.clear();
+
+		if (coroutinesAnchored) {
+			// The key is there already: clearing it doesn't allocate
+			lua_pushlightuserdata(lua, static_cast<void *>(&coroutines));
+			lua_pushnil(lua);
+			lua_rawset(lua, LUA_REGISTRYINDEX);
+			coroutinesAnchored = false;
+		}
+	}
 } // namespace lua::timeoutGuard
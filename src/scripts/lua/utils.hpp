@@ -4,9 +4,14 @@
 #include "utils/filesystem.hpp"
 
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <optional>
 #include <ranges>
 #include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace ranges = std::ranges;
 
@@ -85,17 +90,55 @@ namespace lua
 	[[nodiscard]]
 	auto toString(const sol::object &obj) -> std::string;
 
+	// Returns an empty table exposing the fields of 'src' through __index. Assigning to it raises
+	// an error and its metatable is hidden from getmetatable().
 	[[nodiscard]]
-	bool isBytecode(const fs::path &file);
+	auto makeReadOnlyProxy(sol::state_view lua, const sol::table &src) -> sol::table;
+
+	[[nodiscard]]
+	constexpr bool isBytecode(std::string_view chunk) noexcept
+	{
+		return chunk.starts_with(std::string_view(LUA_SIGNATURE));
+	}
+
+	// Drops a first line starting with '#' ("#!/usr/bin/lua") like luaL_loadfile() does. The
+	// line break is kept, so the line numbers in error messages still match the file.
+	[[nodiscard]]
+	constexpr auto skipShebang(std::string_view chunk) noexcept -> std::string_view
+	{
+		if (!chunk.starts_with('#')) {
+			return chunk;
+		}
+		const auto lineEnd = chunk.find('\n');
+		return lineEnd == std::string_view::npos ? std::string_view{} : chunk.substr(lineEnd);
+	}
 } // namespace lua
 /*-----------------------------------------------------------------------------------------------*/
 namespace lua::memory
 {
 	using Allocator = lua_Alloc;
 
+	class Quota;
+	class SizeClassPool;
+
 	constexpr size_t c1MB = 1L * 1024 * 1024;
 	constexpr size_t cDefaultMemLimit = c1MB;
 
+	// Memory charged to one sandbox of a state. Blocks stay charged to the sandbox which
+	// allocated them until they're freed, whoever frees them.
+	struct SandboxMemory
+	{
+		size_t used {};
+		size_t peak {};
+		size_t limit {}; // Zero: only counted, the limit of the state still applies
+
+		bool limitReached {false};
+		bool released {false}; // The sandbox is gone, its blocks may still be around
+
+		[[nodiscard]]
+		bool isLimitEnabled() const { return limit > 0; }
+	};
+
 	struct LimitedAllocatorState
 	{
 		size_t used {};
@@ -103,14 +146,83 @@ namespace lua::memory
 
 		bool limitReached {false};
 		bool overflow {false};
+		bool quotaReached {false}; // The quota itself tells which of its levels it was
+
+		SizeClassPool *pool {nullptr}; // Backing storage for pool-based allocators (slabAlloc)
+
+		// Shared quota, set with setQuota(). 'credit' is what the state has taken from it so far,
+		// at least 'used' bytes.
+		Quota *quota {nullptr};
+		size_t credit {};
+
+		// Per sandbox accounting, done by sandboxAlloc() on top of the 'base' allocator:
+		// allocations made while 'sandbox' is set are charged to it.
+		SandboxMemory *sandbox {nullptr};
+		Allocator base {nullptr};
 
 		[[nodiscard]]
 		bool isLimitEnabled() const { return limit > 0; }
 		void disableLimit() { limit = 0; }
-		void resetErrorFlags() noexcept { limitReached = overflow = false; }
+		void resetErrorFlags() noexcept { limitReached = overflow = quotaReached = false; }
+	};
+
+	// Accounting shared by all allocators working on top of LimitedAllocatorState.
+	// Returns the value 'used' will have once the block is resized from currSize to newSize,
+	// or std::nullopt (with the corresponding error flag raised) if the request doesn't fit.
+	// With a quota attached, credit is taken from it in cQuotaChunk steps as 'used' grows and
+	// given back in releaseUsage() once more than two chunks of it are unused.
+	[[nodiscard]]
+	auto reserveUsage(LimitedAllocatorState &state, size_t currSize, size_t newSize) noexcept
+		-> std::optional<size_t>;
+	void releaseUsage(LimitedAllocatorState &state, size_t size) noexcept;
+
+	// Charges the allocations of the state to a sandbox (none, if null) for its lifetime.
+	// Scopes nest: the previous sandbox is charged again once the scope ends.
+	class SandboxMemoryScope
+	{
+	public:
+		SandboxMemoryScope(LimitedAllocatorState *state, SandboxMemory *sandbox) noexcept
+			: state(state),
+			  previous(state != nullptr ? state->sandbox : nullptr)
+		{
+			if (state != nullptr) {
+				state->sandbox = sandbox;
+			}
+		}
+		~SandboxMemoryScope()
+		{
+			if (state != nullptr) {
+				state->sandbox = previous;
+			}
+		}
+
+		SandboxMemoryScope(const SandboxMemoryScope &) = delete;
+		SandboxMemoryScope &operator=(const SandboxMemoryScope &) = delete;
+		SandboxMemoryScope(SandboxMemoryScope &&other) noexcept
+			: state(std::exchange(other.state, nullptr)),
+			  previous(other.previous)
+		{}
+		SandboxMemoryScope &operator=(SandboxMemoryScope &&) = delete;
+
+	private:
+		LimitedAllocatorState *state {nullptr};
+		SandboxMemory *previous {nullptr};
 	};
 
 	void *limitedAlloc(void *ud, void *ptr, size_t currSize, size_t newSize) noexcept;
+
+	// Room for the owner in front of the blocks of sandboxAlloc(), keeping the alignment of
+	// the blocks Lua gets.
+	constexpr size_t cOwnerHeaderSize =
+		sizeof(SandboxMemory *) > alignof(double) ? sizeof(SandboxMemory *) : alignof(double);
+
+	// Runs on top of state.base (one of the allocators working on LimitedAllocatorState).
+	// Every block carries the sandbox it's charged to in a small header, so it's credited back
+	// on free in O(1), whoever frees it. The headers are allocated along with the blocks and
+	// count against the limit of the state.
+	// The limit of the current sandbox is checked against the growth of the block, as if it was
+	// its own: resizing a block of another sandbox may overshoot it by the old size.
+	void *sandboxAlloc(void *ud, void *ptr, size_t currSize, size_t newSize) noexcept;
 } // namespace lua::memory
 /*-----------------------------------------------------------------------------------------------*/
 namespace lua::registry
@@ -164,14 +276,27 @@ namespace lua::timeoutGuard
 
 	constexpr auto kDefaultCheckPeriod {10'000};
 	constexpr auto kDefaultLimit {5ms};
+
+	// Hook:    the hook is installed on arm and checks the deadline every checkPeriod instructions.
+	// Monitor: no hook is installed while the script is within its limit. The shared Monitor
+	//          thread installs expiredHook once the deadline passes, on the state and on the
+	//          coroutines created while armed (see trackCoroutines()).
+	enum class Mode { Hook, Monitor };
 /*-----------------------------------------------------------------------------------------------*/
 	void defaultHook(lua_State *L, lua_Debug* /*ar*/);
+	void expiredHook(lua_State *L, lua_Debug* /*ar*/);
 
 	void setHook(sol::state_view lua,
 				 InstructionsCount checkPeriod,
 				 lua_Hook func = lua::timeoutGuard::defaultHook) noexcept;
 
 	void removeHook(sol::state_view lua) noexcept;
+
+	// Replaces coroutine.create and coroutine.wrap of the state with versions reporting the new
+	// threads to the watchdog armed in Monitor mode: Lua 5.1 copies the hook of a thread to a
+	// coroutine only when creating it, so the one installed on expiry would never reach them.
+	// Does nothing if the coroutine lib isn't loaded or is already tracked.
+	void trackCoroutines(sol::state_view lua);
 /*-----------------------------------------------------------------------------------------------*/
 	struct HookContext
 	{
@@ -190,6 +315,66 @@ namespace lua::timeoutGuard
 		[[nodiscard]]
 		bool isTimedOut() const noexcept { return enabled && clock::now() > deadline; }
 	};
+/*-----------------------------------------------------------------------------------------------*/
+	struct HookTrigger
+	{
+		lua_Hook hook{expiredHook};
+		int mask{LUA_MASKCOUNT};
+		InstructionsCount count{1};
+	};
+
+	// A single background thread tracking the deadlines of every scheduled Lua state.
+	// When a deadline passes, it installs the given hook on the state from its own thread
+	// (lua_sethook is safe to call asynchronously, the same way lua.c does it from a signal).
+	class Monitor
+	{
+	public:
+		using clock = HookContext::clock;
+		using Key = const void *;
+		using Trigger = HookTrigger;
+
+		static Monitor &instance();
+
+		Monitor(const Monitor &) = delete;
+		Monitor &operator=(const Monitor &) = delete;
+		Monitor(Monitor &&) = delete;
+		Monitor &operator=(Monitor &&) = delete;
+
+		~Monitor() = default;
+
+		// Replaces any pending deadline previously scheduled under the same key.
+		void schedule(Key key, lua_State *lua, clock::time_point deadline, Trigger trigger = {});
+		// Another thread of the state to put the trigger hook on, right away if already fired.
+		// It must stay alive until the key is cancelled.
+		void addThread(Key key, lua_State *thread);
+
+		// Once it returns, the monitor no longer touches the state scheduled under the key.
+		// Returns true if the trigger hook has already been installed.
+		bool cancel(Key key);
+
+	private:
+		Monitor() = default;
+
+		void run(std::stop_token stop);
+
+	private:
+		struct Entry
+		{
+			Key key{nullptr};
+			lua_State *lua{nullptr};
+			clock::time_point deadline{};
+			Trigger trigger{};
+			bool fired{false};
+			std::vector<lua_State *> threads{};
+		};
+
+		std::mutex mutex;
+		std::condition_variable_any wakeUp;
+		std::vector<Entry> entries;
+		bool changed{false};
+
+		std::jthread thread; // Declared last: stopped and joined before the rest is destroyed
+	};
 /*-----------------------------------------------------------------------------------------------*/
 	class Watchdog
 	{
@@ -198,11 +383,15 @@ namespace lua::timeoutGuard
 		InstructionsCount checkPeriod{0};
 		lua_Hook hook{nullptr};
 		HookContext context{};
+		Mode mode{Mode::Hook};
+		std::vector<lua_State *> coroutines; // Created while armed in Monitor mode, see track()
+		bool coroutinesAnchored{false};
 
 		bool running{false};
 
 	public:
 		using CtxRegistry = registry::TypeTaggedSlot<HookContext>;
+		using SelfRegistry = registry::TypeTaggedSlot<Watchdog>; // Set while armed in Monitor mode
 
 		Watchdog(sol::state_view lua,
 				 InstructionsCount checkPeriod = kDefaultCheckPeriod,
@@ -223,17 +412,28 @@ namespace lua::timeoutGuard
 		void detach() noexcept;
 
 		bool configureHook(InstructionsCount newCheckPeriod, lua_Hook newHook) noexcept;
+		bool setMode(Mode newMode) noexcept;
+
+		[[nodiscard]]
+		Mode currentMode() const noexcept { return mode; }
 
 		[[nodiscard]]
 		bool armed() const noexcept { return running; }
 		[[nodiscard]]
 		bool timedOut() const noexcept { return context.isTimedOut(); }
 
+		// If the monitor fails to take the deadline, the watchdog is disarmed and false returned.
 		bool arm(time::milliseconds limit) noexcept;
 		bool rearm(time::milliseconds limit) noexcept;
 		void disarm() noexcept;
 
+		// Lets the expired hook reach the coroutine at the given stack index of L, which is kept
+		// alive until disarmed. Called from Lua (see trackCoroutines()), raises Lua errors.
+		void track(lua_State *L, int index);
+
 	private:
+		void untrackCoroutines() noexcept;
+
 		[[nodiscard]]
 		bool attached() const noexcept { return lua != nullptr; }
 	};
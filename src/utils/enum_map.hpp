@@ -0,0 +1,151 @@
+#pragma once
+
+#include "utils/enum_set.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <utility>
+
+// Map from enum keys to values, stored as a flat array indexed by the enum value.
+// Present keys are tracked by an enum_set, which is also used to iterate over them in key order.
+// Lookup never allocates; values of absent keys are kept default-constructed.
+template <CountedEnum Enum, typename T>
+class enum_map
+{
+public:
+	using key_type = Enum;
+	using mapped_type = T;
+	using keys_t = enum_set<Enum>;
+
+	constexpr enum_map() = default;
+
+	constexpr enum_map(std::initializer_list<std::pair<Enum, T>> init)
+	{
+		for (const auto &[key, value] : init) {
+			insert_or_assign(key, value);
+		}
+	}
+
+	[[nodiscard]]
+	constexpr bool contains(Enum key) const noexcept { return keys.contains(key); }
+	[[nodiscard]]
+	constexpr bool empty() const noexcept { return keys.empty(); }
+	[[nodiscard]]
+	constexpr size_t size() const noexcept { return keys.size(); }
+	[[nodiscard]]
+	constexpr auto keySet() const noexcept -> const keys_t & { return keys; }
+
+	// nullptr if the key is absent
+	[[nodiscard]]
+	constexpr T *find(Enum key) noexcept
+	{
+		return contains(key) ? &values[index(key)] : nullptr;
+	}
+	[[nodiscard]]
+	constexpr const T *find(Enum key) const noexcept
+	{
+		return contains(key) ? &values[index(key)] : nullptr;
+	}
+
+	[[nodiscard]]
+	constexpr T &at(Enum key) noexcept
+	{
+		assert(contains(key) && "enum_map: no such key.");
+		return values[index(key)];
+	}
+	[[nodiscard]]
+	constexpr const T &at(Enum key) const noexcept
+	{
+		assert(contains(key) && "enum_map: no such key.");
+		return values[index(key)];
+	}
+
+	// Inserts a default-constructed value if the key is absent
+	constexpr T &operator[](Enum key) noexcept
+	{
+		keys.insert(key);
+		return values[index(key)];
+	}
+
+	template <typename Value>
+	constexpr T &insert_or_assign(Enum key, Value &&value)
+	{
+		keys.insert(key);
+		return values[index(key)] = std::forward<Value>(value);
+	}
+
+	// Values are reset rather than just unmarked, so resources they hold are released right away.
+	constexpr void erase(Enum key)
+	{
+		if (contains(key)) {
+			values[index(key)] = T{};
+			keys.erase(key);
+		}
+	}
+	constexpr void clear()
+	{
+		for (const auto key : keys) {
+			values[index(key)] = T{};
+		}
+		keys.clear();
+	}
+
+	template <typename Map, typename Value>
+	struct basic_iterator
+	{
+		// For STL-compatibility
+		using value_type = std::pair<Enum, Value &>;
+		using difference_type = std::ptrdiff_t;
+		using iterator_category = std::input_iterator_tag;
+
+		Map *map = nullptr;
+		typename keys_t::iterator key{};
+
+		constexpr value_type operator*() const noexcept
+		{
+			return {*key, map->values[index(*key)]};
+		}
+		constexpr basic_iterator &operator++() noexcept // pre-increment
+		{
+			++key;
+			return *this;
+		}
+		constexpr basic_iterator operator++(int) noexcept // post-increment
+		{
+			basic_iterator ret = *this;
+			++(*this);
+			return ret;
+		}
+		constexpr bool operator==(const basic_iterator &other) const noexcept
+		{
+			return key == other.key;
+		}
+		constexpr bool operator!=(const basic_iterator &other) const noexcept
+		{
+			return key != other.key;
+		}
+	};
+	using iterator = basic_iterator<enum_map, T>;
+	using const_iterator = basic_iterator<const enum_map, const T>;
+
+	constexpr iterator begin() noexcept { return {this, keys.begin()}; }
+	constexpr iterator end() noexcept { return {this, keys.end()}; }
+	constexpr const_iterator begin() const noexcept { return {this, keys.begin()}; }
+	constexpr const_iterator end() const noexcept { return {this, keys.end()}; }
+
+private:
+	[[nodiscard]]
+	static constexpr size_t index(Enum key) noexcept
+	{
+		return static_cast<size_t>(key);
+	}
+
+private:
+	static constexpr size_t N = static_cast<size_t>(enumSize<Enum>());
+
+	keys_t keys{};
+	std::array<T, N> values{};
+};
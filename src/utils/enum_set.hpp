@@ -1,13 +1,24 @@
 #pragma once
 
+#include <array>
 #include <bit>
 #include <concepts>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <initializer_list>
 #include <iterator>
 #include <type_traits>
 
+// Private to this header: #undef'd at its end
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define ENUM_SET_DETAIL_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define ENUM_SET_DETAIL_SSE2
+#endif
+
 template <typename T>
 concept CountedEnum =
 	std::is_enum_v<T>
@@ -25,12 +36,24 @@ consteval Enum_ut enumSize()
 	}
 }
 
+// Set of enum values stored as a bit mask of enumSize<Enum>() bits, split into 64-bit words.
+// Set algebra works on whole words and uses SSE2/AVX2 when the target has them
+// (and the plain loop in constant evaluation).
 template <CountedEnum Enum, typename Enum_ut = std::underlying_type_t<Enum>>
 class enum_set
 {
 public:
 	using mask_t = uint64_t;
-	static constexpr Enum_ut cMaxCapacity = 64;
+	static constexpr size_t cWordBits = 64;
+
+private:
+	static constexpr Enum_ut N = enumSize<Enum>();
+
+public:
+	static constexpr size_t cWords = N == 0 ? 1 : (size_t(N) + cWordBits - 1) / cWordBits;
+	static constexpr size_t cCapacity = cWords * cWordBits;
+
+	using words_t = std::array<mask_t, cWords>;
 
 	constexpr enum_set() noexcept = default;
 
@@ -46,28 +69,121 @@ public:
 			insert(e);
 		}
 	}
-	constexpr void insert(Enum e) noexcept { bits |= bit(e); }
-	constexpr void erase(Enum e) noexcept { bits &= ~bit(e); }
-	constexpr void clear() noexcept { bits = 0; }
+	constexpr void insert(Enum e) noexcept { words[wordOf(e)] |= bit(e); }
+	constexpr void erase(Enum e) noexcept { words[wordOf(e)] &= ~bit(e); }
+	constexpr void clear() noexcept { words = {}; }
 
 	[[nodiscard]]
 	constexpr bool contains(Enum e) const noexcept
 	{
-		return bits & bit(e);
+		return words[wordOf(e)] & bit(e);
 	}
 
 	[[nodiscard]]
 	constexpr bool empty() const noexcept
 	{
-		return bits == 0;
+		for (const auto word : words) {
+			if (word != 0) {
+				return false;
+			}
+		}
+		return true;
 	}
 
 	[[nodiscard]]
 	constexpr size_t size() const noexcept
 	{
-		return std::popcount(bits);
+		size_t count = 0;
+		for (const auto word : words) {
+			count += std::popcount(word);
+		}
+		return count;
 	}
 
+	// Set algebra
+	constexpr enum_set &operator|=(const enum_set &other) noexcept
+	{
+		apply<Op::Union>(words, other.words);
+		return *this;
+	}
+	constexpr enum_set &operator&=(const enum_set &other) noexcept
+	{
+		apply<Op::Intersection>(words, other.words);
+		return *this;
+	}
+	constexpr enum_set &operator-=(const enum_set &other) noexcept
+	{
+		apply<Op::Difference>(words, other.words);
+		return *this;
+	}
+	constexpr enum_set &operator^=(const enum_set &other) noexcept
+	{
+		apply<Op::SymmetricDifference>(words, other.words);
+		return *this;
+	}
+
+	[[nodiscard]]
+	friend constexpr enum_set operator|(enum_set lhs, const enum_set &rhs) noexcept
+	{
+		return lhs |= rhs;
+	}
+	[[nodiscard]]
+	friend constexpr enum_set operator&(enum_set lhs, const enum_set &rhs) noexcept
+	{
+		return lhs &= rhs;
+	}
+	[[nodiscard]]
+	friend constexpr enum_set operator-(enum_set lhs, const enum_set &rhs) noexcept
+	{
+		return lhs -= rhs;
+	}
+	[[nodiscard]]
+	friend constexpr enum_set operator^(enum_set lhs, const enum_set &rhs) noexcept
+	{
+		return lhs ^= rhs;
+	}
+
+	[[nodiscard]]
+	constexpr bool operator==(const enum_set &other) const noexcept = default;
+
+	// True if every value of this set is in the other one, e.g. tech requirements are met.
+	[[nodiscard]]
+	constexpr bool isSubsetOf(const enum_set &other) const noexcept
+	{
+		size_t i = 0;
+		if (!std::is_constant_evaluated()) {
+			if (!isSubsetVectorized(words, other.words, i)) {
+				return false;
+			}
+		}
+		for (; i < cWords; ++i) {
+			if ((words[i] & ~other.words[i]) != 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	[[nodiscard]]
+	constexpr bool intersects(const enum_set &other) const noexcept
+	{
+		size_t i = 0;
+		if (!std::is_constant_evaluated()) {
+			if (intersectsVectorized(words, other.words, i)) {
+				return true;
+			}
+		}
+		for (; i < cWords; ++i) {
+			if ((words[i] & other.words[i]) != 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	[[nodiscard]]
+	constexpr auto raw() const noexcept -> const words_t & { return words; }
+
 	struct iterator
 	{
 		// For STL-compatibility
@@ -75,31 +191,34 @@ public:
 		using difference_type = std::ptrdiff_t;
 		using iterator_category = std::input_iterator_tag;
 
+		const words_t *words = nullptr;
+		size_t word = cWords;
 		mask_t rest = 0;
 		Enum_ut idx = N;
 
 		constexpr iterator() noexcept = default;
 
-		constexpr iterator(mask_t mask, bool end) noexcept
+		constexpr iterator(const words_t &mask, bool end) noexcept
+			: words(&mask)
 		{
-			if (end || mask == 0) {
-				rest = 0;
-				idx = N;
-			} else {
-				rest = mask;
-				idx = std::countr_zero(rest);
-				rest &= rest - 1;
+			if (!end) {
+				word = 0;
+				rest = mask[0];
+				++(*this);
 			}
 		}
 		constexpr value_type operator*() const noexcept { return to_enum(idx); }
 		constexpr iterator &operator++() noexcept // pre-increment
 		{
-			if (rest == 0) {
-				idx = N;
-			} else {
-				idx = std::countr_zero(rest);
-				rest &= rest - 1;
+			while (rest == 0) {
+				if (++word >= cWords) {
+					idx = N;
+					return *this;
+				}
+				rest = (*words)[word];
 			}
+			idx = static_cast<Enum_ut>(word * cWordBits + std::countr_zero(rest));
+			rest &= rest - 1;
 			return *this;
 		}
 		constexpr iterator operator++(int) noexcept // post-increment
@@ -112,10 +231,141 @@ public:
 		constexpr bool operator!=(const iterator &other) const noexcept { return idx != other.idx; }
 	};
 
-	constexpr iterator begin() const noexcept { return iterator(bits, /*end=*/false); }
-	constexpr iterator end() const noexcept { return iterator(bits, /*end=*/true); }
+	constexpr iterator begin() const noexcept { return iterator(words, /*end=*/false); }
+	constexpr iterator end() const noexcept { return iterator(words, /*end=*/true); }
 
 private:
+	enum class Op { Union, Intersection, Difference, SymmetricDifference };
+
+	template <Op op>
+	static constexpr mask_t combine(mask_t lhs, mask_t rhs) noexcept
+	{
+		if constexpr (op == Op::Union) {
+			return lhs | rhs;
+		} else if constexpr (op == Op::Intersection) {
+			return lhs & rhs;
+		} else if constexpr (op == Op::Difference) {
+			return lhs & ~rhs;
+		} else {
+			return lhs ^ rhs;
+		}
+	}
+
+	template <Op op>
+	static constexpr void apply(words_t &dst, const words_t &src) noexcept
+	{
+		size_t i = 0;
+		if (!std::is_constant_evaluated()) {
+			i = applyVectorized<op>(dst, src);
+		}
+		for (; i < cWords; ++i) {
+			dst[i] = combine<op>(dst[i], src[i]);
+		}
+	}
+
+	// The vectorized helpers process as many leading words as their registers fit and
+	// return (or advance 'i' to) the index the scalar tail has to start from.
+	template <Op op>
+	static size_t applyVectorized([[maybe_unused]] words_t &dst,
+								  [[maybe_unused]] const words_t &src) noexcept
+	{
+		size_t i = 0;
+#if defined(__AVX2__)
+		for (; i + 4 <= cWords; i += 4) {
+			const auto lhs = load256(&dst[i]);
+			const auto rhs = load256(&src[i]);
+			auto result = __m256i{};
+			if constexpr (op == Op::Union) {
+				result = _mm256_or_si256(lhs, rhs);
+			} else if constexpr (op == Op::Intersection) {
+				result = _mm256_and_si256(lhs, rhs);
+			} else if constexpr (op == Op::Difference) {
+				result = _mm256_andnot_si256(rhs, lhs);
+			} else {
+				result = _mm256_xor_si256(lhs, rhs);
+			}
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(&dst[i]), result);
+		}
+#endif
+#if defined(ENUM_SET_DETAIL_SSE2)
+		for (; i + 2 <= cWords; i += 2) {
+			const auto lhs = load128(&dst[i]);
+			const auto rhs = load128(&src[i]);
+			auto result = __m128i{};
+			if constexpr (op == Op::Union) {
+				result = _mm_or_si128(lhs, rhs);
+			} else if constexpr (op == Op::Intersection) {
+				result = _mm_and_si128(lhs, rhs);
+			} else if constexpr (op == Op::Difference) {
+				result = _mm_andnot_si128(rhs, lhs);
+			} else {
+				result = _mm_xor_si128(lhs, rhs);
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(&dst[i]), result);
+		}
+#endif
+		return i;
+	}
+
+	static bool isSubsetVectorized([[maybe_unused]] const words_t &set,
+								   [[maybe_unused]] const words_t &of,
+								   [[maybe_unused]] size_t &i) noexcept
+	{
+#if defined(__AVX2__)
+		for (; i + 4 <= cWords; i += 4) {
+			if (!_mm256_testc_si256(load256(&of[i]), load256(&set[i]))) {
+				return false;
+			}
+		}
+#endif
+#if defined(ENUM_SET_DETAIL_SSE2)
+		for (; i + 2 <= cWords; i += 2) {
+			if (!isZero(_mm_andnot_si128(load128(&of[i]), load128(&set[i])))) {
+				return false;
+			}
+		}
+#endif
+		return true;
+	}
+
+	static bool intersectsVectorized([[maybe_unused]] const words_t &lhs,
+									 [[maybe_unused]] const words_t &rhs,
+									 [[maybe_unused]] size_t &i) noexcept
+	{
+#if defined(__AVX2__)
+		for (; i + 4 <= cWords; i += 4) {
+			if (!_mm256_testz_si256(load256(&lhs[i]), load256(&rhs[i]))) {
+				return true;
+			}
+		}
+#endif
+#if defined(ENUM_SET_DETAIL_SSE2)
+		for (; i + 2 <= cWords; i += 2) {
+			if (!isZero(_mm_and_si128(load128(&lhs[i]), load128(&rhs[i])))) {
+				return true;
+			}
+		}
+#endif
+		return false;
+	}
+
+#if defined(__AVX2__)
+	static __m256i load256(const mask_t *src) noexcept
+	{
+		return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+	}
+#endif
+#if defined(ENUM_SET_DETAIL_SSE2)
+	static __m128i load128(const mask_t *src) noexcept
+	{
+		return _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+	}
+	static bool isZero(__m128i value) noexcept
+	{
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(value, _mm_setzero_si128())) == 0xFFFF;
+	}
+#endif
+
 	[[nodiscard]]
 	static constexpr Enum_ut to_index(Enum e) noexcept
 	{
@@ -128,15 +378,39 @@ private:
 		return static_cast<Enum>(idx);
 	}
 
+	[[nodiscard]]
+	static constexpr size_t wordOf(Enum e) noexcept
+	{
+		return static_cast<size_t>(to_index(e)) / cWordBits;
+	}
+
 	[[nodiscard]]
 	static constexpr mask_t bit(Enum e) noexcept
 	{
-		return mask_t(1) << to_index(e);
+		return mask_t(1) << (static_cast<size_t>(to_index(e)) % cWordBits);
 	}
 
 private:
-	static constexpr Enum_ut N = enumSize<Enum>();
-	static_assert(N <= cMaxCapacity, "enum_set supports up to 64 values");
+	words_t words{};
+};
 
-	mask_t bits = 0;
+template <CountedEnum Enum, typename Enum_ut>
+struct std::hash<enum_set<Enum, Enum_ut>>
+{
+	[[nodiscard]]
+	size_t operator()(const enum_set<Enum, Enum_ut> &set) const noexcept
+	{
+		uint64_t hash = 0;
+		for (const auto word : set.raw()) {
+			// splitmix64 finalizer over the running value, so equal words at different
+			// positions don't cancel out
+			uint64_t mixed = hash ^ word;
+			mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebULL;
+			hash = mixed ^ (mixed >> 31);
+		}
+		return static_cast<size_t>(hash);
+	}
 };
+
+#undef ENUM_SET_DETAIL_SSE2
@@ -1,9 +1,18 @@
 #pragma once
 
 #include <algorithm>
+#include <chrono>
 #include <concepts>
+#include <cstdint>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
 #include <ranges>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
 
 namespace fs = std::filesystem;
 
@@ -53,4 +62,189 @@ namespace fs_utils
 		}
 		return false;
 	}
+
+	// Cheap identity of a file's contents: it changes whenever the file is rewritten.
+	struct FileStamp
+	{
+		fs::file_time_type lastWrite{};
+		std::uintmax_t size{0};
+
+		[[nodiscard]]
+		bool operator==(const FileStamp &) const = default;
+
+		[[nodiscard]]
+		static auto of(const fs::path &file) -> std::optional<FileStamp>
+		{
+			auto ec = std::error_code{};
+			const auto lastWrite = fs::last_write_time(file, ec);
+			if (ec) {
+				return std::nullopt;
+			}
+			const auto size = fs::file_size(file, ec);
+			if (ec) {
+				return std::nullopt;
+			}
+			return FileStamp{.lastWrite = lastWrite, .size = size};
+		}
+	};
+
+	// Reads the whole file through a single open. With the right size hint (e.g. taken from
+	// a FileStamp) the buffer is allocated once and filled by a single read.
+	[[nodiscard]]
+	inline auto readFile(const fs::path &file, std::uintmax_t sizeHint = 0)
+		-> std::optional<std::string>
+	{
+		auto ifs = std::ifstream(file, std::ios::binary);
+		if (!ifs) {
+			return std::nullopt;
+		}
+		auto content = std::string(static_cast<size_t>(sizeHint), '\0');
+		ifs.read(content.data(), static_cast<std::streamsize>(content.size()));
+		content.resize(static_cast<size_t>(ifs.gcount()));
+
+		if (ifs) { // The file is longer than expected
+			content.append(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+		}
+		if (ifs.bad()) {
+			return std::nullopt;
+		}
+		return content;
+	}
+
+	// Remembers file stamps (including missing files) for a short time, so a script loaded
+	// over and over within a frame is stat'ed once. A change made to the file during the TTL
+	// goes unnoticed unless the file is invalidated. A zero TTL disables caching.
+	class StatCache
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		// Long enough to cover the loads of a frame, short enough for edited scripts to be
+		// picked up without a restart
+		static constexpr clock::duration cDefaultTtl = std::chrono::seconds(1);
+
+		explicit StatCache(clock::duration ttl = cDefaultTtl) : ttl(ttl) {}
+
+		[[nodiscard]]
+		auto stamp(const fs::path &file) -> std::optional<FileStamp>
+		{
+			if (ttl <= clock::duration::zero()) {
+				return FileStamp::of(file);
+			}
+			const auto now = clock::now();
+			auto [it, inserted] = entries.try_emplace(file.native());
+			auto &entry = it->second;
+			if (inserted || entry.expires <= now) {
+				entry.stamp = FileStamp::of(file);
+				entry.expires = now + ttl;
+			}
+			return entry.stamp;
+		}
+
+		void setTtl(clock::duration newTtl) noexcept { ttl = newTtl; }
+		[[nodiscard]]
+		auto getTtl() const noexcept -> clock::duration { return ttl; }
+
+		// The next stamp() of the file checks it again
+		void invalidate(const fs::path &file) { entries.erase(file.native()); }
+		void clear() noexcept { entries.clear(); }
+
+	private:
+		struct Entry
+		{
+			std::optional<FileStamp> stamp{};
+			clock::time_point expires{};
+		};
+
+		clock::duration ttl{};
+		std::unordered_map<fs::path::string_type, Entry> entries;
+	};
+
+	// Set of absolute directory roots stored as a trie of path components. Tells whether
+	// a path lies inside any of them without touching the file system (unlike startsWith(),
+	// which resolves both paths with fs::absolute() on every call).
+	class PathIndex
+	{
+	public:
+		// Relative roots are rejected: there is nothing to resolve them against.
+		bool insert(const fs::path &root)
+		{
+			if (root.empty() || !root.is_absolute()) {
+				return false;
+			}
+			size_t node = 0;
+			for (const auto &part : normalize(root)) {
+				node = findOrAddChild(node, part.native());
+			}
+			if (!nodes[node].isRoot) {
+				nodes[node].isRoot = true;
+				++roots;
+			}
+			return true;
+		}
+
+		[[nodiscard]]
+		bool contains(const fs::path &path) const
+		{
+			if (roots == 0 || !path.is_absolute()) {
+				return false;
+			}
+			size_t node = 0;
+			for (const auto &part : path.lexically_normal()) {
+				if (nodes[node].isRoot) {
+					return true;
+				}
+				node = findChild(node, part.native());
+				if (node == cNone) {
+					return false;
+				}
+			}
+			return nodes[node].isRoot;
+		}
+
+		[[nodiscard]]
+		bool empty() const noexcept { return roots == 0; }
+		[[nodiscard]]
+		size_t size() const noexcept { return roots; }
+
+		void clear()
+		{
+			nodes.assign(1, Node{});
+			roots = 0;
+		}
+
+	private:
+		static constexpr size_t cNone = static_cast<size_t>(-1);
+
+		struct Node
+		{
+			std::vector<std::pair<fs::path::string_type, size_t>> children{};
+			bool isRoot{false};
+		};
+
+		[[nodiscard]]
+		size_t findChild(size_t node, const fs::path::string_type &name) const
+		{
+			for (const auto &[childName, child] : nodes[node].children) {
+				if (childName == name) {
+					return child;
+				}
+			}
+			return cNone;
+		}
+
+		size_t findOrAddChild(size_t node, const fs::path::string_type &name)
+		{
+			if (const auto child = findChild(node, name); child != cNone) {
+				return child;
+			}
+			nodes.push_back(Node{});
+			nodes[node].children.emplace_back(name, nodes.size() - 1);
+			return nodes.size() - 1;
+		}
+
+	private:
+		std::vector<Node> nodes{Node{}};
+		size_t roots{0};
+	};
 } // namespace fs_utils
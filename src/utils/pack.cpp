@@ -0,0 +1,349 @@
+#include "utils/pack.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <tuple>
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace pack
+{
+	namespace
+	{
+		[[nodiscard]]
+		constexpr uint64_t alignUp(uint64_t value) noexcept
+		{
+			return (value + cAlignment - 1) & ~(cAlignment - 1);
+		}
+
+		// True if [offset, offset + size) lies within 'total', without overflowing.
+		[[nodiscard]]
+		constexpr bool fits(uint64_t offset, uint64_t size, uint64_t total) noexcept
+		{
+			return offset <= total && size <= total - offset;
+		}
+
+		[[nodiscard]]
+		auto sortKey(const DirEntry &entry, std::string_view name)
+		{
+			return std::tuple{entry.hash, name};
+		}
+	} // namespace
+/*-----------------------------------------------------------------------------------------------*/
+#if defined(_WIN32)
+	bool MappedFile::map(const fs::path &file) noexcept
+	{
+		unmap();
+
+		const HANDLE fileHandle = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+											  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (fileHandle == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		auto fileSize = LARGE_INTEGER{};
+		if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart <= 0) {
+			CloseHandle(fileHandle);
+			return false;
+		}
+		const HANDLE mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY,
+														0, 0, nullptr);
+		CloseHandle(fileHandle);
+		if (mappingHandle == nullptr) {
+			return false;
+		}
+		const void *view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mappingHandle); // The view keeps the mapping alive
+		if (view == nullptr) {
+			return false;
+		}
+		data = static_cast<const std::byte *>(view);
+		size = static_cast<size_t>(fileSize.QuadPart);
+		return true;
+	}
+
+	void MappedFile::unmap() noexcept
+	{
+		if (data != nullptr) {
+			UnmapViewOfFile(data);
+			data = nullptr;
+			size = 0;
+		}
+	}
+#else
+	bool MappedFile::map(const fs::path &file) noexcept
+	{
+		unmap();
+
+		const int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat info{};
+		if (::fstat(fd, &info) != 0 || info.st_size <= 0) {
+			::close(fd);
+			return false;
+		}
+		const auto fileSize = static_cast<size_t>(info.st_size);
+		void *view = ::mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // The mapping stays valid after the descriptor is closed
+		if (view == MAP_FAILED) {
+			return false;
+		}
+		data = static_cast<const std::byte *>(view);
+		size = fileSize;
+		return true;
+	}
+
+	void MappedFile::unmap() noexcept
+	{
+		if (data != nullptr) {
+			::munmap(const_cast<std::byte *>(data), size);
+			data = nullptr;
+			size = 0;
+		}
+	}
+#endif
+/*-----------------------------------------------------------------------------------------------*/
+	auto Archive::open(const fs::path &file) -> std::unique_ptr<Archive>
+	{
+		auto archive = std::unique_ptr<Archive>(new Archive());
+		archive->file = fs_utils::normalize(fs::absolute(file));
+
+		const auto stamp = fs_utils::FileStamp::of(archive->file);
+		if (!stamp || !archive->mapping.map(archive->file)) {
+			spdlog::error("Unable to map the pack file: \"{}\"", archive->file.string());
+			return nullptr;
+		}
+		archive->fileStamp = *stamp;
+
+		if (!archive->validate()) {
+			spdlog::error("Malformed pack file: \"{}\"", archive->file.string());
+			return nullptr;
+		}
+		return archive;
+	}
+
+	// Everything read from the mapping later on is checked here once, so lookups can trust
+	// offsets and sizes stored in the directory.
+	bool Archive::validate()
+	{
+		const auto bytes = mapping.bytes();
+		const uint64_t total = bytes.size();
+
+		if (total < sizeof(Header)) {
+			return false;
+		}
+		auto header = Header{};
+		std::memcpy(&header, bytes.data(), sizeof(Header));
+
+		if (header.magic != cMagic) {
+			spdlog::error("Pack: bad signature");
+			return false;
+		}
+		if (header.version != cVersion) {
+			spdlog::error("Pack: unsupported version {}", header.version);
+			return false;
+		}
+		const uint64_t directorySize = uint64_t{header.entriesCount} * sizeof(DirEntry);
+		if (header.directoryOffset % alignof(DirEntry) != 0
+			|| !fits(header.directoryOffset, directorySize, total)
+			|| !fits(header.namesOffset, header.namesSize, total)) {
+			spdlog::error("Pack: directory is out of bounds");
+			return false;
+		}
+		directory = {reinterpret_cast<const DirEntry *>(bytes.data() + header.directoryOffset),
+					 header.entriesCount};
+
+		namesBlob = {reinterpret_cast<const char *>(bytes.data() + header.namesOffset),
+					 static_cast<size_t>(header.namesSize)};
+		const DirEntry *prev = nullptr;
+		for (const auto &entry : directory) {
+			if (!fits(entry.nameOffset, entry.nameSize, header.namesSize)
+				|| !fits(entry.offset, entry.storedSize, total)) {
+				spdlog::error("Pack: entry is out of bounds");
+				return false;
+			}
+			const auto name = nameOf(entry);
+			if (entry.hash != hashName(name)) {
+				spdlog::error("Pack: bad hash of entry \"{}\"", name);
+				return false;
+			}
+			if (entry.compression == Compression::None && entry.size != entry.storedSize) {
+				spdlog::error("Pack: bad size of entry \"{}\"", name);
+				return false;
+			}
+			if (prev != nullptr && !(sortKey(*prev, nameOf(*prev)) < sortKey(entry, name))) {
+				spdlog::error("Pack: directory is not sorted at \"{}\"", name);
+				return false;
+			}
+			prev = &entry;
+		}
+		return true;
+	}
+
+	auto Archive::nameOf(const DirEntry &entry) const noexcept -> std::string_view
+	{
+		return namesBlob.substr(entry.nameOffset, entry.nameSize);
+	}
+
+	auto Archive::findEntry(std::string_view name) const -> const DirEntry *
+	{
+		const auto key = std::tuple{hashName(name), name};
+		const auto it = std::ranges::lower_bound(directory, key, {}, [this](const DirEntry &entry) {
+			return sortKey(entry, nameOf(entry));
+		});
+		if (it == directory.end() || it->hash != std::get<0>(key) || nameOf(*it) != name) {
+			return nullptr;
+		}
+		return &*it;
+	}
+
+	auto Archive::find(std::string_view name) const -> std::optional<std::span<const std::byte>>
+	{
+		const auto *entry = findEntry(name);
+		if (entry == nullptr) {
+			return std::nullopt;
+		}
+		if (entry->compression != Compression::None) {
+			spdlog::error("Pack: unsupported compression of entry \"{}\"", name);
+			return std::nullopt;
+		}
+		return mapping.bytes().subspan(entry->offset, entry->size);
+	}
+
+	auto Archive::names() const -> std::vector<std::string_view>
+	{
+		auto result = std::vector<std::string_view>{};
+		result.reserve(directory.size());
+		for (const auto &entry : directory) {
+			result.push_back(nameOf(entry));
+		}
+		return result;
+	}
+/*-----------------------------------------------------------------------------------------------*/
+	void Writer::add(std::string_view name, std::span<const std::byte> content)
+	{
+		auto entryContent = std::vector<std::byte>(content.begin(), content.end());
+		auto entry = Pending{.name = entryName(fs::path(name)), .content = std::move(entryContent)};
+
+		const auto it = std::ranges::find(entries, entry.name, &Pending::name);
+		if (it != entries.end()) {
+			*it = std::move(entry);
+			return;
+		}
+		entries.push_back(std::move(entry));
+	}
+
+	bool Writer::addFile(const fs::path &file, const fs::path &root)
+	{
+		const auto content = fs_utils::readFile(file);
+		if (!content) {
+			spdlog::error("Pack: unable to read \"{}\"", file.string());
+			return false;
+		}
+		add(entryName(file.lexically_relative(root)), std::string_view(*content));
+		return true;
+	}
+
+	bool Writer::addDirectory(const fs::path &root)
+	{
+		auto ec = std::error_code{};
+		auto it = fs::recursive_directory_iterator(root, ec);
+		if (ec) {
+			spdlog::error("Pack: unable to read directory \"{}\"", root.string());
+			return false;
+		}
+		for (const auto &item : it) {
+			if (item.is_regular_file() && !addFile(item.path(), root)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool Writer::write(const fs::path &file) const
+	{
+		if (entries.size() > std::numeric_limits<uint32_t>::max()) {
+			spdlog::error("Pack: too many entries");
+			return false;
+		}
+		auto order = std::vector<const Pending *>{};
+		order.reserve(entries.size());
+		for (const auto &entry : entries) {
+			if (entry.name.size() > std::numeric_limits<uint16_t>::max()) {
+				spdlog::error("Pack: entry name is too long: \"{}\"", entry.name);
+				return false;
+			}
+			order.push_back(&entry);
+		}
+		std::ranges::sort(order, {}, [](const Pending *entry) {
+			return std::tuple{hashName(entry->name), std::string_view(entry->name)};
+		});
+
+		auto header = Header{};
+		header.entriesCount = static_cast<uint32_t>(order.size());
+
+		auto directory = std::vector<DirEntry>{};
+		directory.reserve(order.size());
+		auto names = std::string{};
+
+		uint64_t offset = alignUp(sizeof(Header));
+		for (const auto *entry : order) {
+			directory.push_back({.hash = hashName(entry->name),
+								 .offset = offset,
+								 .size = entry->content.size(),
+								 .storedSize = entry->content.size(),
+								 .nameOffset = static_cast<uint32_t>(names.size()),
+								 .nameSize = static_cast<uint16_t>(entry->name.size())});
+			names += entry->name;
+			offset = alignUp(offset + entry->content.size());
+		}
+		header.directoryOffset = offset;
+		header.namesOffset = offset + directory.size() * sizeof(DirEntry);
+		header.namesSize = names.size();
+
+		auto ofs = std::ofstream(file, std::ios::binary | std::ios::trunc);
+		if (!ofs) {
+			spdlog::error("Pack: unable to create \"{}\"", file.string());
+			return false;
+		}
+		auto pad = [&ofs](uint64_t to) {
+			static constexpr auto zeros = std::array<char, cAlignment>{};
+			const auto at = static_cast<uint64_t>(ofs.tellp());
+			ofs.write(zeros.data(), static_cast<std::streamsize>(to - at));
+		};
+		ofs.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+		for (size_t i = 0; i < order.size(); ++i) {
+			pad(directory[i].offset);
+			ofs.write(reinterpret_cast<const char *>(order[i]->content.data()),
+					  static_cast<std::streamsize>(order[i]->content.size()));
+		}
+		pad(header.directoryOffset);
+		ofs.write(reinterpret_cast<const char *>(directory.data()),
+				  static_cast<std::streamsize>(directory.size() * sizeof(DirEntry)));
+		ofs.write(names.data(), static_cast<std::streamsize>(names.size()));
+
+		if (!ofs) {
+			spdlog::error("Pack: unable to write \"{}\"", file.string());
+			return false;
+		}
+		return true;
+	}
+} // namespace pack
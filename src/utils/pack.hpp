@@ -0,0 +1,186 @@
+#pragma once
+
+#include "utils/filesystem.hpp"
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*----------------------------------------------------------------------------
+--  Read-only pack of game data files
+--
+--  Layout (little-endian):
+--    Header
+--    Entry data, each entry starting at a cAlignment boundary
+--    Directory: Header::entriesCount DirEntry records sorted by (hash, name)
+--    Names: UTF-8 generic relative paths ("scripts/ai/peon.lua"), not terminated
+----------------------------------------------------------------------------*/
+namespace pack
+{
+	static_assert(std::endian::native == std::endian::little,
+				  "Pack records are read in place, which needs a little-endian host.");
+
+	constexpr auto cMagic = std::array<char, 4>{'Z', 'Z', 'P', 'K'};
+	constexpr uint16_t cVersion = 1;
+	constexpr uint64_t cAlignment = 16;
+
+	enum class Compression : uint8_t { None = 0 };
+
+	struct Header
+	{
+		std::array<char, 4> magic{cMagic};
+		uint16_t version{cVersion};
+		uint16_t flags{0};
+		uint32_t entriesCount{0};
+		uint32_t reserved{0};
+		uint64_t directoryOffset{0};
+		uint64_t namesOffset{0};
+		uint64_t namesSize{0};
+	};
+	static_assert(sizeof(Header) == 40);
+
+	struct DirEntry
+	{
+		uint64_t hash{0};
+		uint64_t offset{0};
+		uint64_t size{0};		// Unpacked size
+		uint64_t storedSize{0}; // Size in the pack, the same as 'size' when not compressed
+		uint32_t nameOffset{0};
+		uint16_t nameSize{0};
+		Compression compression{Compression::None};
+		uint8_t reserved{0};
+	};
+	static_assert(sizeof(DirEntry) == 40);
+
+	[[nodiscard]]
+	constexpr uint64_t hashName(std::string_view name) noexcept
+	{
+		uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+		for (const char c : name) {
+			hash ^= static_cast<unsigned char>(c);
+			hash *= 0x100000001b3ULL;
+		}
+		return hash;
+	}
+
+	// The name under which a file is stored: relative, normalized, with '/' separators.
+	[[nodiscard]]
+	inline auto entryName(const fs::path &relativePath) -> std::string
+	{
+		return fs_utils::normalize(relativePath).generic_string();
+	}
+/*-----------------------------------------------------------------------------------------------*/
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		~MappedFile() { unmap(); }
+
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+		MappedFile(MappedFile &&) = delete;
+		MappedFile &operator=(MappedFile &&) = delete;
+
+		bool map(const fs::path &file) noexcept;
+		void unmap() noexcept;
+
+		[[nodiscard]]
+		auto bytes() const noexcept -> std::span<const std::byte> { return {data, size}; }
+
+	private:
+		const std::byte *data{nullptr};
+		size_t size{0};
+	};
+/*-----------------------------------------------------------------------------------------------*/
+	// Pack file mapped into memory. Entries are handed out as views into the mapping,
+	// valid as long as the archive exists.
+	class Archive
+	{
+	public:
+		// Returns nullptr (the reason is logged) if the file can't be mapped or is malformed.
+		[[nodiscard]]
+		static auto open(const fs::path &file) -> std::unique_ptr<Archive>;
+
+		Archive(const Archive &) = delete;
+		Archive &operator=(const Archive &) = delete;
+		Archive(Archive &&) = delete;
+		Archive &operator=(Archive &&) = delete;
+		~Archive() = default;
+
+		[[nodiscard]]
+		auto find(std::string_view name) const -> std::optional<std::span<const std::byte>>;
+
+		[[nodiscard]]
+		auto findText(std::string_view name) const -> std::optional<std::string_view>
+		{
+			const auto bytes = find(name);
+			if (!bytes) {
+				return std::nullopt;
+			}
+			return std::string_view(reinterpret_cast<const char *>(bytes->data()), bytes->size());
+		}
+
+		[[nodiscard]]
+		bool contains(std::string_view name) const { return findEntry(name) != nullptr; }
+
+		[[nodiscard]]
+		size_t size() const noexcept { return directory.size(); }
+
+		[[nodiscard]]
+		auto names() const -> std::vector<std::string_view>;
+
+		// Identifies the pack contents, e.g. to validate chunks compiled from its entries.
+		[[nodiscard]]
+		auto stamp() const noexcept -> const fs_utils::FileStamp & { return fileStamp; }
+		[[nodiscard]]
+		auto path() const noexcept -> const fs::path & { return file; }
+
+	private:
+		Archive() = default;
+
+		[[nodiscard]]
+		bool validate();
+		[[nodiscard]]
+		auto nameOf(const DirEntry &entry) const noexcept -> std::string_view;
+		[[nodiscard]]
+		auto findEntry(std::string_view name) const -> const DirEntry *;
+
+	private:
+		fs::path file;
+		fs_utils::FileStamp fileStamp{};
+		MappedFile mapping;
+		std::span<const DirEntry> directory;
+		std::string_view namesBlob;
+	};
+/*-----------------------------------------------------------------------------------------------*/
+	class Writer
+	{
+	public:
+		void add(std::string_view name, std::span<const std::byte> content);
+		void add(std::string_view name, std::string_view content)
+		{
+			add(name, std::as_bytes(std::span(content.data(), content.size())));
+		}
+		bool addFile(const fs::path &file, const fs::path &root);
+
+		// Adds every regular file under the root, named by its path relative to the root.
+		bool addDirectory(const fs::path &root);
+
+		bool write(const fs::path &file) const;
+
+	private:
+		struct Pending
+		{
+			std::string name;
+			std::vector<std::byte> content;
+		};
+		std::vector<Pending> entries;
+	};
+} // namespace pack
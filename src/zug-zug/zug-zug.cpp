@@ -3,9 +3,15 @@
 #include <fmt/ranges.h>
 #include <spdlog/spdlog.h>
 
+#include "lua/precompile.hpp"
+
 #include "utils/filesystem.hpp"
+#include "utils/pack.hpp"
+
+#include <memory>
+#include <optional>
 
-void parseCmdLineArguments(int argc, char* argv[])
+auto parseCmdLineArguments(int argc, char* argv[]) -> std::optional<fs::path>
 {
 	auto options = cxxopts::Options{"Zug-Zug", 
 									"Just an engine for classical 2D RTS games. Dabu..."};
@@ -29,11 +35,32 @@ void parseCmdLineArguments(int argc, char* argv[])
 	if (parsed.count("data")) {
 		const auto dataPath = parsed["data"].as<fs::path>();
 		spdlog::info("Using given data path: \"{}\"", dataPath.string());
+		return dataPath;
 	}
+	return std::nullopt;
 }
 
 int zzMain(int argc, char* argv[])
 {
-	parseCmdLineArguments(argc, argv);
+	const auto dataPath = parseCmdLineArguments(argc, argv);
+
+	// Game data comes either as a pack file, mapped once for the whole run, or as loose files.
+	// Sandboxes running the game scripts take 'scriptsRoot' as their root and get the pack
+	// mounted (LuaSandbox::mountScriptsPack), so the warm-up below hits the same cache keys.
+	auto dataPack = std::unique_ptr<pack::Archive>{};
+	auto scriptsRoot = fs::path{};
+	if (dataPath && fs::is_regular_file(*dataPath)) {
+		dataPack = pack::Archive::open(*dataPath);
+		if (!dataPack) {
+			return 1;
+		}
+		spdlog::info("Data pack mounted: {} entries", dataPack->size());
+		scriptsRoot = dataPack->path();
+		lua::logReport(lua::precompileScripts(lua::ChunkCache::global(), *dataPack, scriptsRoot));
+	} else if (dataPath) {
+		spdlog::info("Using loose data files");
+		scriptsRoot = *dataPath;
+		lua::logReport(lua::precompileScripts(lua::ChunkCache::global(), scriptsRoot));
+	}
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "utils/filesystem.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+
+// Directory with a random name, so test cases run as separate processes don't clash.
+struct TempDir
+{
+	fs::path path;
+	TempDir()
+	{
+		path = fs::temp_directory_path() / ("zzTests_" + randomString(8));
+		if (fs::exists(path)) {
+			fs::remove_all(path);
+		}
+		fs::create_directories(path);
+	}
+	~TempDir() { fs::remove_all(path); }
+
+	void clear() { fs::remove_all(path); }
+
+	void write(const fs::path &file, std::string_view content) const
+	{
+		std::ofstream(path / file, std::ios::binary) << content;
+	}
+
+	std::string randomString(size_t length)
+	{
+		const auto chars = "0123456789abcdef";
+		auto rndDevice = std::random_device();
+		auto generator = std::mt19937(rndDevice());
+		auto distribution = std::uniform_int_distribution(0, 15);
+		auto result = std::string();
+		for (size_t i = 0; i < length; ++i) {
+			result += chars[distribution(generator)];
+		}
+		return result;
+	}
+};
@@ -0,0 +1,75 @@
+#include "utils/enum_map.hpp"
+
+#include <doctest/doctest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	enum class Resource { Gold, Lumber, Oil, Count };
+
+	constexpr auto startingResources = enum_map<Resource, int>{{Resource::Gold, 2000},
+															   {Resource::Lumber, 1000}};
+	static_assert(startingResources.size() == 2);
+	static_assert(startingResources.at(Resource::Gold) == 2000);
+	static_assert(startingResources.find(Resource::Oil) == nullptr);
+} // namespace
+
+TEST_CASE("enum_map: lookup and modification")
+{
+	auto names = enum_map<Resource, std::string>{{Resource::Oil, "oil"}, {Resource::Gold, "gold"}};
+
+	CHECK(names.size() == 2);
+	CHECK(names.contains(Resource::Gold));
+	CHECK_FALSE(names.contains(Resource::Lumber));
+	REQUIRE(names.find(Resource::Oil) != nullptr);
+	CHECK(*names.find(Resource::Oil) == "oil");
+	CHECK(names.find(Resource::Lumber) == nullptr);
+
+	names[Resource::Lumber] += "lumber";
+	CHECK(names.at(Resource::Lumber) == "lumber");
+
+	names.insert_or_assign(Resource::Gold, "GOLD");
+	CHECK(names.at(Resource::Gold) == "GOLD");
+
+	names.erase(Resource::Gold);
+	CHECK_FALSE(names.contains(Resource::Gold));
+	CHECK(names.size() == 2);
+
+	names.clear();
+	CHECK(names.empty());
+	CHECK(names.begin() == names.end());
+}
+
+TEST_CASE("enum_map: iterates over present keys in key order")
+{
+	auto counters = enum_map<Resource, int>{{Resource::Oil, 3}, {Resource::Gold, 1}};
+
+	auto keys = std::vector<Resource>{};
+	auto sum = 0;
+	for (const auto &[resource, count] : counters) {
+		keys.push_back(resource);
+		sum += count;
+	}
+	CHECK(keys == std::vector{Resource::Gold, Resource::Oil});
+	CHECK(sum == 4);
+
+	for (auto [resource, count] : counters) {
+		count *= 10;
+	}
+	CHECK(counters.at(Resource::Gold) == 10);
+	CHECK(counters.at(Resource::Oil) == 30);
+}
+
+TEST_CASE("enum_map: erased values are released")
+{
+	auto shared = std::make_shared<int>(42);
+	auto owners = enum_map<Resource, std::shared_ptr<int>>{};
+
+	owners[Resource::Gold] = shared;
+	CHECK(shared.use_count() == 2);
+
+	owners.erase(Resource::Gold);
+	CHECK(shared.use_count() == 1);
+}
@@ -0,0 +1,88 @@
+#include "utils/enum_set.hpp"
+
+#include <doctest/doctest.h>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+	enum class Color { Red, Green, Blue, Count };
+	enum class Upgrade : uint16_t { Armor1, Armor2 = 63, Weapons1 = 64, Weapons2 = 130, Last = 199, Count };
+
+	using Colors = enum_set<Color>;
+	using Upgrades = enum_set<Upgrade>;
+
+	static_assert(Colors::cWords == 1);
+	static_assert(Upgrades::cWords == 4);
+
+	constexpr auto requirements = Upgrades{Upgrade::Armor2, Upgrade::Weapons2};
+	constexpr auto researched = Upgrades{Upgrade::Armor1, Upgrade::Armor2, Upgrade::Weapons2};
+	static_assert(requirements.isSubsetOf(researched));
+	static_assert((researched - requirements) == Upgrades{Upgrade::Armor1});
+	static_assert((researched & requirements) == requirements);
+	static_assert((requirements | Upgrades{Upgrade::Last}).size() == 3);
+} // namespace
+
+TEST_CASE("enum_set: single word")
+{
+	auto colors = Colors{Color::Red, Color::Blue};
+
+	CHECK(colors.contains(Color::Red));
+	CHECK_FALSE(colors.contains(Color::Green));
+	CHECK(colors.size() == 2);
+
+	colors.erase(Color::Red);
+	CHECK(colors == Colors{Color::Blue});
+
+	colors.clear();
+	CHECK(colors.empty());
+	CHECK(colors.begin() == colors.end());
+}
+
+TEST_CASE("enum_set: values are spread over several words")
+{
+	auto upgrades = Upgrades{Upgrade::Last, Upgrade::Armor1, Upgrade::Weapons1, Upgrade::Armor2};
+
+	CHECK(upgrades.size() == 4);
+	CHECK(upgrades.contains(Upgrade::Armor2));
+	CHECK(upgrades.contains(Upgrade::Weapons1));
+	CHECK_FALSE(upgrades.contains(Upgrade::Weapons2));
+
+	const auto values = std::vector<Upgrade>(upgrades.begin(), upgrades.end());
+	CHECK(values == std::vector{Upgrade::Armor1, Upgrade::Armor2, Upgrade::Weapons1, Upgrade::Last});
+
+	upgrades.erase(Upgrade::Weapons1);
+	CHECK_FALSE(upgrades.contains(Upgrade::Weapons1));
+	CHECK(upgrades.size() == 3);
+}
+
+TEST_CASE("enum_set: set algebra")
+{
+	const auto lhs = Upgrades{Upgrade::Armor1, Upgrade::Weapons1, Upgrade::Last};
+	const auto rhs = Upgrades{Upgrade::Weapons1, Upgrade::Weapons2};
+
+	CHECK((lhs | rhs) == Upgrades{Upgrade::Armor1, Upgrade::Weapons1, Upgrade::Weapons2, Upgrade::Last});
+	CHECK((lhs & rhs) == Upgrades{Upgrade::Weapons1});
+	CHECK((lhs - rhs) == Upgrades{Upgrade::Armor1, Upgrade::Last});
+	CHECK((lhs ^ rhs) == Upgrades{Upgrade::Armor1, Upgrade::Weapons2, Upgrade::Last});
+
+	CHECK(lhs.intersects(rhs));
+	CHECK_FALSE((lhs - rhs).intersects(rhs));
+
+	CHECK(Upgrades{}.isSubsetOf(rhs));
+	CHECK((lhs & rhs).isSubsetOf(lhs));
+	CHECK_FALSE(lhs.isSubsetOf(rhs));
+	CHECK_FALSE(Upgrades{Upgrade::Last}.isSubsetOf(rhs));
+}
+
+TEST_CASE("enum_set: hash")
+{
+	const auto lhs = Upgrades{Upgrade::Armor1, Upgrade::Last};
+	const auto rhs = Upgrades{Upgrade::Last, Upgrade::Armor1};
+
+	CHECK(std::hash<Upgrades>{}(lhs) == std::hash<Upgrades>{}(rhs));
+
+	const auto sets = std::unordered_set<Upgrades>{lhs, rhs, Upgrades{}, Upgrades{Upgrade::Weapons1}};
+	CHECK(sets.size() == 3);
+	CHECK(sets.contains(Upgrades{Upgrade::Weapons1}));
+}
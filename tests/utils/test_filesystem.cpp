@@ -1,6 +1,10 @@
 #include "utils/filesystem.hpp"
 
+#include "temp_dir.hpp"
+
+#include <chrono>
 #include <doctest/doctest.h>
+#include <fstream>
 #include <vector>
 
 TEST_CASE("fs_utils: startsWith absolute base")
@@ -46,3 +50,80 @@ TEST_CASE("fs_utils: startsWith range of bases")
 	CHECK_FALSE(fs_utils::startsWith(fs::path(wrkDir / "../scripts/tileset"), allowedPaths));
 	CHECK_FALSE(fs_utils::startsWith(fs::path(wrkDir / "mods/../config.lua"), allowedPaths));
 }
+
+TEST_CASE("fs_utils: PathIndex matches paths inside its roots")
+{
+	const auto wrkDir = fs::path("/the/path/to/game/data");
+
+	auto index = fs_utils::PathIndex();
+	CHECK_FALSE(index.contains(wrkDir / "scripts/config.lua"));
+
+	REQUIRE(index.insert(wrkDir / "scripts/"));
+	REQUIRE(index.insert(wrkDir / "mods/../maps"));
+	CHECK_FALSE(index.insert("relative/root"));
+	CHECK(index.size() == 2);
+
+	REQUIRE(index.insert(wrkDir / "scripts"));
+	CHECK(index.size() == 2); // Already there
+
+	CHECK(index.contains(wrkDir / "scripts"));
+	CHECK(index.contains(wrkDir / "scripts/config.lua"));
+	CHECK(index.contains(wrkDir / "scripts/tileset/../ai.lua"));
+	CHECK(index.contains(wrkDir / "maps/arena.lua"));
+
+	CHECK_FALSE(index.contains(wrkDir / "config.lua"));
+	CHECK_FALSE(index.contains(wrkDir / "scriptsX/config.lua"));
+	CHECK_FALSE(index.contains(wrkDir / "mods/config.lua"));
+	CHECK_FALSE(index.contains(wrkDir / "scripts/../config.lua"));
+	CHECK_FALSE(index.contains("scripts/config.lua"));
+
+	index.clear();
+	CHECK(index.empty());
+	CHECK_FALSE(index.contains(wrkDir / "scripts/config.lua"));
+}
+
+TEST_CASE("fs_utils: StatCache keeps stamps for its TTL")
+{
+	const auto dir = TempDir();
+	const auto file = dir.path / "statCache.txt";
+
+	auto cache = fs_utils::StatCache(std::chrono::hours(1));
+	CHECK_FALSE(cache.stamp(file));
+
+	std::ofstream(file) << "data";
+	CHECK_FALSE(cache.stamp(file)); // The missing file is remembered as well
+
+	cache.clear();
+	const auto stamp = cache.stamp(file);
+	REQUIRE(stamp);
+	CHECK(stamp->size == 4);
+
+	std::ofstream(file) << "more data";
+	CHECK(cache.stamp(file)->size == 4);
+	cache.invalidate(file);
+	CHECK(cache.stamp(file)->size == 9);
+
+	cache.setTtl(fs_utils::StatCache::clock::duration::zero());
+	std::ofstream(file) << "even more data";
+	CHECK(cache.stamp(file)->size == 14);
+}
+
+TEST_CASE("fs_utils: StatCache caches by default")
+{
+	CHECK(fs_utils::StatCache().getTtl() > fs_utils::StatCache::clock::duration::zero());
+}
+
+TEST_CASE("fs_utils: readFile reads the whole file regardless of the size hint")
+{
+	const auto dir = TempDir();
+	const auto file = dir.path / "readFile.txt";
+	std::ofstream(file, std::ios::binary) << "return 42\n";
+
+	CHECK(fs_utils::readFile(file) == "return 42\n");
+	CHECK(fs_utils::readFile(file, 3) == "return 42\n");
+	CHECK(fs_utils::readFile(file, 10) == "return 42\n");
+	CHECK(fs_utils::readFile(file, 100) == "return 42\n");
+
+	fs::remove(file);
+	CHECK_FALSE(fs_utils::readFile(file));
+}
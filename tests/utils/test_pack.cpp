@@ -0,0 +1,86 @@
+#include "utils/pack.hpp"
+
+#include "temp_dir.hpp"
+
+#include <doctest/doctest.h>
+#include <fstream>
+#include <string_view>
+
+TEST_CASE("pack: written entries are found in the mapped archive")
+{
+	const auto dir = TempDir();
+	const auto packFile = dir.path / "roundtrip.pak";
+
+	auto writer = pack::Writer();
+	writer.add("scripts/ai/peon.lua", std::string_view("return 42"));
+	writer.add("scripts/../maps/forest.map", std::string_view("trees"));
+	writer.add("empty.txt", std::string_view(""));
+	REQUIRE(writer.write(packFile));
+
+	const auto archive = pack::Archive::open(packFile);
+	REQUIRE(archive);
+	CHECK(archive->size() == 3);
+
+	CHECK(archive->findText("scripts/ai/peon.lua") == "return 42");
+	CHECK(archive->findText("maps/forest.map") == "trees");
+	CHECK(archive->findText("empty.txt") == "");
+	CHECK(archive->contains("maps/forest.map"));
+
+	CHECK_FALSE(archive->find("scripts/ai"));
+	CHECK_FALSE(archive->find("scripts/ai/grunt.lua"));
+
+	const auto entry = archive->find("scripts/ai/peon.lua");
+	REQUIRE(entry);
+	CHECK(reinterpret_cast<uintptr_t>(entry->data()) % pack::cAlignment == 0);
+}
+
+TEST_CASE("pack: directory is packed with paths relative to its root")
+{
+	const auto dir = TempDir();
+	const auto root = dir.path / "data";
+	fs::create_directories(root / "scripts");
+	std::ofstream(root / "scripts/main.lua", std::ios::binary) << "print('zug-zug')";
+	std::ofstream(root / "readme.txt", std::ios::binary) << "dabu";
+
+	const auto packFile = dir.path / "data.pak";
+	auto writer = pack::Writer();
+	REQUIRE(writer.addDirectory(root));
+	REQUIRE(writer.write(packFile));
+
+	const auto archive = pack::Archive::open(packFile);
+	REQUIRE(archive);
+	CHECK(archive->size() == 2);
+	CHECK(archive->findText("scripts/main.lua") == "print('zug-zug')");
+	CHECK(archive->findText("readme.txt") == "dabu");
+}
+
+TEST_CASE("pack: malformed files are rejected")
+{
+	const auto dir = TempDir();
+	const auto packFile = dir.path / "malformed.pak";
+
+	SUBCASE("Missing file.")
+	{
+		CHECK_FALSE(pack::Archive::open(packFile));
+	}
+
+	SUBCASE("Not a pack.")
+	{
+		std::ofstream(packFile, std::ios::binary) << "definitely not a pack file, but long enough";
+		CHECK_FALSE(pack::Archive::open(packFile));
+	}
+
+	SUBCASE("Directory out of bounds.")
+	{
+		auto writer = pack::Writer();
+		writer.add("file.txt", std::string_view("content"));
+		REQUIRE(writer.write(packFile));
+		{
+			auto fstrm = std::fstream(packFile, std::ios::in | std::ios::out | std::ios::binary);
+			const auto badOffset = uint64_t{1} << 40;
+			fstrm.seekp(offsetof(pack::Header, directoryOffset));
+			fstrm.write(reinterpret_cast<const char *>(&badOffset), sizeof(badOffset));
+		}
+		CHECK_FALSE(pack::Archive::open(packFile));
+	}
+}
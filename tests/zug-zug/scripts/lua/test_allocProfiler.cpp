@@ -0,0 +1,113 @@
+#include "scripts/lua/alloc_profiler.hpp"
+#include "scripts/lua/runtime.hpp"
+
+#include <doctest/doctest.h>
+
+#include <sstream>
+
+using lua::memory::AllocProfiler;
+
+namespace
+{
+	constexpr auto script = R"(
+		function makeTables(count)
+			local t = {}
+			for i = 1, count do
+				t[i] = {i}
+			end
+			return t
+		end
+		keep = makeTables(2000)
+	)";
+
+	[[nodiscard]]
+	int64_t liveBytes(const AllocProfiler &profiler)
+	{
+		int64_t total = 0;
+		for (const auto &[stack, stats] : profiler.stacks()) {
+			total += stats.liveBytes;
+		}
+		return total;
+	}
+} // namespace
+
+TEST_CASE("Allocation profiler")
+{
+	LuaRuntime lua(4 * lua::memory::c1MB);
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+
+	lua.enableAllocProfiler(1); // Every allocation is a sample
+	REQUIRE(lua.getAllocProfiler() != nullptr);
+	const auto &profiler = *lua.getAllocProfiler();
+
+	REQUIRE(sandbox.run(script).valid());
+	REQUIRE_FALSE(profiler.stacks().empty());
+
+	SUBCASE("Allocations are attributed to the Lua call sites.")
+	{
+		const auto hotspots = profiler.hotspots(1);
+		REQUIRE(hotspots.size() == 1);
+		CHECK(hotspots.front().first.starts_with("[string"));
+		CHECK(hotspots.front().second.samples >= 2000);
+
+		std::ostringstream folded;
+		profiler.writeFolded(folded);
+		const auto text = folded.str();
+		// The hot site is called from the main chunk: two frames at least
+		CHECK(text.find("[string") != std::string::npos);
+		CHECK(text.find(';') != std::string::npos);
+	}
+	SUBCASE("Freed blocks leave the live bytes.")
+	{
+		const auto before = liveBytes(profiler);
+		CHECK(before > 0);
+
+		sandbox.run("keep = nil");
+		lua.collectGarbage();
+		CHECK(liveBytes(profiler) < before / 2);
+	}
+	SUBCASE("Failed allocations are counted.")
+	{
+		CHECK(profiler.failedAllocations() == 0);
+		CHECK_FALSE(sandbox.run("local t = {} for i = 1, 1e6 do t[i] = i end").valid());
+		CHECK(profiler.failedAllocations() > 0);
+	}
+	SUBCASE("The profiler survives a runtime reset.")
+	{
+		lua.reset();
+		CHECK(profiler.isAttached());
+		CHECK(profiler.stacks().empty());
+
+		LuaSandbox fresh(lua, LuaSandbox::Presets::Minimal);
+		REQUIRE(fresh.run(script).valid());
+		CHECK_FALSE(profiler.stacks().empty());
+	}
+	SUBCASE("Disabling puts the allocator back.")
+	{
+		lua.disableAllocProfiler();
+		CHECK(lua.getAllocProfiler() == nullptr);
+
+		void *data = nullptr;
+		CHECK(lua_getallocf(lua.state.lua_state(), &data) == lua::memory::limitedAlloc);
+		CHECK(sandbox.run(script).valid());
+	}
+}
+
+TEST_CASE("Allocation profiler: sampling")
+{
+	LuaRuntime lua;
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+
+	lua.enableAllocProfiler(16 * 1024);
+	REQUIRE(sandbox.run(script).valid());
+
+	const auto &profiler = *lua.getAllocProfiler();
+	uint64_t samples = 0;
+	for (const auto &[stack, stats] : profiler.stacks()) {
+		samples += stats.samples;
+		CHECK(stats.totalBytes % profiler.sampleInterval() == 0);
+	}
+	// 2000 small tables take some tens of Kb: a handful of samples, not one per table
+	CHECK(samples > 0);
+	CHECK(samples < 100);
+}
@@ -0,0 +1,132 @@
+#include "scripts/lua/runtime.hpp"
+
+#include "temp_dir.hpp"
+
+#include <doctest/doctest.h>
+#include <filesystem>
+#include <string>
+
+TEST_CASE("ChunkCache: runFile compiles the script once")
+{
+	const auto dir = TempDir();
+	dir.write("counter.lua", "counter = (counter or 0) + 1 return counter");
+
+	auto cache = lua::ChunkCache();
+	LuaRuntime lua;
+	lua.setChunkCache(&cache);
+
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom, dir.path, {dir.path});
+
+	for (int i = 1; i <= 3; ++i) {
+		auto result = sandbox.runFile(dir.path / "counter.lua");
+		REQUIRE(result.valid());
+		CHECK(result.get<int>() == i);
+	}
+	CHECK(cache.size() == 1);
+	CHECK(cache.stats().misses == 1);
+	CHECK(cache.stats().hits == 2);
+}
+
+TEST_CASE("ChunkCache: Cached chunks are shared between sandboxes and runtimes")
+{
+	const auto dir = TempDir();
+	dir.write("module.lua", "return { name = 'module' }");
+
+	auto cache = lua::ChunkCache();
+	LuaRuntime first;
+	LuaRuntime second;
+	first.setChunkCache(&cache);
+	second.setChunkCache(&cache);
+
+	LuaSandbox sandboxA(first, LuaSandbox::Presets::Custom, dir.path, {dir.path});
+	LuaSandbox sandboxB(second, LuaSandbox::Presets::Custom, dir.path, {dir.path});
+
+	sandboxA.run(R"(name = require_file("module.lua").name)");
+	sandboxB.run(R"(name = loadfile("module.lua")().name)");
+
+	CHECK(sandboxA["name"] == std::string("module"));
+	CHECK(sandboxB["name"] == std::string("module"));
+	CHECK(cache.stats().misses == 1);
+	CHECK(cache.stats().hits == 1);
+}
+
+TEST_CASE("ChunkCache: A rewritten file is compiled again")
+{
+	const auto dir = TempDir();
+	dir.write("value.lua", "return 1");
+
+	auto cache = lua::ChunkCache();
+	LuaRuntime lua;
+	lua.setChunkCache(&cache);
+
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom, dir.path, {dir.path});
+
+	REQUIRE(sandbox.runFile(dir.path / "value.lua").get<int>() == 1);
+
+	dir.write("value.lua", "return 22");
+
+	SUBCASE("Once its stamp is invalidated.")
+	{
+		lua.invalidateFileStamps(dir.path / "value.lua");
+	}
+	SUBCASE("Once its stamp expires.")
+	{
+		lua.setStatCacheTtl(std::chrono::milliseconds::zero());
+	}
+	REQUIRE(sandbox.runFile(dir.path / "value.lua").get<int>() == 22);
+
+	CHECK(cache.stats().misses == 2);
+	CHECK(cache.stats().hits == 0);
+	CHECK(cache.size() == 1);
+}
+
+TEST_CASE("ChunkCache: A hit reuses the file stamp while it's fresh")
+{
+	const auto dir = TempDir();
+	dir.write("value.lua", "return 1");
+
+	auto cache = lua::ChunkCache();
+	LuaRuntime lua;
+	lua.setChunkCache(&cache);
+	lua.setStatCacheTtl(std::chrono::hours(1));
+
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom, dir.path, {dir.path});
+
+	REQUIRE(sandbox.runFile(dir.path / "value.lua").get<int>() == 1);
+	dir.write("value.lua", "return 22");
+	CHECK(sandbox.runFile(dir.path / "value.lua").get<int>() == 1);
+	CHECK(cache.stats().hits == 1);
+}
+
+TEST_CASE("ChunkCache: A hit still respects the sandbox allowed paths")
+{
+	const auto dir = TempDir();
+	fs::create_directories(dir.path / "private");
+	dir.write("private/secret.lua", "return 'secret'");
+
+	auto cache = lua::ChunkCache();
+	LuaRuntime lua;
+	lua.setChunkCache(&cache);
+
+	LuaSandbox trusted(lua, LuaSandbox::Presets::Custom, dir.path, {dir.path});
+	LuaSandbox untrusted(lua, LuaSandbox::Presets::Custom, dir.path, {dir.path / "public"});
+
+	REQUIRE(trusted.runFile(dir.path / "private/secret.lua").valid());
+	CHECK_FALSE(untrusted.runFile(dir.path / "private/secret.lua").valid());
+	CHECK(cache.stats().hits == 0);
+}
+
+TEST_CASE("ChunkCache: Syntax errors are not cached")
+{
+	const auto dir = TempDir();
+	dir.write("broken.lua", "return (");
+
+	auto cache = lua::ChunkCache();
+	LuaRuntime lua;
+	lua.setChunkCache(&cache);
+
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom, dir.path, {dir.path});
+
+	CHECK_FALSE(sandbox.runFile(dir.path / "broken.lua").valid());
+	CHECK(cache.size() == 0);
+}
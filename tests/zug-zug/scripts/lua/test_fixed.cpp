@@ -0,0 +1,92 @@
+#include "scripts/lua/fixed.hpp"
+#include "scripts/lua/runtime.hpp"
+
+#include <doctest/doctest.h>
+
+#include <cstdlib>
+
+namespace fixed = lua::fixed;
+
+TEST_CASE("Fixed: arithmetic")
+{
+	static_assert(fixed::mul(fixed::fromInt(3), fixed::cOne / 2) == fixed::cOne * 3 / 2);
+	static_assert(fixed::div(fixed::fromInt(1), fixed::fromInt(4)) == fixed::cOne / 4);
+	static_assert(fixed::div(fixed::fromInt(-7), fixed::fromInt(2)) == -fixed::cOne * 7 / 2);
+	static_assert(fixed::sqrt(fixed::fromInt(16)) == fixed::fromInt(4));
+	static_assert(fixed::sqrt(-fixed::cOne) == 0);
+
+	CHECK(fixed::fromInt(1 << 20) == fixed::cMax);
+	CHECK(fixed::mul(fixed::cMax, fixed::fromInt(2)) == fixed::cMax);
+	CHECK(fixed::mul(fixed::cMin, fixed::fromInt(2)) == fixed::cMin);
+}
+
+TEST_CASE("Fixed: trigonometry")
+{
+	static_assert(fixed::detail::cSineTable.front() == 0);
+	static_assert(fixed::detail::cSineTable.back() == fixed::cOne);
+	static_assert(fixed::sin(0) == 0);
+	static_assert(fixed::cos(0) == fixed::cOne);
+
+	constexpr auto cTolerance = 4; // In 2^-16 units
+	CHECK(std::abs(fixed::sin(fixed::cHalfPi) - fixed::cOne) <= cTolerance);
+	CHECK(std::abs(fixed::sin(fixed::cPi)) <= cTolerance);
+	CHECK(std::abs(fixed::sin(-fixed::cHalfPi) + fixed::cOne) <= cTolerance);
+	CHECK(std::abs(fixed::cos(fixed::cPi) + fixed::cOne) <= cTolerance);
+	CHECK(std::abs(fixed::sin(fixed::cPi / 6) - fixed::cOne / 2) <= cTolerance);
+}
+
+TEST_CASE("Fixed: Lua side")
+{
+	LuaRuntime lua;
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom);
+	REQUIRE(sandbox.require(sol::lib::base));
+	REQUIRE(sandbox.require(lua::EngineLib::Fixed));
+
+	SUBCASE("Values are raw numbers.")
+	{
+		sandbox.run(R"(
+			half = fixed.ratio(1, 2)
+			sum = fixed.from(2) + half
+			product = fixed.mul(sum, fixed.from(2))
+			root = fixed.sqrt(fixed.from(9))
+			whole = fixed.floor(fixed.ratio(-3, 2))
+		)");
+		CHECK(sandbox["half"] == fixed::cOne / 2);
+		CHECK(sandbox["product"] == fixed::fromInt(5));
+		CHECK(sandbox["root"] == fixed::fromInt(3));
+		CHECK(sandbox["whole"] == -2);
+	}
+
+	SUBCASE("Results match the native ones.")
+	{
+		sandbox.run("s = fixed.sin(fixed.pi / 6)");
+		CHECK(sandbox["s"] == fixed::sin(fixed::cPi / 6));
+	}
+
+	SUBCASE("Invalid arguments raise errors.")
+	{
+		sandbox.run(R"(
+			divByZero = pcall(fixed.div, fixed.one, 0)
+			notIntegral = pcall(fixed.sqrt, 0.5)
+			outOfRange = pcall(fixed.from, 1e9)
+		)");
+		CHECK(sandbox["divByZero"] == false);
+		CHECK(sandbox["notIntegral"] == false);
+		CHECK(sandbox["outOfRange"] == false);
+	}
+}
+
+TEST_CASE("Fixed: deterministic preset")
+{
+	LuaRuntime lua;
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Deterministic);
+
+	CHECK_FALSE(sandbox["math"].valid());
+	CHECK_FALSE(sandbox["os"].valid());
+	CHECK(sandbox["fixed"].valid());
+	CHECK(sandbox["random"].valid());
+
+	sandbox.reset();
+	CHECK_FALSE(sandbox["math"].valid());
+	CHECK(sandbox["fixed"].valid());
+}
@@ -0,0 +1,135 @@
+#include "scripts/lua/gc_pacer.hpp"
+#include "scripts/lua/runtime.hpp"
+
+#include <doctest/doctest.h>
+
+#include <chrono>
+
+namespace gc = lua::gc;
+using namespace std::chrono_literals;
+
+namespace
+{
+	constexpr auto garbage = "for i = 1, 20000 do local t = {i, i + 1} end";
+
+	[[nodiscard]]
+	int heapKb(LuaRuntime &lua)
+	{
+		return lua_gc(lua.state.lua_state(), LUA_GCCOUNT, 0);
+	}
+} // namespace
+
+TEST_CASE("GC pacer: pause histogram")
+{
+	static_assert(gc::PauseHistogram::bucketOf(500ns) == 0);
+	static_assert(gc::PauseHistogram::bucketOf(1us) == 1);
+	static_assert(gc::PauseHistogram::bucketOf(3us) == 2);
+	static_assert(gc::PauseHistogram::bucketOf(1000us) == 10);
+	static_assert(gc::PauseHistogram::bucketOf(1h) == gc::PauseHistogram::cBuckets - 1);
+
+	auto histogram = gc::PauseHistogram{};
+	CHECK(histogram.percentile(0.5) == 0us);
+
+	for (int i = 0; i < 99; ++i) {
+		histogram.add(3us);
+	}
+	histogram.add(900us);
+
+	CHECK(histogram.count() == 100);
+	CHECK(histogram.max() == 900us);
+	CHECK(histogram.sum() == 99 * 3us + 900us);
+	CHECK(histogram.percentile(0.5) == 4us);
+	CHECK(histogram.percentile(0.99) == 4us);
+	CHECK(histogram.percentile(1.0) == 1024us);
+}
+
+TEST_CASE("GC pacer: collection runs only in the idle time")
+{
+	LuaRuntime lua;
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+	lua.enableGcPacer({.budget = 100ms});
+
+	const auto before = heapKb(lua);
+	sandbox.run(garbage);
+	sandbox.run(garbage);
+	const auto peak = heapKb(lua);
+	CHECK(peak > before + 1024); // Nothing was collected during the "ticks"
+
+	for (int i = 0; i < 100 && lua.getGcStats().cycles == 0; ++i) {
+		lua.collectIdle();
+	}
+	CHECK(lua.getGcStats().cycles > 0);
+	CHECK(lua.getGcStats().pauses.count() > 0);
+	CHECK(lua.getGcStats().steps.count() >= lua.getGcStats().pauses.count());
+	CHECK(heapKb(lua) < peak);
+
+	SUBCASE("Collection stays stopped after idle steps.")
+	{
+		const auto idleHeap = heapKb(lua);
+		sandbox.run(garbage);
+		CHECK(heapKb(lua) > idleHeap + 512);
+	}
+
+	SUBCASE("The pacer survives a runtime reset.")
+	{
+		lua.reset();
+		LuaSandbox fresh(lua, LuaSandbox::Presets::Minimal);
+		const auto freshHeap = heapKb(lua);
+		fresh.run(garbage);
+		CHECK(heapKb(lua) > freshHeap + 512);
+	}
+
+	SUBCASE("Disabling hands collection back to Lua.")
+	{
+		lua.disableGcPacer();
+		lua.collectGarbage();
+		const auto idleHeap = heapKb(lua);
+		sandbox.run(garbage);
+		sandbox.run(garbage);
+		CHECK(heapKb(lua) < idleHeap + 2048);
+		CHECK(lua.collectIdle() == 0ns);
+	}
+}
+
+TEST_CASE("GC pacer: memory pressure")
+{
+	constexpr size_t limit = 4 * lua::memory::c1MB;
+
+	LuaRuntime lua(limit);
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+	lua.enableGcPacer({.budget = 10us, .softPressure = 0.4, .hardPressure = 0.6});
+
+	auto fillUpTo = [&](double pressure, const char *script) {
+		for (int i = 0; i < 1000 && lua.getAllocatorState().used < limit * pressure; ++i) {
+			sandbox.run(script);
+		}
+		return lua.getAllocatorState().used >= limit * pressure;
+	};
+
+	SUBCASE("Garbage gets a full collection.")
+	{
+		REQUIRE(fillUpTo(0.65, "for i = 1, 1000 do local t = {i} end"));
+		lua.collectIdle();
+
+		CHECK(lua.getGcStats().fullCollections == 1);
+		CHECK(lua.getGcStats().fallbacks == 0);
+		CHECK(lua.getAllocatorState().used < limit / 2);
+	}
+
+	SUBCASE("Live data turns the automatic collection back on.")
+	{
+		sandbox.run("keep = {}");
+		REQUIRE(fillUpTo(0.65, "for i = 1, 1000 do keep[#keep + 1] = {i} end"));
+		lua.collectIdle();
+
+		CHECK(lua.getGcStats().fullCollections == 1);
+		CHECK(lua.getGcStats().fallbacks == 1);
+
+		sandbox.run("keep = nil");
+		lua.collectGarbage();
+		lua.collectIdle(); // Low pressure again: back to pacing
+		const auto used = lua.getAllocatorState().used;
+		sandbox.run("for i = 1, 1000 do local t = {i} end");
+		CHECK(lua.getAllocatorState().used > used);
+	}
+}
@@ -0,0 +1,129 @@
+#include "scripts/lua/quota.hpp"
+#include "scripts/lua/runtime.hpp"
+
+#include <doctest/doctest.h>
+
+#include <thread>
+#include <vector>
+
+namespace mem = lua::memory;
+
+TEST_CASE("Memory quota: hierarchy")
+{
+	auto process = mem::Quota("process", 4 * mem::cQuotaChunk);
+	auto match = mem::Quota("match", 2 * mem::cQuotaChunk, &process);
+	auto other = mem::Quota("other match", 0, &process);
+
+	CHECK(match.tryAcquire(mem::cQuotaChunk) == nullptr);
+	CHECK(process.used() == mem::cQuotaChunk);
+
+	SUBCASE("The match level trips first.")
+	{
+		CHECK(match.tryAcquire(2 * mem::cQuotaChunk) == &match);
+		CHECK(match.used() == mem::cQuotaChunk);
+		CHECK(process.used() == mem::cQuotaChunk);
+	}
+	SUBCASE("The process level trips for an unlimited match.")
+	{
+		CHECK(other.tryAcquire(3 * mem::cQuotaChunk) == nullptr);
+		CHECK(other.tryAcquire(1) == &process);
+		CHECK(other.used() == 3 * mem::cQuotaChunk);
+
+		other.release(3 * mem::cQuotaChunk);
+		CHECK(process.used() == mem::cQuotaChunk);
+	}
+	match.release(mem::cQuotaChunk);
+	CHECK(match.used() == 0);
+}
+
+TEST_CASE("Memory quota: credit is taken in chunks")
+{
+	auto match = mem::Quota("match", 4 * mem::cQuotaChunk);
+	auto allocState = mem::LimitedAllocatorState({.limit = 0});
+	mem::setQuota(allocState, &match);
+
+	void *small = mem::limitedAlloc(&allocState, nullptr, 0, 100);
+	REQUIRE(small != nullptr);
+	CHECK(allocState.credit == mem::cQuotaChunk);
+	CHECK(match.used() == mem::cQuotaChunk);
+
+	// Served from the credit: the quota isn't touched
+	void *more = mem::limitedAlloc(&allocState, nullptr, 0, 1000);
+	REQUIRE(more != nullptr);
+	CHECK(match.used() == mem::cQuotaChunk);
+
+	SUBCASE("Near the limit the exact amount is taken.")
+	{
+		const size_t rest = 4 * mem::cQuotaChunk - allocState.used - 100;
+		void *big = mem::limitedAlloc(&allocState, nullptr, 0, rest);
+		REQUIRE(big != nullptr);
+		CHECK(match.used() == 4 * mem::cQuotaChunk);
+
+		CHECK(mem::limitedAlloc(&allocState, nullptr, 0, 200) == nullptr);
+		CHECK(allocState.quotaReached);
+		CHECK_FALSE(allocState.limitReached);
+		CHECK(match.limitReached());
+
+		mem::limitedAlloc(&allocState, big, rest, 0);
+		CHECK(match.used() <= allocState.used + 2 * mem::cQuotaChunk);
+	}
+	mem::limitedAlloc(&allocState, more, 1000, 0);
+	mem::limitedAlloc(&allocState, small, 100, 0);
+	CHECK(allocState.used == 0);
+	CHECK(allocState.credit == 0);
+	CHECK(match.used() == 0);
+}
+
+TEST_CASE("Memory quota: runtimes on several threads")
+{
+	constexpr int threadsCount = 4;
+	auto process = mem::Quota("process");
+	auto match = mem::Quota("match", 0, &process);
+
+	{
+		auto threads = std::vector<std::jthread>{};
+		for (int idx = 0; idx < threadsCount; ++idx) {
+			threads.emplace_back([&match] {
+				LuaRuntime lua(8 * mem::c1MB);
+				CHECK(lua.setMemoryQuota(&match));
+				LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+				for (int i = 0; i < 20; ++i) {
+					sandbox.run("local t = {} for i = 1, 5000 do t[i] = {i} end");
+				}
+				CHECK(match.used() >= lua.getAllocatorState().used);
+				lua.reset();
+			});
+		}
+	}
+	// Every credit was given back when the states were closed
+	CHECK(match.used() == 0);
+	CHECK(process.used() == 0);
+}
+
+TEST_CASE("Memory quota: the runtime is stopped at the shared limit")
+{
+	auto match = mem::Quota("match", 2 * mem::c1MB);
+
+	LuaRuntime first(8 * mem::c1MB);
+	LuaRuntime second(8 * mem::c1MB);
+	REQUIRE(first.setMemoryQuota(&match));
+	REQUIRE(second.setMemoryQuota(&match));
+
+	LuaSandbox sandbox(first, LuaSandbox::Presets::Minimal);
+	LuaSandbox neighbour(second, LuaSandbox::Presets::Minimal);
+
+	CHECK_FALSE(sandbox.run("keep = {} for i = 1, 1e6 do keep[i] = {} end").valid());
+	CHECK(first.hasAllocError());
+	CHECK(first.getAllocatorState().quotaReached);
+	CHECK_FALSE(first.getAllocatorState().limitReached);
+	CHECK(match.limitReached());
+
+	// The memory is held by the first runtime until it's collected
+	CHECK_FALSE(neighbour.run("local t = {} for i = 1, 1e5 do t[i] = {} end").valid());
+	CHECK(second.getAllocatorState().quotaReached);
+
+	sandbox.run("keep = nil");
+	first.collectGarbage();
+	match.resetErrorFlags();
+	CHECK(neighbour.run("local t = {} for i = 1, 1e4 do t[i] = {} end").valid());
+}
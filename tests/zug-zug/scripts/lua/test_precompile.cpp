@@ -0,0 +1,70 @@
+#include "scripts/lua/precompile.hpp"
+#include "scripts/lua/runtime.hpp"
+
+#include "temp_dir.hpp"
+
+#include <doctest/doctest.h>
+#include <filesystem>
+#include <string>
+
+TEST_CASE("Precompile: scripts under the root are compiled into the cache")
+{
+	const auto dir = TempDir();
+	fs::create_directories(dir.path / "ai");
+	dir.write("main.lua", "return 'main'");
+	dir.write("ai/peon.lua", "return 'peon'");
+	dir.write("ai/grunt.lua", "return 'grunt'");
+	dir.write("ai/broken.lua", "return (");
+	dir.write("readme.txt", "not a script (");
+
+	auto cache = lua::ChunkCache();
+	const auto report = lua::precompileScripts(cache, dir.path, 3);
+
+	CHECK(report.compiled == 3);
+	CHECK(cache.size() == 3);
+	REQUIRE(report.errors.size() == 1);
+	CHECK(report.errors[0].file == dir.path / "ai/broken.lua");
+	CHECK_FALSE(report.errors[0].message.empty());
+
+	LuaRuntime lua;
+	lua.setChunkCache(&cache);
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom, dir.path, {dir.path});
+
+	auto result = sandbox.runFile(dir.path / "ai/peon.lua");
+	REQUIRE(result.valid());
+	CHECK(result.get<std::string>() == "peon");
+	CHECK(cache.stats().hits == 1);
+	CHECK(cache.stats().misses == 0);
+}
+
+TEST_CASE("Precompile: scripts of a mounted pack are compiled into the cache")
+{
+	const auto dir = TempDir();
+	const auto packFile = dir.path / "scripts.pak";
+
+	auto writer = pack::Writer();
+	writer.add("main.lua", std::string_view("return 'main'"));
+	writer.add("ai/broken.lua", std::string_view("return ("));
+	writer.add("maps/forest.map", std::string_view("trees"));
+	REQUIRE(writer.write(packFile));
+
+	const auto archive = pack::Archive::open(packFile);
+	REQUIRE(archive);
+
+	auto cache = lua::ChunkCache();
+	const auto report = lua::precompileScripts(cache, *archive, archive->path());
+
+	CHECK(report.compiled == 1);
+	REQUIRE(report.errors.size() == 1);
+	CHECK(report.errors[0].file == archive->path() / "ai/broken.lua");
+
+	LuaRuntime lua;
+	lua.setChunkCache(&cache);
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom, archive->path(), {archive->path()});
+	sandbox.mountScriptsPack(archive.get());
+
+	auto result = sandbox.runFile(archive->path() / "main.lua");
+	REQUIRE(result.valid());
+	CHECK(result.get<std::string>() == "main");
+	CHECK(cache.stats().hits == 1);
+}
@@ -0,0 +1,106 @@
+#include "scripts/lua/runtime.hpp"
+
+#include <doctest/doctest.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	struct CollectingSink final : lua::print::Sink
+	{
+		std::vector<std::string> lines;
+
+		void write(std::string_view line) noexcept override { lines.emplace_back(line); }
+	};
+} // namespace
+
+TEST_CASE("print: Values are formatted like tostring() does")
+{
+	LuaRuntime lua;
+	auto out = std::ostringstream();
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal, {}, {}, out);
+
+	sandbox.run(R"(
+		print("str", 42, 0.1, 1e100, true, nil, false)
+		print(setmetatable ~= nil)
+		print()
+	)");
+	CHECK(out.str() == "[lua sandbox]:> str 42 0.1 1e+100 true nil false\n"
+					   "[lua sandbox]:> false\n"
+					   "[lua sandbox]:> \n");
+}
+
+TEST_CASE("print: Tables use __tostring or their address")
+{
+	LuaRuntime lua;
+	lua.require(sol::lib::base);
+	auto sink = CollectingSink();
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal, {}, {}, sink);
+	sandbox["named"] = lua.state.safe_script(R"(
+		return setmetatable({}, { __tostring = function() return "named table" end })
+	)").get<sol::table>();
+
+	sandbox.run(R"(print(named, {}))");
+	REQUIRE(sink.lines.size() == 1);
+	CHECK(sink.lines[0].starts_with("[lua sandbox]:> named table table: "));
+}
+
+TEST_CASE("print: Rate limit suppresses lines over the budget")
+{
+	LuaRuntime lua;
+	auto sink = CollectingSink();
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal, {}, {}, sink);
+	sandbox.setPrintRateLimit({.linesPerSecond = 1, .burst = 5});
+
+	sandbox.run(R"(for i = 1, 100 do print(i) end)");
+	CHECK(sink.lines.size() == 5);
+	CHECK(sandbox.suppressedPrints() == 95);
+}
+
+TEST_CASE("print: Async sink writes lines from the logger thread")
+{
+	auto out = std::ostringstream();
+	{
+		auto sink = lua::print::AsyncSink(out, 4096);
+		LuaRuntime lua;
+		LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal, {}, {}, sink);
+
+		sandbox.run(R"(for i = 1, 1000 do print("line", i) end)");
+		sink.flush();
+		CHECK(sink.dropped() == 0);
+	}
+	auto in = std::istringstream(out.str());
+	size_t count = 0;
+	for (std::string line; std::getline(in, line);) {
+		++count;
+	}
+	CHECK(count == 1000);
+}
+
+TEST_CASE("print: Async sink drops lines when the buffer is full")
+{
+	auto out = std::ostringstream();
+	auto written = size_t{0};
+	auto dropped = size_t{0};
+	{
+		auto sink = lua::print::AsyncSink(out, 8);
+		auto producers = std::vector<std::jthread>{};
+		for (int t = 0; t < 4; ++t) {
+			producers.emplace_back([&sink] {
+				for (int i = 0; i < 1000; ++i) {
+					sink.write("line");
+				}
+			});
+		}
+		producers.clear();
+		sink.flush();
+		dropped = sink.dropped();
+	}
+	for (auto pos = out.str().find('\n'); pos != std::string::npos;
+		 pos = out.str().find('\n', pos + 1)) {
+		++written;
+	}
+	CHECK(written + dropped == 4000);
+}
@@ -0,0 +1,126 @@
+#include "scripts/lua/random.hpp"
+#include "scripts/lua/runtime.hpp"
+
+#include <doctest/doctest.h>
+
+TEST_CASE("Random: xoshiro256** reference output")
+{
+	auto rng = lua::random::Xoshiro256();
+	rng.setState({1, 2, 3, 4});
+
+	CHECK(rng.next() == 11520);
+	CHECK(rng.next() == 0);
+	CHECK(rng.next() == 1509978240);
+	CHECK(rng.next() == 1215971899390074240);
+}
+
+TEST_CASE("Random: state save and restore")
+{
+	auto rng = lua::random::Xoshiro256(42);
+	rng.next();
+
+	const auto saved = rng.save();
+	CHECK(saved.size() == lua::random::Xoshiro256::cSavedSize);
+
+	auto restored = lua::random::Xoshiro256();
+	REQUIRE(restored.restore(saved));
+	for (int i = 0; i < 8; ++i) {
+		CHECK(restored.next() == rng.next());
+	}
+	CHECK_FALSE(restored.restore("too short"));
+	CHECK_FALSE(restored.restore(std::string(lua::random::Xoshiro256::cSavedSize, '\0')));
+}
+
+TEST_CASE("Random: Lua side")
+{
+	LuaRuntime lua;
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom);
+	REQUIRE(sandbox.require(sol::lib::base));
+	REQUIRE(sandbox.require(lua::EngineLib::Random));
+
+	SUBCASE("Same seed gives the same sequence.")
+	{
+		sandbox.run(R"(
+			local a, b = random.new(7), random.new(7)
+			same = true
+			for i = 1, 100 do
+				if a:next(1000) ~= b:next(1000) then same = false end
+			end
+		)");
+		CHECK(sandbox["same"] == true);
+	}
+
+	SUBCASE("Values stay within the requested range.")
+	{
+		sandbox.run(R"(
+			local rng = random.new(1)
+			inRange = true
+			for i = 1, 1000 do
+				local f, n, mn = rng:next(), rng:next(6), rng:next(-3, 3)
+				if f < 0 or f >= 1 or n < 1 or n > 6 or mn < -3 or mn > 3 then inRange = false end
+			end
+			ok, err = pcall(function() return rng:next(5, 1) end)
+		)");
+		CHECK(sandbox["inRange"] == true);
+		CHECK(sandbox["ok"] == false);
+	}
+
+	SUBCASE("Bulk fill matches single values.")
+	{
+		sandbox.run(R"(
+			local a, b = random.new(3), random.new(3)
+			local values = b:fill({}, 64, 10, 20)
+			count = #values
+			same = true
+			for i = 1, 64 do
+				if values[i] ~= a:next(10, 20) then same = false end
+			end
+			tooMany = pcall(function() return b:fill({}, 2^20 + 1) end)
+		)");
+		CHECK(sandbox["count"] == 64);
+		CHECK(sandbox["same"] == true);
+		CHECK(sandbox["tooMany"] == false);
+	}
+
+	SUBCASE("Restored state replays the sequence.")
+	{
+		sandbox.run(R"(
+			local rng = random.new(99)
+			rng:next()
+			local saved = rng:save()
+			local first = rng:next(1000000)
+
+			local replay = random.new(0)
+			restored = replay:restore(saved)
+			same = replay:next(1000000) == first
+		)");
+		CHECK(sandbox["restored"] == true);
+		CHECK(sandbox["same"] == true);
+	}
+
+	SUBCASE("Streams differ.")
+	{
+		sandbox.run(R"(
+			local p1, p2 = random.new(5, 1), random.new(5, 2)
+			differ = p1:next(1000000000) ~= p2:next(1000000000)
+		)");
+		CHECK(sandbox["differ"] == true);
+	}
+
+	SUBCASE("The lib is read-only and survives reset.")
+	{
+		sandbox.run("ok = pcall(function() random.new = nil end)");
+		CHECK(sandbox["ok"] == false);
+
+		sandbox.reset();
+		sandbox.run("alive = random.new(1):next(2) ~= nil");
+		CHECK(sandbox["alive"] == true);
+	}
+}
+
+TEST_CASE("Random: only custom sandboxes may require it")
+{
+	LuaRuntime lua;
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Complete);
+	CHECK_FALSE(sandbox.require(lua::EngineLib::Random));
+}
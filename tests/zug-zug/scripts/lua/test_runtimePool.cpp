@@ -0,0 +1,141 @@
+#include "scripts/lua/runtime_pool.hpp"
+
+#include <cmath>
+#include <doctest/doctest.h>
+#include <future>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace marshal = lua::marshal;
+using PlainValue = marshal::PlainValue;
+using PlainTable = marshal::PlainTable;
+
+TEST_CASE("marshal: Plain values round trip through a Lua state")
+{
+	sol::state lua;
+
+	const auto original = PlainValue{PlainTable{
+		{"name", "peon"},
+		{"hp", 30},
+		{"alive", true},
+		{1, PlainTable{{"x", 1.5}, {"y", -2}}},
+	}};
+	const auto object = marshal::fromPlain(lua, original);
+	REQUIRE(object.get_type() == sol::type::table);
+
+	const auto copy = marshal::toPlain(object);
+	REQUIRE(copy);
+	REQUIRE(copy->find("name") != nullptr);
+	CHECK(copy->find("name")->as<std::string>() == "peon");
+	CHECK(copy->find("hp")->as<lua_Number>() == 30);
+	CHECK(copy->find("alive")->as<bool>());
+	CHECK(copy->find(1)->find("y")->as<lua_Number>() == -2);
+}
+
+TEST_CASE("marshal: Functions and cyclic tables are rejected")
+{
+	sol::state lua;
+	lua.open_libraries(sol::lib::base);
+
+	CHECK_FALSE(marshal::toPlain(lua.safe_script("return function() end").get<sol::object>()));
+	CHECK_FALSE(marshal::toPlain(lua.safe_script("local t = {} t.self = t return t")
+									 .get<sol::object>()));
+}
+
+TEST_CASE("LuaRuntimePool: Jobs run on workers and return plain results")
+{
+	auto pool = LuaRuntimePool({.workers = 4});
+	REQUIRE(pool.workersCount() == 4);
+
+	auto futures = std::vector<std::future<LuaRuntimePool::JobResult>>{};
+	for (int i = 0; i < 64; ++i) {
+		futures.push_back(pool.submit({
+			.preset = LuaSandbox::Presets::Complete,
+			.script = R"(
+				local sum = 0
+				for i = 1, input.count do sum = sum + i end
+				return { id = input.id, sum = sum }
+			)",
+			.input = PlainTable{{"id", i}, {"count", 1000 + i}},
+		}));
+	}
+	for (int i = 0; i < 64; ++i) {
+		const auto result = futures[i].get();
+		REQUIRE(result.ok);
+		const lua_Number count = 1000 + i;
+		CHECK(result.value.find("id")->as<lua_Number>() == i);
+		CHECK(result.value.find("sum")->as<lua_Number>() == count * (count + 1) / 2);
+	}
+}
+
+TEST_CASE("LuaRuntimePool: Timeouts and memory limits apply per job")
+{
+	auto pool = LuaRuntimePool({.workers = 2, .memoryLimit = 1024 * 1024, .timeout = 10ms});
+	// The memory limit has to be hit long before the timeout, whatever the machine
+	auto roomy = LuaRuntimePool({.workers = 1, .memoryLimit = 1024 * 1024, .timeout = 10s});
+
+	auto endless = pool.submit({.preset = LuaSandbox::Presets::Core,
+								.script = "while true do end"});
+	auto greedy = roomy.submit({.preset = LuaSandbox::Presets::Minimal,
+								.script = "local t = {} for i = 1, 1e7 do t[i] = i end"});
+	auto fine = pool.submit({.preset = LuaSandbox::Presets::Core, .script = "return input",
+							 .input = "still works"});
+
+	const auto endlessResult = endless.get();
+	CHECK_FALSE(endlessResult.ok);
+	CHECK(endlessResult.error.find("timed out") != std::string::npos);
+
+	const auto greedyResult = greedy.get();
+	CHECK_FALSE(greedyResult.ok);
+	CHECK(greedyResult.error.find("not enough memory") != std::string::npos);
+
+	const auto fineResult = fine.get();
+	REQUIRE(fineResult.ok);
+	CHECK(fineResult.value.as<std::string>() == "still works");
+
+	const auto afterGreedy = roomy.submit({.script = "return input", .input = "recovered"}).get();
+	REQUIRE(afterGreedy.ok);
+	CHECK(afterGreedy.value.as<std::string>() == "recovered");
+}
+
+TEST_CASE("LuaRuntimePool: Inputs the worker can't take fail the job only")
+{
+	auto pool = LuaRuntimePool({.workers = 1, .memoryLimit = 1024 * 1024});
+
+	const auto huge = pool.submit({.script = "return #input",
+								   .input = std::string(2 * 1024 * 1024, 'x')}).get();
+	CHECK_FALSE(huge.ok);
+	CHECK(huge.error.find("input") != std::string::npos);
+
+	// Lua tables can't hold NaN keys: they are dropped
+	const auto nanKey = pool.submit({.script = "return input.name",
+									 .input = PlainTable{{std::nan(""), 1}, {"name", "grunt"}}})
+							.get();
+	REQUIRE(nanKey.ok);
+	CHECK(nanKey.value.as<std::string>() == "grunt");
+}
+
+TEST_CASE("LuaRuntimePool: Coroutines don't escape the timeout")
+{
+	auto pool = LuaRuntimePool({.workers = 1, .timeout = 10ms});
+
+	const auto result = pool.submit({.preset = LuaSandbox::Presets::Complete,
+									 .script = R"(
+										 coroutine.wrap(function() while true do end end)()
+									 )"}).get();
+	CHECK_FALSE(result.ok);
+	CHECK(result.error.find("timed out") != std::string::npos);
+}
+
+TEST_CASE("LuaRuntimePool: Script globals don't leak between jobs")
+{
+	auto pool = LuaRuntimePool({.workers = 1});
+
+	REQUIRE(pool.submit({.script = "leaked = 42"}).get().ok);
+
+	const auto result = pool.submit({.script = "return leaked"}).get();
+	REQUIRE(result.ok);
+	CHECK(result.value.isNil());
+}
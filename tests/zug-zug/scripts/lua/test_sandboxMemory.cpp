@@ -0,0 +1,134 @@
+#include "scripts/lua/runtime.hpp"
+
+#include <doctest/doctest.h>
+
+namespace mem = lua::memory;
+
+namespace
+{
+	constexpr auto fill = "keep = {} for i = 1, 20000 do keep[i] = {i} end";
+} // namespace
+
+TEST_CASE("Sandbox memory: allocations are charged to the running sandbox")
+{
+	LuaRuntime lua(64 * mem::c1MB);
+	REQUIRE(lua.enableSandboxMemory());
+	LuaSandbox first(lua, LuaSandbox::Presets::Minimal);
+	LuaSandbox second(lua, LuaSandbox::Presets::Minimal);
+
+	REQUIRE(first.setMemoryLimit(0));
+	REQUIRE(second.setMemoryLimit(0));
+	REQUIRE(first.getMemoryUsage());
+
+	REQUIRE(first.run(fill).valid());
+	const auto charged = first.getMemoryUsage()->used;
+	CHECK(charged > 20000 * sizeof(void *));
+	CHECK(first.getMemoryUsage()->peak >= charged);
+	CHECK(second.getMemoryUsage()->used == 0);
+
+	SUBCASE("Freeing credits the owner, whoever triggers the collection.")
+	{
+		REQUIRE(first.run("keep = nil").valid());
+		REQUIRE(second.run(fill).valid());
+		lua.collectGarbage();
+		CHECK(first.getMemoryUsage()->used < charged / 10);
+		CHECK(second.getMemoryUsage()->used >= charged / 2);
+	}
+	SUBCASE("Host calls are charged within a memory scope.")
+	{
+		REQUIRE(second.run("function grow() other = {} for i = 1, 1000 do other[i] = {} end end")
+					.valid());
+		const auto before = second.getMemoryUsage()->used;
+		{
+			const auto scope = second.makeMemoryScope();
+			sol::protected_function grow = second["grow"];
+			REQUIRE(grow().valid());
+		}
+		CHECK(second.getMemoryUsage()->used > before);
+		CHECK(first.getMemoryUsage()->used <= charged); // Only its garbage may have gone
+	}
+}
+
+TEST_CASE("Sandbox memory: one sandbox can't starve the others")
+{
+	LuaRuntime lua(64 * mem::c1MB);
+	REQUIRE(lua.enableSandboxMemory());
+	LuaSandbox greedy(lua, LuaSandbox::Presets::Minimal);
+	LuaSandbox fair(lua, LuaSandbox::Presets::Minimal);
+	REQUIRE(greedy.setMemoryLimit(mem::c1MB));
+
+	CHECK_FALSE(greedy.run("hoard = {} for i = 1, 1e6 do hoard[i] = {} end").valid());
+	CHECK(greedy.getMemoryUsage()->limitReached);
+	CHECK(greedy.getMemoryUsage()->used <= mem::c1MB);
+	CHECK_FALSE(lua.hasAllocError()); // The runtime limit wasn't reached
+
+	CHECK(fair.run(fill).valid());
+	CHECK_FALSE(fair.getMemoryUsage());
+
+	greedy.resetMemoryErrors();
+	CHECK_FALSE(greedy.getMemoryUsage()->limitReached);
+}
+
+TEST_CASE("Sandbox memory: bookkeeping")
+{
+	SUBCASE("The limited allocator is required.")
+	{
+		LuaRuntime lua;
+		CHECK_FALSE(lua.enableSandboxMemory());
+		LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+		CHECK_FALSE(sandbox.setMemoryLimit(mem::c1MB));
+		CHECK_FALSE(sandbox.getMemoryUsage());
+	}
+	SUBCASE("Accounting has to be enabled on the runtime.")
+	{
+		LuaRuntime lua(64 * mem::c1MB);
+		LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+		CHECK_FALSE(sandbox.setMemoryLimit(mem::c1MB));
+	}
+	SUBCASE("Blocks of a destroyed sandbox are left to the state.")
+	{
+		LuaRuntime lua(64 * mem::c1MB);
+		REQUIRE(lua.enableSandboxMemory());
+		const mem::SandboxMemory *record = nullptr;
+		size_t charged = 0;
+		{
+			LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+			REQUIRE(sandbox.setMemoryLimit(0));
+			REQUIRE(sandbox.run(fill).valid());
+			record = &*sandbox.getMemoryUsage();
+			charged = record->used;
+		}
+		CHECK(lua.getAllocatorState().sandbox == nullptr);
+		CHECK(record->released);
+
+		lua.collectGarbage(); // The runtime keeps the record its blocks refer to
+		CHECK(record->used < charged / 10);
+	}
+	SUBCASE("Records with nothing charged to them are reused.")
+	{
+		LuaRuntime lua(64 * mem::c1MB);
+		REQUIRE(lua.enableSandboxMemory());
+		const mem::SandboxMemory *record = nullptr;
+		{
+			LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+			REQUIRE(sandbox.setMemoryLimit(mem::c1MB));
+			record = &*sandbox.getMemoryUsage();
+		}
+		LuaSandbox next(lua, LuaSandbox::Presets::Minimal);
+		REQUIRE(next.setMemoryLimit(0));
+		CHECK(&*next.getMemoryUsage() == record);
+		CHECK_FALSE(record->released);
+		CHECK(record->limit == 0);
+	}
+	SUBCASE("A runtime reset clears the charges.")
+	{
+		LuaRuntime lua(64 * mem::c1MB, mem::arenaAlloc);
+		REQUIRE(lua.enableSandboxMemory());
+		LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+		REQUIRE(sandbox.setMemoryLimit(0));
+		REQUIRE(sandbox.run(fill).valid());
+
+		lua.reset();
+		CHECK(sandbox.getMemoryUsage()->used == 0);
+	}
+}
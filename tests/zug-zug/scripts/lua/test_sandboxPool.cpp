@@ -0,0 +1,93 @@
+#include "scripts/lua/sandbox_pool.hpp"
+
+#include <doctest/doctest.h>
+#include <string>
+
+using Presets = LuaSandbox::Presets;
+
+TEST_CASE("LuaSandboxPool: Released sandbox is reused")
+{
+	LuaRuntime lua;
+	LuaSandboxPool pool(lua);
+
+	const LuaSandbox *first = nullptr;
+	{
+		auto sandbox = pool.acquire(Presets::Minimal);
+		REQUIRE(sandbox);
+		first = &*sandbox;
+		CHECK(pool.idleCount(Presets::Minimal) == 0);
+	}
+	CHECK(pool.idleCount(Presets::Minimal) == 1);
+
+	auto sandbox = pool.acquire(Presets::Minimal);
+	CHECK(&*sandbox == first);
+	CHECK(pool.idleCount(Presets::Minimal) == 0);
+
+	auto other = pool.acquire(Presets::Complete);
+	CHECK(&*other != first);
+}
+
+TEST_CASE("LuaSandboxPool: Recycled sandbox drops script globals")
+{
+	LuaRuntime lua;
+	LuaSandboxPool pool(lua);
+
+	{
+		auto sandbox = pool.acquire(Presets::Complete);
+		sandbox->run(R"(
+			counter = 42
+			print = nil
+			tostring = function() return "hijacked" end
+		)");
+	}
+	auto sandbox = pool.acquire(Presets::Complete);
+
+	CHECK_FALSE((*sandbox)["counter"].valid());
+	CHECK((*sandbox)["print"].valid());
+
+	auto result = sandbox->run(R"(return tostring(1), math.max(1, 2))");
+	REQUIRE(result.valid());
+	CHECK(result.get<std::string>(0) == "1");
+	CHECK(result.get<int>(1) == 2);
+}
+
+TEST_CASE("LuaSandboxPool: Libs required by a custom sandbox are dropped on recycle")
+{
+	LuaRuntime lua;
+	LuaSandboxPool pool(lua);
+
+	{
+		auto sandbox = pool.acquire(Presets::Custom);
+		REQUIRE(sandbox->require(sol::lib::string));
+		CHECK((*sandbox)["string"].valid());
+	}
+	auto sandbox = pool.acquire(Presets::Custom);
+	CHECK_FALSE((*sandbox)["string"].valid());
+	CHECK(sandbox->require(sol::lib::string));
+}
+
+TEST_CASE("LuaSandboxPool: Reserve and idle collection")
+{
+	LuaRuntime lua;
+	LuaSandboxPool pool(lua);
+
+	pool.reserve(Presets::Minimal, 4);
+	CHECK(pool.idleCount(Presets::Minimal) == 4);
+
+	for (int i = 0; i < 3; ++i) {
+		auto sandbox = pool.acquire(Presets::Minimal);
+		sandbox->run(R"(garbage = {} for i = 1, 1000 do garbage[i] = {} end)");
+	}
+	CHECK(pool.idleCount(Presets::Minimal) == 4);
+
+	bool cycleFinished = false;
+	for (int step = 0; step < 10'000 && !cycleFinished; ++step) {
+		cycleFinished = pool.collectIdle();
+	}
+	CHECK(cycleFinished);
+
+	auto handle = pool.acquire(Presets::Minimal);
+	handle.release();
+	CHECK_FALSE(handle);
+	CHECK(pool.idleCount(Presets::Minimal) == 4);
+}
@@ -1,40 +1,12 @@
 #include "scripts/lua/runtime.hpp"
 
+#include "temp_dir.hpp"
+
 #include <doctest/doctest.h>
 #include <filesystem>
 #include <fstream>
-#include <random>
 #include <string>
 
-struct TempDir
-{
-	fs::path path;
-	TempDir()
-	{
-		path = fs::temp_directory_path() / ("zzTests_" + randomString(8));
-		if (fs::exists(path)) {
-			fs::remove_all(path);
-		}
-		fs::create_directories(path);
-	}
-	~TempDir() { fs::remove_all(path); }
-
-	void clear() { fs::remove_all(path); }
-
-	std::string randomString(size_t length)
-	{
-		const auto chars = "0123456789abcdef";
-		auto rndDevice = std::random_device();
-		auto generator = std::mt19937(rndDevice());
-		auto distribution = std::uniform_int_distribution(0, 15);
-		auto result = std::string();
-		for (size_t i = 0; i < length; ++i) {
-			result += chars[distribution(generator)];
-		}
-		return result;
-	}
-};
-
 bool createScriptFile(const fs::path &fileName, const auto &script)
 {
 	if (std::ofstream ofs(fileName); ofs) {
@@ -171,6 +143,28 @@ TEST_CASE("LuaRuntime sandbox runs a script file: Cpp side.")
 		auto result = sandbox.runFile(fs::path(wrkDir / "bytecode.lua"));
 		CHECK_FALSE(result.valid());
 	}
+
+	SUBCASE("The first line is skipped when it starts with '#'.")
+	{
+		LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom, wrkDir, {wrkDir});
+
+		REQUIRE(createScriptFile(wrkDir / "shebang.lua", "#!/usr/bin/env lua\nreturn 42"));
+		REQUIRE(createScriptFile(wrkDir / "shebangOnly.lua", "# nothing else"));
+		REQUIRE(createScriptFile(wrkDir / "shebangError.lua",
+								 "#!/usr/bin/env lua\n\nerror('boom')"));
+
+		auto result = sandbox.runFile(fs::path(wrkDir / "shebang.lua"));
+		REQUIRE(result.valid());
+		CHECK(result.get<int>() == 42);
+
+		CHECK(sandbox.runFile(fs::path(wrkDir / "shebangOnly.lua")).valid());
+
+		// Line numbers still match the file
+		auto failed = sandbox.runFile(fs::path(wrkDir / "shebangError.lua"));
+		REQUIRE_FALSE(failed.valid());
+		const auto errMsg = std::string(sol::error{failed}.what());
+		CHECK(errMsg.find("shebangError.lua:3:") != std::string::npos);
+	}
 }
 
 TEST_CASE("LuaRuntime sandbox runs a script file: Lua side.")
@@ -440,4 +434,107 @@ TEST_CASE("LuaRuntime sandbox using 'require_file' to load files as modules: Lua
 		CHECK(sandbox["before"] == 42);
 		CHECK(sandbox["after"] == 13);
 	}
+
+	SUBCASE("Module is executed once and its result is shared.")
+	{
+		REQUIRE(createScriptFile(wrkDir / "modules/counted.lua", R"(
+			loads = (loads or 0) + 1
+			return { value = loads }
+		)"));
+		LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom, wrkDir, {wrkDir});
+
+		sandbox.run(R"(
+			first = require_file("modules/counted.lua")
+			second = require_file("modules/../modules/counted.lua")
+			same = first == second
+		)");
+		CHECK(sandbox["loads"] == 1);
+		CHECK(sandbox["same"] == true);
+
+		sandbox.reset();
+		sandbox.run(R"(third = require_file("modules/counted.lua"))");
+		CHECK(sandbox["loads"] == 1); // The environment was recreated along with the module cache
+		CHECK(sandbox["third"]["value"] == 1);
+	}
+
+	SUBCASE("Module is reloaded when its file changes.")
+	{
+		REQUIRE(createScriptFile(wrkDir / "modules/version.lua", "return 1"));
+		LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom, wrkDir, {wrkDir});
+
+		sandbox.run(R"(before = require_file("modules/version.lua"))");
+		REQUIRE(createScriptFile(wrkDir / "modules/version.lua", "return 222"));
+		lua.invalidateFileStamps();
+		sandbox.run(R"(after = require_file("modules/version.lua"))");
+
+		CHECK(sandbox["before"] == 1);
+		CHECK(sandbox["after"] == 222);
+	}
+
+	SUBCASE("Module requiring itself is reported as a loop.")
+	{
+		REQUIRE(createScriptFile(wrkDir / "modules/loop.lua", R"(
+			local result, err = require_file("modules/loop.lua")
+			loopErr = err
+			return "done"
+		)"));
+		LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom, wrkDir, {wrkDir});
+
+		sandbox.run(R"(result = require_file("modules/loop.lua"))");
+		CHECK(sandbox["result"] == std::string("done"));
+		REQUIRE(sandbox["loopErr"].valid());
+		CHECK(sandbox["loopErr"].is<std::string>());
+	}
+}
+
+TEST_CASE("LuaRuntime sandbox loads scripts from a mounted pack.")
+{
+	LuaRuntime lua;
+
+	const auto tmpDir = TempDir();
+	const auto wrkDir = fs::absolute(tmpDir.path / "scripts");
+	const auto packFile = tmpDir.path / "data.pak";
+
+	auto writer = pack::Writer();
+	writer.add("allowed.lua", std::string_view("bar = 42 return 'foo'"));
+	writer.add("modules/counted.lua", std::string_view("loads = (loads or 0) + 1 return loads"));
+	writer.add("forbidden/script.lua", std::string_view("return 'forbidden'"));
+	REQUIRE(writer.write(packFile));
+
+	const auto archive = pack::Archive::open(packFile);
+	REQUIRE(archive);
+
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom, wrkDir,
+					   {wrkDir / "allowed.lua", wrkDir / "modules"});
+	sandbox.mountScriptsPack(archive.get());
+
+	SUBCASE("Entry exists, path is allowed.")
+	{
+		auto result = sandbox.runFile(wrkDir / "allowed.lua");
+		REQUIRE(result.valid());
+		CHECK(result.get<std::string>() == "foo");
+		CHECK(sandbox["bar"] == 42);
+	}
+
+	SUBCASE("Modules are loaded once.")
+	{
+		sandbox.run(R"(
+			first = require_file("modules/counted.lua")
+			second = require_file("modules/counted.lua")
+		)");
+		CHECK(sandbox["loads"] == 1);
+		CHECK(sandbox["second"] == 1);
+	}
+
+	SUBCASE("Entry exists, path is forbidden.")
+	{
+		CHECK_FALSE(sandbox.runFile(wrkDir / "forbidden/script.lua").valid());
+	}
+
+	SUBCASE("Loose files are not used.")
+	{
+		fs::create_directories(wrkDir / "modules");
+		REQUIRE(createScriptFile(wrkDir / "modules/loose.lua", "return 1"));
+		CHECK_FALSE(sandbox.runFile(wrkDir / "modules/loose.lua").valid());
+	}
 }
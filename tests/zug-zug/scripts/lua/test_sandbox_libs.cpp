@@ -222,3 +222,34 @@ TEST_CASE("Multiple LuaRuntime sandboxes on the single LuaState")
 		sandbox.run(whoAmI);
 	}
 }
+
+TEST_CASE("LuaRuntime sandboxes share read-only lib tables")
+{
+	LuaRuntime lua;
+	LuaSandbox first(lua, LuaSandbox::Presets::Complete);
+	LuaSandbox second(lua, LuaSandbox::Presets::Complete);
+
+	const sol::table firstString = first["string"];
+	const sol::table secondString = second["string"];
+	CHECK(firstString == secondString);
+
+	auto result = first.run(R"(string.dump = function() end)");
+	CHECK_FALSE(result.valid());
+	CHECK_FALSE(second["string"]["dump"].valid());
+
+	// getmetatable() isn't available to sandboxes: the one of the runtime is used instead
+	lua.require(sol::lib::base);
+	const sol::protected_function getmetatable = lua.state["getmetatable"];
+	const sol::object meta = getmetatable(firstString);
+	CHECK(meta.get_type() == sol::type::boolean);
+	CHECK_FALSE(meta.as<bool>());
+
+	// The metatable is there, just hidden by its __metatable field
+	auto *L = lua.state.lua_state();
+	sol::stack::push(L, firstString);
+	CHECK(lua_getmetatable(L, -1) == 1);
+	lua_pop(L, 2);
+
+	first.run(R"(upper = string.upper("foo"))");
+	CHECK(first["upper"] == std::string("FOO"));
+}
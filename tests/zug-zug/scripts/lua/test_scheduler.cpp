@@ -0,0 +1,151 @@
+#include "scripts/lua/scheduler.hpp"
+
+#include <doctest/doctest.h>
+#include <string>
+
+using namespace std::chrono_literals;
+
+namespace sched = lua::scheduling;
+namespace timeout = lua::timeoutGuard;
+
+namespace
+{
+	auto makeTask(sol::state &lua, std::string_view body) -> sol::protected_function
+	{
+		return lua.safe_script("return function() " + std::string(body) + " end")
+			.get<sol::protected_function>();
+	}
+} // namespace
+
+TEST_CASE("scheduler: Instruction budget spreads a task across ticks")
+{
+	sol::state lua;
+	lua.open_libraries(sol::lib::base);
+
+	auto scheduler = sched::Scheduler(lua, 100);
+	const auto id = scheduler.spawn(makeTask(lua, R"(
+		local sum = 0
+		for i = 1, 100000 do sum = sum + i end
+		return sum
+	)"), {.instructions = 10'000});
+
+	size_t ticks = 0;
+	while (scheduler.tick() > 0) {
+		++ticks;
+		REQUIRE(ticks < 1'000);
+	}
+	REQUIRE(scheduler.status(id) == sched::TaskStatus::Finished);
+	CHECK(scheduler.result(id).as<double>() == 5000050000.0);
+
+	const auto &stats = scheduler.stats(id);
+	CHECK(ticks > 1);
+	CHECK(stats.slices == ticks + 1);
+	CHECK(stats.preemptions == ticks);
+	CHECK(stats.instructions >= 100'000);
+}
+
+TEST_CASE("scheduler: Time budget preempts a busy task")
+{
+	sol::state lua;
+	lua.open_libraries(sol::lib::base);
+
+	auto scheduler = sched::Scheduler(lua);
+	const auto id = scheduler.spawn(makeTask(lua, "while true do end"), {.time = 2ms});
+
+	for (int tick = 0; tick < 3; ++tick) {
+		CHECK(scheduler.tick() == 1);
+	}
+	CHECK(scheduler.status(id) == sched::TaskStatus::Ready);
+	CHECK(scheduler.stats(id).preemptions == 3);
+	CHECK(scheduler.stats(id).time >= 6ms);
+
+	scheduler.remove(id);
+	CHECK(scheduler.readyCount() == 0);
+}
+
+TEST_CASE("scheduler: Tasks take turns and may yield voluntarily")
+{
+	sol::state lua;
+	lua.open_libraries(sol::lib::base, sol::lib::coroutine, sol::lib::table);
+	lua["order"] = lua.create_table();
+
+	auto scheduler = sched::Scheduler(lua);
+	const auto first = scheduler.spawn(makeTask(lua, R"(
+		for i = 1, 3 do table.insert(order, "a"); coroutine.yield() end
+	)"));
+	const auto second = scheduler.spawn(makeTask(lua, R"(
+		for i = 1, 3 do table.insert(order, "b"); coroutine.yield() end
+	)"));
+
+	while (scheduler.tick() > 0) {}
+
+	CHECK(scheduler.status(first) == sched::TaskStatus::Finished);
+	CHECK(scheduler.status(second) == sched::TaskStatus::Finished);
+	CHECK(scheduler.stats(first).preemptions == 0);
+
+	const sol::table order = lua["order"];
+	REQUIRE(order.size() == 6);
+	CHECK(order[1].get<std::string>() == "a");
+	CHECK(order[2].get<std::string>() == "b");
+	CHECK(order[6].get<std::string>() == "b");
+}
+
+TEST_CASE("scheduler: Errors fail the task, preemption waits for C calls to return")
+{
+	sol::state lua;
+	lua.open_libraries(sol::lib::base);
+
+	auto scheduler = sched::Scheduler(lua, 10);
+	const auto failing = scheduler.spawn(makeTask(lua, "error('boom')"));
+	const auto inPcall = scheduler.spawn(makeTask(lua, R"(
+		local ok, sum = pcall(function()
+			local sum = 0
+			for i = 1, 10000 do sum = sum + i end
+			return sum
+		end)
+		assert(ok, sum)
+		for i = 1, 1000 do sum = sum + 1 end
+		return sum
+	)"), {.instructions = 100});
+
+	scheduler.tick();
+
+	CHECK(scheduler.status(failing) == sched::TaskStatus::Failed);
+	CHECK(scheduler.error(failing).find("boom") != std::string::npos);
+
+	// The budget ran out inside pcall: the task is paused right after it, not failed
+	CHECK(scheduler.status(inPcall) == sched::TaskStatus::Ready);
+	CHECK(scheduler.stats(inPcall).preemptions == 1);
+
+	size_t ticks = 0;
+	while (scheduler.tick() > 0) {
+		++ticks;
+		REQUIRE(ticks < 1'000);
+	}
+	REQUIRE(scheduler.status(inPcall) == sched::TaskStatus::Finished);
+	CHECK(scheduler.result(inPcall).as<double>() == 50006000.0);
+}
+
+TEST_CASE("scheduler: A watchdog armed around tick() times tasks out")
+{
+	sol::state lua;
+	lua.open_libraries(sol::lib::base);
+
+	auto mode = timeout::Mode::Hook;
+	SUBCASE("Hook mode.") { mode = timeout::Mode::Hook; }
+	SUBCASE("Monitor mode.") { mode = timeout::Mode::Monitor; }
+
+	auto watchdog = timeout::Watchdog(lua);
+	REQUIRE(watchdog.setMode(mode));
+
+	auto scheduler = sched::Scheduler(lua, 100);
+	const auto endless = scheduler.spawn(makeTask(lua, "while true do end"));
+	{
+		const auto guard = timeout::GuardedScope(watchdog, 20ms);
+		scheduler.tick();
+	}
+
+	REQUIRE(scheduler.status(endless) == sched::TaskStatus::Failed);
+	CHECK(scheduler.error(endless).find("timed out") != std::string::npos);
+	CHECK(lua_gethook(lua) == nullptr);
+}
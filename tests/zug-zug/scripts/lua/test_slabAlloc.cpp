@@ -0,0 +1,183 @@
+#include "scripts/lua/allocators.hpp"
+#include "scripts/lua/runtime.hpp"
+
+#include <cstring>
+#include <doctest/doctest.h>
+#include <string_view>
+
+namespace mem = lua::memory;
+
+TEST_CASE("slabAlloc: small blocks are recycled through the class free list")
+{
+	mem::SizeClassPool pool;
+	auto allocState = mem::LimitedAllocatorState({.limit = mem::c1MB, .pool = &pool});
+
+	void *ptr = mem::slabAlloc(&allocState, nullptr, 0, 24);
+	REQUIRE(ptr != nullptr);
+	CHECK(allocState.used == 24);
+	CHECK(pool.chunksCount() == 1);
+
+	mem::slabAlloc(&allocState, ptr, 24, 0);
+	CHECK(allocState.used == 0);
+
+	// Same size class (17..32 bytes) -> the freed block is handed out again
+	void *ptr2 = mem::slabAlloc(&allocState, nullptr, 0, 32);
+	CHECK(ptr2 == ptr);
+	CHECK(allocState.used == 32);
+
+	mem::slabAlloc(&allocState, ptr2, 32, 0);
+	CHECK(allocState.used == 0);
+}
+
+TEST_CASE("slabAlloc: realloc keeps contents across size classes and large blocks")
+{
+	mem::SizeClassPool pool;
+	auto allocState = mem::LimitedAllocatorState({.limit = mem::c1MB, .pool = &pool});
+
+	auto *ptr = static_cast<char *>(mem::slabAlloc(&allocState, nullptr, 0, 16));
+	REQUIRE(ptr != nullptr);
+	std::memcpy(ptr, "zug-zug", 8);
+
+	auto *grown = static_cast<char *>(mem::slabAlloc(&allocState, ptr, 16, 200));
+	REQUIRE(grown != nullptr);
+	CHECK(std::string_view(grown) == "zug-zug");
+	CHECK(allocState.used == 200);
+
+	auto *large = static_cast<char *>(mem::slabAlloc(&allocState, grown, 200, 4096));
+	REQUIRE(large != nullptr);
+	CHECK(std::string_view(large) == "zug-zug");
+	CHECK(allocState.used == 4096);
+
+	auto *shrunk = static_cast<char *>(mem::slabAlloc(&allocState, large, 4096, 8));
+	REQUIRE(shrunk != nullptr);
+	CHECK(std::string_view(shrunk, 7) == "zug-zug");
+	CHECK(allocState.used == 8);
+
+	mem::slabAlloc(&allocState, shrunk, 8, 0);
+	CHECK(allocState.used == 0);
+}
+
+TEST_CASE("slabAlloc: limitReached is set and block is kept on limit exceed")
+{
+	constexpr size_t limit = 64;
+
+	mem::SizeClassPool pool;
+	auto allocState = mem::LimitedAllocatorState({.limit = limit, .pool = &pool});
+
+	void *ptr = mem::slabAlloc(&allocState, nullptr, 0, limit);
+	REQUIRE(ptr != nullptr);
+
+	void *ptr2 = mem::slabAlloc(&allocState, ptr, limit, limit + 1);
+	CHECK(ptr2 == nullptr);
+	CHECK(allocState.used == limit);
+	CHECK(allocState.limitReached);
+	CHECK_FALSE(allocState.overflow);
+
+	mem::slabAlloc(&allocState, ptr, limit, 0);
+	CHECK(allocState.used == 0);
+}
+
+TEST_CASE("slabAlloc: + LuaRuntime: accounting matches the malloc-backed allocator")
+{
+	const auto script = R"(
+		placeHolder = {}
+		for i = 1, 4096 do
+			placeHolder[i] = { id = i, name = "unit #" .. i }
+		end
+	)";
+
+	LuaRuntime mallocLua(mem::cDefaultMemLimit * 8, mem::limitedAlloc);
+	LuaRuntime slabLua(mem::cDefaultMemLimit * 8, mem::slabAlloc);
+
+	CHECK(slabLua.getAllocatorState().used == mallocLua.getAllocatorState().used);
+
+	mallocLua.state.script(script);
+	slabLua.state.script(script);
+
+	CHECK(slabLua.getAllocatorState().used == mallocLua.getAllocatorState().used);
+}
+
+TEST_CASE("slabAlloc: + LuaRuntime: used memory reduced to initial value after runtime reset")
+{
+	LuaRuntime lua(mem::cDefaultMemLimit, mem::slabAlloc);
+
+	auto &allocState = lua.getAllocatorState();
+	const size_t initialUsed = allocState.used;
+
+	lua.state.script(R"(
+		placeHolder = {}
+		for i = 1, 8192 do
+			placeHolder[i] = "A string #" .. i
+		end
+	)");
+	CHECK(allocState.used > initialUsed);
+
+	lua.reset();
+	CHECK(allocState.used == initialUsed);
+}
+
+TEST_CASE("slabAlloc: + LuaSandbox on LuaRuntime: script returns error if memory limit exceeded")
+{
+	LuaRuntime lua(mem::cDefaultMemLimit, mem::slabAlloc);
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+
+	auto result = sandbox.run(R"(
+		placeHolder = {}
+		while true do
+			table.insert(placeHolder, {})
+		end
+	)");
+	CHECK_FALSE(result.valid());
+	CHECK(lua.getAllocatorState().limitReached);
+}
+
+TEST_CASE("arenaAlloc: region drops small and large blocks in one step")
+{
+	mem::SizeClassPool region(mem::SizeClassPool::Mode::Region);
+	auto allocState = mem::LimitedAllocatorState({.limit = mem::c1MB, .pool = &region});
+
+	void *small = mem::arenaAlloc(&allocState, nullptr, 0, 48);
+	void *large = mem::arenaAlloc(&allocState, nullptr, 0, 8192);
+	REQUIRE(small != nullptr);
+	REQUIRE(large != nullptr);
+	CHECK(allocState.used == 48 + 8192);
+
+	large = mem::arenaAlloc(&allocState, large, 8192, 16384);
+	REQUIRE(large != nullptr);
+	CHECK(allocState.used == 48 + 16384);
+
+	region.discardFrees();
+	mem::arenaAlloc(&allocState, small, 48, 0);
+	CHECK(allocState.used == 48 + 16384); // rebased by the owner of the region
+
+	region.release();
+	CHECK(region.chunksCount() == 0);
+	CHECK_FALSE(region.discardsFrees());
+}
+
+TEST_CASE("arenaAlloc: + LuaRuntime: used memory goes back to the baseline after reset")
+{
+	LuaRuntime lua(mem::cDefaultMemLimit * 8, mem::arenaAlloc);
+	REQUIRE(lua.usesArena());
+
+	auto &allocState = lua.getAllocatorState();
+	const size_t initialUsed = allocState.used;
+
+	for (auto i = 0; i < 3; ++i) {
+		lua.require(sol::lib::base);
+		lua.state.script(R"(
+			placeHolder = {}
+			for i = 1, 16384 do
+				placeHolder[i] = { name = "A string #" .. i }
+			end
+		)");
+		CHECK(allocState.used > initialUsed);
+
+		lua.reset();
+		CHECK(allocState.used == initialUsed);
+		CHECK_FALSE(lua.hasAllocError());
+	}
+	auto result = lua.state.safe_script("return 42");
+	REQUIRE(result.valid());
+	CHECK(result.get<int>() == 42);
+}
@@ -0,0 +1,152 @@
+#include "scripts/lua/runtime.hpp"
+#include "scripts/lua/snapshot.hpp"
+
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+	const auto world = R"(
+		players = {
+			{name = "orc\0grunt", gold = 150, pos = {x = 1.5, y = -2}},
+			{name = "peon", gold = 2^60, flags = {true, false}},
+		}
+		players[1].ally = players[2]
+		players[2].ally = players[1]
+		players.self = players
+		shared = players[1].pos
+		env = _G
+		fmt = string.format
+		print = nil
+		function onTick() return "tick" end
+		handlers = {name = "tick", onTick = onTick, [onTick] = true}
+	)";
+} // namespace
+
+TEST_CASE("Snapshot: round trip")
+{
+	LuaRuntime lua;
+	LuaSandbox source(lua, LuaSandbox::Presets::Complete);
+	REQUIRE(source.run(world).valid());
+	// setmetatable() isn't available to sandboxes
+	lua.require(sol::lib::base);
+	source["limits"] = lua.state.safe_script(R"(
+		return setmetatable({}, {__index = {max = 10}})
+	)").get<sol::table>();
+
+	auto writer = lua::snapshot::Writer(4096);
+	REQUIRE(source.saveSnapshot(writer));
+
+	SUBCASE("Into a sandbox of another runtime.")
+	{
+		LuaRuntime other;
+		LuaSandbox target(other, LuaSandbox::Presets::Complete);
+		REQUIRE(target.restoreSnapshot(writer.bytes()));
+
+		const auto result = target.run(R"(
+			assert(players[1].name == "orc\0grunt" and players[2].gold == 2^60)
+			assert(players[1].pos.x == 1.5 and players[1].pos.y == -2)
+			assert(players[2].flags[1] == true and players[2].flags[2] == false)
+			assert(players[1].ally == players[2] and players[2].ally == players[1])
+			assert(players.self == players and shared == players[1].pos)
+			assert(env == _G)
+			assert(fmt == string.format)
+			assert(limits.max == 10)
+			assert(print == nil)
+			assert(onTick == nil)
+			local fields = 0
+			for _ in pairs(handlers) do fields = fields + 1 end
+			assert(handlers.name == "tick" and fields == 1)
+		)");
+		CHECK(result.valid());
+	}
+
+	SUBCASE("Saving the same data gives the same bytes.")
+	{
+		const auto first = std::vector(writer.bytes().begin(), writer.bytes().end());
+		REQUIRE(source.saveSnapshot(writer));
+		CHECK(std::ranges::equal(first, writer.bytes()));
+	}
+
+	SUBCASE("An unchanged environment saves nothing but the header.")
+	{
+		LuaSandbox fresh(lua, LuaSandbox::Presets::Complete);
+		REQUIRE(fresh.saveSnapshot(writer));
+		CHECK(writer.bytes().size() == sizeof(lua::snapshot::Header) + 1);
+	}
+}
+
+TEST_CASE("Snapshot: values that can't be saved")
+{
+	LuaRuntime lua;
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Complete);
+	auto writer = lua::snapshot::Writer();
+
+	SUBCASE("Coroutines.")
+	{
+		sandbox.run("worker = coroutine.create(function() end)");
+		CHECK_FALSE(sandbox.saveSnapshot(writer));
+	}
+
+	SUBCASE("Too deeply nested tables.")
+	{
+		sandbox.run(R"(
+			deep = {}
+			local t = deep
+			for i = 1, 200 do t.next = {}; t = t.next end
+		)");
+		CHECK_FALSE(sandbox.saveSnapshot(writer));
+	}
+}
+
+TEST_CASE("Snapshot: natives bound by the host")
+{
+	LuaRuntime lua;
+	LuaSandbox source(lua, LuaSandbox::Presets::Minimal);
+	source["spawn"] = [](int count) { return count * 2; };
+	REQUIRE(source.run("handlers = {onSpawn = spawn}").valid());
+
+	auto writer = lua::snapshot::Writer();
+	CHECK_FALSE(source.saveSnapshot(writer)); // Not known to the sandbox yet
+
+	source.addSnapshotNative("spawn", source["spawn"]);
+	REQUIRE(source.saveSnapshot(writer));
+
+	LuaSandbox target(lua, LuaSandbox::Presets::Minimal);
+	target["spawn"] = [](int count) { return count * 3; };
+	target.addSnapshotNative("spawn", target["spawn"]);
+	REQUIRE(target.restoreSnapshot(writer.bytes()));
+
+	const auto result = target.run("return handlers.onSpawn == spawn and handlers.onSpawn(2)");
+	REQUIRE(result.valid());
+	CHECK(result.get<int>() == 6);
+}
+
+TEST_CASE("Snapshot: bad data leaves the environment as it was")
+{
+	LuaRuntime lua;
+	LuaSandbox source(lua, LuaSandbox::Presets::Complete);
+	source.run("score = 42; names = {'a', 'b', 'c'}");
+
+	auto writer = lua::snapshot::Writer();
+	REQUIRE(source.saveSnapshot(writer));
+	const auto bytes = writer.bytes();
+
+	LuaSandbox target(lua, LuaSandbox::Presets::Complete);
+	for (size_t size = 0; size < bytes.size(); ++size) {
+		CHECK_FALSE(target.restoreSnapshot(bytes.first(size)));
+	}
+	CHECK_FALSE(target["score"].valid());
+
+	SUBCASE("Natives missing from the target.")
+	{
+		source.run("fmt = string.format");
+		REQUIRE(source.saveSnapshot(writer));
+
+		LuaSandbox minimal(lua, LuaSandbox::Presets::Minimal);
+		CHECK_FALSE(minimal.restoreSnapshot(writer.bytes()));
+		CHECK_FALSE(minimal["score"].valid());
+	}
+}
@@ -0,0 +1,134 @@
+#include "scripts/lua/allocators.hpp"
+#include "scripts/lua/runtime.hpp"
+
+#include <cstring>
+#include <doctest/doctest.h>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace mem = lua::memory;
+
+TEST_CASE("threadCachedAlloc: freed blocks are reused by the same thread")
+{
+	mem::flushThreadCache();
+	auto allocState = mem::LimitedAllocatorState({.limit = mem::c1MB});
+
+	void *ptr = mem::threadCachedAlloc(&allocState, nullptr, 0, 24);
+	REQUIRE(ptr != nullptr);
+	CHECK(allocState.used == 24);
+	// The first allocation of a class brings a whole batch in
+	CHECK(mem::threadCachedBlocks() == mem::cThreadCacheBatch - 1);
+
+	mem::threadCachedAlloc(&allocState, ptr, 24, 0);
+	CHECK(allocState.used == 0);
+	CHECK(mem::threadCachedBlocks() == mem::cThreadCacheBatch);
+
+	// Same size class (17..32 bytes) -> the freed block is handed out again
+	void *ptr2 = mem::threadCachedAlloc(&allocState, nullptr, 0, 32);
+	CHECK(ptr2 == ptr);
+
+	mem::threadCachedAlloc(&allocState, ptr2, 32, 0);
+	mem::flushThreadCache();
+	CHECK(mem::threadCachedBlocks() == 0);
+}
+
+TEST_CASE("threadCachedAlloc: realloc keeps contents across size classes and large blocks")
+{
+	auto allocState = mem::LimitedAllocatorState({.limit = mem::c1MB});
+
+	auto *ptr = static_cast<char *>(mem::threadCachedAlloc(&allocState, nullptr, 0, 16));
+	REQUIRE(ptr != nullptr);
+	std::memcpy(ptr, "zug-zug", 8);
+
+	auto *grown = static_cast<char *>(mem::threadCachedAlloc(&allocState, ptr, 16, 200));
+	REQUIRE(grown != nullptr);
+	CHECK(std::string_view(grown) == "zug-zug");
+
+	auto *large = static_cast<char *>(mem::threadCachedAlloc(&allocState, grown, 200, 4096));
+	REQUIRE(large != nullptr);
+	CHECK(std::string_view(large) == "zug-zug");
+	CHECK(allocState.used == 4096);
+
+	auto *shrunk = static_cast<char *>(mem::threadCachedAlloc(&allocState, large, 4096, 8));
+	REQUIRE(shrunk != nullptr);
+	CHECK(std::string_view(shrunk, 7) == "zug-zug");
+	CHECK(allocState.used == 8);
+
+	mem::threadCachedAlloc(&allocState, shrunk, 8, 0);
+	CHECK(allocState.used == 0);
+}
+
+TEST_CASE("threadCachedAlloc: the cache gives blocks back in batches")
+{
+	constexpr size_t count = 4 * mem::cThreadCacheBatch;
+
+	mem::flushThreadCache();
+	auto allocState = mem::LimitedAllocatorState({.limit = mem::c1MB});
+
+	auto blocks = std::vector<void *>{};
+	for (size_t idx = 0; idx < count; ++idx) {
+		blocks.push_back(mem::threadCachedAlloc(&allocState, nullptr, 0, 64));
+		REQUIRE(blocks.back() != nullptr);
+	}
+	for (void *block : blocks) {
+		mem::threadCachedAlloc(&allocState, block, 64, 0);
+		CHECK(mem::threadCachedBlocks() < 2 * mem::cThreadCacheBatch);
+	}
+	CHECK(allocState.used == 0);
+	mem::flushThreadCache();
+}
+
+TEST_CASE("threadCachedAlloc: limitReached is set on limit exceed")
+{
+	constexpr size_t limit = 64;
+	auto allocState = mem::LimitedAllocatorState({.limit = limit});
+
+	void *ptr = mem::threadCachedAlloc(&allocState, nullptr, 0, limit);
+	REQUIRE(ptr != nullptr);
+
+	CHECK(mem::threadCachedAlloc(&allocState, ptr, limit, limit + 1) == nullptr);
+	CHECK(allocState.limitReached);
+	CHECK(allocState.used == limit);
+
+	mem::threadCachedAlloc(&allocState, ptr, limit, 0);
+	CHECK(allocState.used == 0);
+}
+
+TEST_CASE("threadCachedAlloc: runtimes on worker threads")
+{
+	constexpr int threadsCount = 4;
+
+	auto runtimes = std::vector<std::unique_ptr<LuaRuntime>>{};
+	for (int idx = 0; idx < threadsCount; ++idx) {
+		runtimes.push_back(std::make_unique<LuaRuntime>(16 * mem::c1MB, mem::threadCachedAlloc));
+	}
+	auto worker = [](LuaRuntime &lua) {
+		LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+		for (int i = 0; i < 10; ++i) {
+			auto result = sandbox.run(R"(
+				local units = {}
+				for i = 1, 2000 do
+					units[i % 64 + 1] = { id = i, pos = { x = i % 128, y = i % 96 } }
+				end
+				return #units
+			)");
+			CHECK(result.valid());
+		}
+	};
+	{
+		auto threads = std::vector<std::jthread>{};
+		for (auto &lua : runtimes) {
+			threads.emplace_back(worker, std::ref(*lua));
+		}
+	}
+	for (const auto &lua : runtimes) {
+		CHECK_FALSE(lua->hasAllocError());
+	}
+	// The states are closed on this thread: the blocks of the workers end up in its cache
+	runtimes.clear();
+	mem::flushThreadCache();
+	CHECK(mem::threadCachedBlocks() == 0);
+}
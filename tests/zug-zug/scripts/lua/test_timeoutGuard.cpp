@@ -1,8 +1,11 @@
 #include "scripts/lua/runtime.hpp"
 
+#include <array>
 #include <doctest/doctest.h>
 #include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 using namespace std::chrono_literals;
 
@@ -563,3 +566,153 @@ TEST_CASE("timeoutGuard: One runtime guard applies to multiple sandboxes on the
 		CHECK(contains(sol::error{bTimeout}.what(), "Script timed out"));
 	}
 }
+
+TEST_CASE("timeoutGuard: Monitor mode runs armed script with no hook and times out")
+{
+	sol::state lua;
+	lua.open_libraries(sol::lib::base);
+
+	auto watchdog = timeout::Watchdog(lua);
+	REQUIRE(watchdog.setMode(timeout::Mode::Monitor));
+
+	REQUIRE(watchdog.arm(5ms));
+	CHECK(watchdog.armed());
+	CHECK_FALSE(timeout::Watchdog::CtxRegistry::empty(lua));
+	CHECK(lua_gethook(lua.lua_state()) == nullptr);
+
+	auto result = lua.safe_script(R"(
+		while true do end
+	)");
+	REQUIRE_FALSE(result.valid());
+	CHECK(contains(sol::error{result}.what(), "Script timed out"));
+	CHECK(watchdog.timedOut());
+	CHECK(lua_gethook(lua.lua_state()) == timeout::expiredHook);
+
+	watchdog.disarm();
+	CHECK_FALSE(watchdog.armed());
+	CHECK(timeout::Watchdog::CtxRegistry::empty(lua));
+	CHECK(lua_gethook(lua.lua_state()) == nullptr);
+}
+
+TEST_CASE("timeoutGuard: Monitor mode can't be changed while armed")
+{
+	sol::state lua;
+
+	auto watchdog = timeout::Watchdog(lua);
+	REQUIRE(watchdog.arm(5ms));
+	CHECK_FALSE(watchdog.setMode(timeout::Mode::Monitor));
+	CHECK(watchdog.currentMode() == timeout::Mode::Hook);
+
+	watchdog.disarm();
+	CHECK(watchdog.setMode(timeout::Mode::Monitor));
+	CHECK(watchdog.currentMode() == timeout::Mode::Monitor);
+}
+
+TEST_CASE("timeoutGuard: Monitor mode watchdog re-armed to protect multiple executions")
+{
+	sol::state lua;
+	lua.open_libraries(sol::lib::base);
+
+	const auto boilerPlate = R"(
+		local sum = 1;
+		for i = 1, 10000 do
+			sum = sum + i
+		end
+		return sum
+	)";
+
+	auto watchdog = timeout::Watchdog(lua);
+	REQUIRE(watchdog.setMode(timeout::Mode::Monitor));
+	REQUIRE(watchdog.arm(5ms));
+
+	auto result1 = lua.safe_script(R"(
+		while true do end
+	)");
+	REQUIRE_FALSE(result1.valid());
+	CHECK(contains(sol::error{result1}.what(), "Script timed out"));
+
+	auto result2 = lua.safe_script(boilerPlate);
+	REQUIRE_FALSE(result2.valid());
+	CHECK(contains(sol::error{result2}.what(), "Script timed out"));
+
+	REQUIRE(watchdog.rearm(50ms));
+	CHECK(lua_gethook(lua.lua_state()) == nullptr);
+
+	auto result3 = lua.safe_script(boilerPlate);
+	CHECK(result3.valid());
+
+	watchdog.disarm();
+}
+
+TEST_CASE("timeoutGuard: Monitor mode reaches coroutines created while armed")
+{
+	LuaRuntime lua;
+	REQUIRE(lua.setTimeoutGuardMode(timeout::Mode::Monitor));
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Complete);
+
+	SUBCASE("coroutine.wrap")
+	{
+		auto scopeGuard = sandbox.makeTimeoutGuardedScope(5ms);
+		auto result = sandbox.run(R"(
+			coroutine.wrap(function() while true do end end)()
+		)");
+		REQUIRE_FALSE(result.valid());
+		CHECK(contains(sol::error{result}.what(), "Script timed out"));
+		CHECK(scopeGuard.timedOut());
+	}
+	SUBCASE("coroutine.create")
+	{
+		auto scopeGuard = sandbox.makeTimeoutGuardedScope(5ms);
+		auto result = sandbox.run(R"(
+			local co = coroutine.create(function() while true do end end)
+			local ok, err = coroutine.resume(co)
+			return err
+		)");
+		REQUIRE(result.valid());
+		CHECK(contains(result.get<std::string>(), "Script timed out"));
+	}
+	SUBCASE("The expired hook is removed on disarm")
+	{
+		{
+			auto scopeGuard = sandbox.makeTimeoutGuardedScope(5ms);
+			auto result = sandbox.run(R"(
+				counter = coroutine.wrap(function() while true do coroutine.yield(1) end end)
+				counter()
+				while true do end
+			)");
+			REQUIRE_FALSE(result.valid());
+		}
+		auto result = sandbox.run("return counter()");
+		REQUIRE(result.valid());
+		CHECK(result.get<int>() == 1);
+	}
+}
+
+TEST_CASE("timeoutGuard: Monitor mode guards runtimes on several threads at once")
+{
+	constexpr auto runtimesCount = 4;
+
+	auto timedOut = std::array<bool, runtimesCount>{};
+	auto workers = std::vector<std::thread>{};
+
+	for (auto i = 0; i < runtimesCount; ++i) {
+		workers.emplace_back([&timedOut, i] {
+			LuaRuntime lua;
+			lua.setTimeoutGuardMode(timeout::Mode::Monitor);
+			LuaSandbox sandbox(lua, LuaSandbox::Presets::Custom);
+
+			const auto limit = std::chrono::milliseconds(5 * (i + 1));
+			auto scopeGuard = sandbox.makeTimeoutGuardedScope(limit);
+			auto result = sandbox.run(R"(
+				while true do end
+			)");
+			timedOut[i] = !result.valid() && scopeGuard.timedOut();
+		});
+	}
+	for (auto &worker : workers) {
+		worker.join();
+	}
+	for (const auto isTimedOut : timedOut) {
+		CHECK(isTimedOut);
+	}
+}
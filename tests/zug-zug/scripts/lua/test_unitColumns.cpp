@@ -0,0 +1,105 @@
+#include "scripts/lua/runtime.hpp"
+#include "scripts/lua/unit_columns.hpp"
+
+#include <doctest/doctest.h>
+#include <memory>
+#include <vector>
+
+namespace
+{
+	using namespace lua::units;
+
+	auto makeSnapshot() -> std::shared_ptr<UnitsSnapshot>
+	{
+		auto units = std::make_shared<UnitsSnapshot>();
+		units->add({.id = 10, .x = 0.f, .y = 0.f, .hp = 60, .owner = 1, .type = 3});
+		units->add({.id = 11, .x = 3.f, .y = 4.f, .hp = 40, .owner = 2, .type = 3});
+		units->add({.id = 12, .x = 30.f, .y = 0.f, .hp = 90, .owner = 2, .type = 7});
+		return units;
+	}
+} // namespace
+
+TEST_CASE("UnitColumns: C++ queries")
+{
+	const auto units = makeSnapshot();
+	auto rows = std::vector<uint32_t>{};
+
+	selectInRadius(*units, 0.f, 0.f, 5.f, rows);
+	CHECK(rows == std::vector<uint32_t>{0, 1});
+
+	selectInRadius(*units, 100.f, 100.f, 5.f, rows);
+	CHECK(rows.empty());
+
+	selectByOwner(*units, 2, rows);
+	CHECK(rows == std::vector<uint32_t>{1, 2});
+}
+
+TEST_CASE("UnitColumns: Lua side")
+{
+	LuaRuntime lua;
+	LuaSandbox sandbox(lua, LuaSandbox::Presets::Minimal);
+
+	auto columns = UnitColumns(lua.state);
+	sandbox["units"] = columns.object();
+
+	SUBCASE("Nothing published yet.")
+	{
+		sandbox.run("count = #units");
+		CHECK(sandbox["count"] == 0);
+	}
+
+	SUBCASE("Columns are read by row.")
+	{
+		columns.publish(makeSnapshot());
+		sandbox.run(R"(
+			count = units:count()
+			id, x, y, hp, owner, kind = units:unit(2)
+			lastHp = units:hp(#units)
+			missing = units:hp(4)
+		)");
+		CHECK(sandbox["count"] == 3);
+		CHECK(sandbox["id"] == 11);
+		CHECK(sandbox["x"] == 3);
+		CHECK(sandbox["y"] == 4);
+		CHECK(sandbox["hp"] == 40);
+		CHECK(sandbox["owner"] == 2);
+		CHECK(sandbox["kind"] == 3);
+		CHECK(sandbox["lastHp"] == 90);
+		CHECK_FALSE(sandbox["missing"].valid());
+	}
+
+	SUBCASE("Filters return rows and reuse the given table.")
+	{
+		columns.publish(makeSnapshot());
+		sandbox.run(R"(
+			local rows = units:ofOwner(2)
+			enemies = #rows
+			firstEnemy = units:id(rows[1])
+
+			local reused = units:inRadius(0, 0, 1, rows)
+			same = reused == rows
+			near = #reused
+			nearId = units:id(reused[1])
+		)");
+		CHECK(sandbox["enemies"] == 2);
+		CHECK(sandbox["firstEnemy"] == 11);
+		CHECK(sandbox["same"] == true);
+		CHECK(sandbox["near"] == 1);
+		CHECK(sandbox["nearId"] == 10);
+	}
+
+	SUBCASE("Publishing replaces the snapshot seen by scripts.")
+	{
+		columns.publish(makeSnapshot());
+		sandbox.run("before = #units");
+
+		auto next = std::make_shared<UnitsSnapshot>();
+		next->add({.id = 99});
+		columns.publish(next);
+		sandbox.run("after = #units; afterId = units:id(1)");
+
+		CHECK(sandbox["before"] == 3);
+		CHECK(sandbox["after"] == 1);
+		CHECK(sandbox["afterId"] == 99);
+	}
+}